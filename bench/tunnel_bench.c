@@ -0,0 +1,731 @@
+/**
+ * tunnel_bench.c - benchmark del camino de datos del túnel
+ *
+ * Levanta un reactor con el código real de socks5_conn y le hace atravesar
+ * tráfico cliente→origen. Cada flujo negocia SOCKS5 (sin autenticación) con
+ * un CONNECT a un origen en loopback que atiende el propio benchmark, y
+ * después envía su parte de los datos en bloques de `chunk' bytes. El lado
+ * del cliente es un socketpair(2) o una conexión TCP por loopback; el del
+ * origen siempre es TCP, porque lo abre el túnel con connect(2).
+ *
+ * Recorre todas las combinaciones de modo, tope de buffer, tamaño de bloque,
+ * cantidad de flujos y disector, y escribe una línea CSV por combinación:
+ *
+ *   mode,buffer,chunk,flows,dissector,bytes,seconds,gbps,ops_per_mb,p50_us,p99_us
+ *
+ *  - buffer: clase de tamaño más grande a la que puede crecer el buffer de
+ *    cada dirección (ver tunnel_set_buffer_max); la memoria total alcanza
+ *    para que todos los flujos lleguen a ella.
+ *  - ops_per_mb: operaciones del reactor por MiB transferido: iteraciones
+ *    del selector, cambios de interés aplicados y lecturas/escrituras del
+ *    túnel. Con epoll cada una es una syscall; io_uring agrupa los cambios
+ *    de interés y la espera en una sola.
+ *  - p50_us, p99_us: desde que se empieza a escribir un bloque del lado del
+ *    cliente hasta que llega su último byte al origen, con hasta
+ *    BENCH_WINDOW bloques en vuelo por flujo.
+ *
+ * Con disector el origen escucha en BENCH_SNIFF_PORT, uno de los puertos en
+ * los que el túnel inspecciona HTTP.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../src/helpers/selector.h"
+#include "../src/helpers/metrics.h"
+#include "../src/helpers/parser.h"
+#include "../src/socks5/socks5.h"
+#include "../src/tunnel/tunnel.h"
+
+#define BENCH_WINDOW      16
+#define BENCH_SNIFF_PORT  8888
+#define BENCH_MAX_VALUES  16
+#define BENCH_MAX_FLOWS   1024
+#define BENCH_READ_SIZE   (256 * 1024)
+#define BENCH_MAX_CHUNK   (16 * 1024 * 1024)
+
+#define NS_PER_SEC 1000000000ULL
+
+enum bench_mode {
+    MODE_SOCKETPAIR,
+    MODE_TCP,
+};
+
+static const char *mode_names[] = {
+    [MODE_SOCKETPAIR] = "socketpair",
+    [MODE_TCP]        = "tcp",
+};
+
+struct bench_values {
+    unsigned long v[BENCH_MAX_VALUES];
+    size_t n;
+};
+
+struct bench_config {
+    struct bench_values modes;
+    struct bench_values buffers;
+    struct bench_values chunks;
+    struct bench_values flows;
+    struct bench_values dissector;
+    /** bytes por corrida, repartidos entre los flujos */
+    unsigned long total;
+    bool edge_triggered;
+};
+
+struct bench_flow {
+    /** entrega el extremo del proxy al reactor (ver flow_attach) */
+    struct selector_completion attach;
+    int proxy_fd;
+    int client_fd;
+    int origin_fd;
+
+    size_t total;
+    size_t sent;
+    size_t received;
+    /** bloques empezados y terminados; el en curso va por `chunk_off' */
+    size_t chunks_sent;
+    size_t chunks_done;
+    size_t chunk_off;
+    uint64_t sent_at[BENCH_WINDOW];
+};
+
+/** contadores del reactor, copiados desde su propio thread */
+struct bench_probe {
+    struct selector_completion c;
+    atomic_bool done;
+    uint64_t iterations;
+    uint64_t interest_applied;
+    uint64_t reads;
+    uint64_t writes;
+};
+
+struct bench_result {
+    size_t bytes;
+    double seconds;
+    uint64_t ops;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+};
+
+static fd_selector selector;
+static pthread_t reactor;
+static atomic_bool reactor_stop;
+static struct selector_completion reactor_wakeup;
+
+static uint8_t payload[BENCH_MAX_CHUNK];
+static uint8_t sink[BENCH_READ_SIZE];
+
+static uint64_t *latencies;
+static size_t latencies_n;
+static size_t latencies_cap;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "Usage: %s [OPTION]...\n"
+            "\n"
+            "   -h               Imprime la ayuda y termina.\n"
+            "   -m <modos>       Lado del cliente: socketpair,tcp (def. ambos).\n"
+            "   -b <bytes,...>   Topes de buffer por dirección, entre las clases del\n"
+            "                    túnel (def. 4096,16384,65536,262144).\n"
+            "   -c <bytes,...>   Tamaños de bloque (def. 1024,16384,131072).\n"
+            "   -f <n,...>       Cantidades de flujos (def. 1,16).\n"
+            "   -d <0|1,...>     Disector apagado/prendido (def. 0,1).\n"
+            "   -n <MiB>         Datos por corrida, entre todos los flujos (def. 256).\n"
+            "   -e               Selector en modo edge-triggered.\n"
+            "\n",
+            progname);
+    exit(1);
+}
+
+// "a,b,c" → valores en `out'. Los modos se aceptan por nombre; `max' 0: sin tope
+static void parse_values(const char *s, struct bench_values *out, bool modes,
+                         unsigned long max, const char *what) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", s);
+    out->n = 0;
+
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (out->n == BENCH_MAX_VALUES) {
+            fprintf(stderr, "too many values for %s\n", what);
+            exit(1);
+        }
+        unsigned long v;
+        if (modes) {
+            if (strcmp(tok, mode_names[MODE_SOCKETPAIR]) == 0) {
+                v = MODE_SOCKETPAIR;
+            } else if (strcmp(tok, mode_names[MODE_TCP]) == 0) {
+                v = MODE_TCP;
+            } else {
+                fprintf(stderr, "invalid %s: %s\n", what, tok);
+                exit(1);
+            }
+        } else {
+            char *end = NULL;
+            errno = 0;
+            v = strtoul(tok, &end, 10);
+            if (end == tok || *end != '\0' || errno == ERANGE || tok[0] == '-' || (max != 0 && v > max)) {
+                fprintf(stderr, "invalid %s: %s\n", what, tok);
+                exit(1);
+            }
+        }
+        out->v[out->n++] = v;
+    }
+    if (out->n == 0) {
+        fprintf(stderr, "no values for %s\n", what);
+        exit(1);
+    }
+}
+
+// Los buffers del túnel solo crecen de a clases: otro tope no se mediría
+static bool buffer_is_class(unsigned long v) {
+    for (unsigned c = 0; c < TUNNEL_BUFFER_CLASSES; c++) {
+        if (v == (unsigned long)TUNNEL_BUFFER_MIN << (2 * c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void parse_bench_args(int argc, char **argv, struct bench_config *conf) {
+    memset(conf, 0, sizeof(*conf));
+    parse_values("socketpair,tcp", &conf->modes, true, 0, "mode");
+    parse_values("4096,16384,65536,262144", &conf->buffers, false, 0, "buffer");
+    parse_values("1024,16384,131072", &conf->chunks, false, 0, "chunk");
+    parse_values("1,16", &conf->flows, false, 0, "flows");
+    parse_values("0,1", &conf->dissector, false, 0, "dissector");
+    conf->total = 256UL << 20;
+
+    int c;
+    while ((c = getopt(argc, argv, "hm:b:c:f:d:n:e")) != -1) {
+        switch (c) {
+        case 'm':
+            parse_values(optarg, &conf->modes, true, 0, "mode");
+            break;
+        case 'b':
+            parse_values(optarg, &conf->buffers, false, 1UL << 30, "buffer");
+            break;
+        case 'c':
+            parse_values(optarg, &conf->chunks, false, BENCH_MAX_CHUNK, "chunk");
+            break;
+        case 'f':
+            parse_values(optarg, &conf->flows, false, BENCH_MAX_FLOWS, "flows");
+            break;
+        case 'd':
+            parse_values(optarg, &conf->dissector, false, 1, "dissector");
+            break;
+        case 'n': {
+            struct bench_values mib;
+            parse_values(optarg, &mib, false, 1UL << 20, "MiB");
+            conf->total = mib.v[0] << 20;
+            break;
+        }
+        case 'e':
+            conf->edge_triggered = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+    for (size_t i = 0; i < conf->buffers.n; i++) {
+        if (!buffer_is_class(conf->buffers.v[i])) {
+            fprintf(stderr, "invalid buffer: %lu\n", conf->buffers.v[i]);
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < conf->chunks.n; i++) {
+        if (conf->chunks.v[i] == 0) {
+            fprintf(stderr, "invalid chunk: 0\n");
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < conf->flows.n; i++) {
+        if (conf->flows.v[i] == 0) {
+            fprintf(stderr, "invalid flows: 0\n");
+            exit(1);
+        }
+    }
+}
+
+// ============================================================================
+// REACTOR
+// ============================================================================
+
+static void *reactor_run(void *arg) {
+    (void)arg;
+    metrics_attach(0);
+    while (!atomic_load(&reactor_stop)) {
+        const selector_status st = selector_select(selector);
+        if (st != SELECTOR_SUCCESS) {
+            fprintf(stderr, "selector_select: %s\n", selector_error(st));
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void reactor_noop(struct selector_key *key, struct selector_completion *c) {
+    (void)key;
+    (void)c;
+}
+
+static bool reactor_start(void) {
+    selector = selector_new(BENCH_MAX_FLOWS * 2 + 16);
+    if (selector == NULL) {
+        fprintf(stderr, "selector_new failed\n");
+        return false;
+    }
+    atomic_store(&reactor_stop, false);
+    const int err = pthread_create(&reactor, NULL, reactor_run, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        selector_destroy(selector);
+        return false;
+    }
+    return true;
+}
+
+// Detiene el reactor y destruye el selector, cerrando lo que quedó abierto
+static void reactor_finish(void) {
+    atomic_store(&reactor_stop, true);
+    reactor_wakeup.fd       = -1;
+    reactor_wakeup.callback = reactor_noop;
+    selector_notify_completion(selector, &reactor_wakeup);
+    pthread_join(reactor, NULL);
+    selector_destroy(selector);
+    selector = NULL;
+}
+
+// En el thread del reactor: el extremo del proxy pasa a ser una conexión
+// SOCKS5 como las que crea el acceptor del servidor
+static void flow_attach(struct selector_key *key, struct selector_completion *c) {
+    struct bench_flow *f = (struct bench_flow *)c;
+    struct socks5_conn *conn = socks5_new(f->proxy_fd);
+    if (conn == NULL) {
+        close(f->proxy_fd);
+        return;
+    }
+    if (selector_register(key->s, f->proxy_fd, socks5_get_handler(), OP_READ, conn) != SELECTOR_SUCCESS) {
+        socks5_destroy(conn);
+        close(f->proxy_fd);
+        return;
+    }
+    socks5_start_timeout(conn, key->s);
+}
+
+static void probe_collect(struct selector_key *key, struct selector_completion *c) {
+    struct bench_probe *p = (struct bench_probe *)c;
+    struct selector_stats st;
+    selector_get_stats(key->s, &st);
+    const struct socks5_metrics *m = metrics_get();
+    p->iterations       = selector_iteration(key->s);
+    p->interest_applied = st.interest_applied;
+    p->reads            = m->tunnel_reads;
+    p->writes           = m->tunnel_writes;
+    atomic_store(&p->done, true);
+}
+
+static void probe(struct bench_probe *p) {
+    memset(p, 0, sizeof(*p));
+    atomic_init(&p->done, false);
+    p->c.fd       = -1;
+    p->c.callback = probe_collect;
+    p->c.name     = "bench";
+    selector_notify_completion(selector, &p->c);
+    while (!atomic_load(&p->done)) {
+        sched_yield();
+    }
+}
+
+// ============================================================================
+// FLUJOS
+// ============================================================================
+
+static int listen_loopback(uint16_t port, uint16_t *bound) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(port),
+        .sin_addr   = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+        || listen(fd, BENCH_MAX_FLOWS) == -1
+        || getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+        fprintf(stderr, "listen 127.0.0.1:%u: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *bound = ntohs(addr.sin_port);
+    return fd;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t n) {
+    while (n > 0) {
+        const ssize_t w = write(fd, data, n);
+        if (w <= 0) {
+            return false;
+        }
+        data += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+static bool read_all(int fd, uint8_t *data, size_t n) {
+    while (n > 0) {
+        const ssize_t r = read(fd, data, n);
+        if (r <= 0) {
+            return false;
+        }
+        data += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+// Crea el par cliente/proxy según el modo
+static bool flow_pair(struct bench_flow *f, enum bench_mode mode, int proxy_listen, uint16_t proxy_port) {
+    if (mode == MODE_SOCKETPAIR) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair");
+            return false;
+        }
+        f->client_fd = sv[0];
+        f->proxy_fd  = sv[1];
+        return true;
+    }
+
+    f->client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    const struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(proxy_port),
+        .sin_addr   = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    if (f->client_fd == -1 || connect(f->client_fd, (const struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        return false;
+    }
+    f->proxy_fd = accept(proxy_listen, NULL, NULL);
+    if (f->proxy_fd == -1) {
+        perror("accept");
+        return false;
+    }
+    return true;
+}
+
+// Negocia SOCKS5 y acepta del lado del origen la conexión que abre el túnel
+static bool flow_open(struct bench_flow *f, enum bench_mode mode, int proxy_listen,
+                      uint16_t proxy_port, int origin_listen, uint16_t origin_port) {
+    f->client_fd = f->proxy_fd = f->origin_fd = -1;
+    if (!flow_pair(f, mode, proxy_listen, proxy_port)) {
+        return false;
+    }
+    if (selector_fd_set_nio(f->proxy_fd) == -1) {
+        perror("selector_fd_set_nio");
+        return false;
+    }
+    f->attach.fd       = -1;
+    f->attach.callback = flow_attach;
+    f->attach.name     = "bench";
+    selector_notify_completion(selector, &f->attach);
+
+    const uint8_t hello[] = { 0x05, 0x01, 0x00 };
+    const uint8_t request[] = {
+        0x05, 0x01, 0x00, 0x01, 127, 0, 0, 1,
+        (uint8_t)(origin_port >> 8), (uint8_t)(origin_port & 0xFF),
+    };
+    uint8_t reply[10];
+    if (!write_all(f->client_fd, hello, sizeof(hello)) || !read_all(f->client_fd, reply, 2)
+        || reply[1] != 0x00 || !write_all(f->client_fd, request, sizeof(request))) {
+        fprintf(stderr, "socks5 handshake failed\n");
+        return false;
+    }
+    f->origin_fd = accept(origin_listen, NULL, NULL);
+    if (f->origin_fd == -1) {
+        perror("accept (origin)");
+        return false;
+    }
+    if (!read_all(f->client_fd, reply, sizeof(reply)) || reply[1] != 0x00) {
+        fprintf(stderr, "socks5 connect failed\n");
+        return false;
+    }
+    return selector_fd_set_nio(f->client_fd) != -1 && selector_fd_set_nio(f->origin_fd) != -1;
+}
+
+static void flow_close(struct bench_flow *f) {
+    if (f->client_fd != -1) {
+        close(f->client_fd);
+    }
+    if (f->origin_fd != -1) {
+        close(f->origin_fd);
+    }
+}
+
+static void latency_add(uint64_t ns) {
+    if (latencies_n == latencies_cap) {
+        const size_t cap = latencies_cap == 0 ? 4096 : latencies_cap * 2;
+        uint64_t *l = realloc(latencies, cap * sizeof(*l));
+        if (l == NULL) {
+            return;
+        }
+        latencies = l;
+        latencies_cap = cap;
+    }
+    latencies[latencies_n++] = ns;
+}
+
+// Escribe del lado del cliente mientras haya lugar en la ventana
+static bool flow_send(struct bench_flow *f, size_t chunk) {
+    while (f->sent < f->total && f->chunks_sent - f->chunks_done < BENCH_WINDOW) {
+        if (f->chunk_off == 0) {
+            f->sent_at[f->chunks_sent % BENCH_WINDOW] = now_ns();
+        }
+        const ssize_t n = write(f->client_fd, payload + f->chunk_off, chunk - f->chunk_off);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        f->sent += (size_t)n;
+        f->chunk_off += (size_t)n;
+        if (f->chunk_off == chunk) {
+            f->chunk_off = 0;
+            f->chunks_sent++;
+        }
+    }
+    return true;
+}
+
+// Lee del lado del origen y cierra los bloques que llegaron completos
+static bool flow_receive(struct bench_flow *f, size_t chunk) {
+    while (true) {
+        const ssize_t n = read(f->origin_fd, sink, sizeof(sink));
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return f->received == f->total;
+        }
+        f->received += (size_t)n;
+        const uint64_t now = now_ns();
+        while (f->chunks_done < f->chunks_sent + (f->chunk_off > 0)
+               && f->received >= (f->chunks_done + 1) * chunk) {
+            latency_add(now - f->sent_at[f->chunks_done % BENCH_WINDOW]);
+            f->chunks_done++;
+        }
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(unsigned p) {
+    if (latencies_n == 0) {
+        return 0;
+    }
+    size_t i = latencies_n * p / 100;
+    return latencies[i < latencies_n ? i : latencies_n - 1];
+}
+
+// ============================================================================
+// CORRIDAS
+// ============================================================================
+
+static bool bench_run(enum bench_mode mode, size_t buffer, size_t chunk, size_t nflows,
+                      bool dissector, size_t total, struct bench_result *out) {
+    static struct bench_flow flows[BENCH_MAX_FLOWS];
+    static struct pollfd pfds[BENCH_MAX_FLOWS * 2];
+    bool ok = false;
+    int proxy_listen = -1, origin_listen = -1;
+    uint16_t proxy_port = 0, origin_port = 0;
+    size_t opened = 0;
+
+    // cada flujo manda una cantidad entera de bloques
+    size_t per_flow = total / nflows / chunk * chunk;
+    if (per_flow == 0) {
+        per_flow = chunk;
+    }
+
+    // pools nuevos en cada corrida, cada uno con los buffers mínimos de
+    // todos sus flujos ya reservados
+    tunnel_set_buffer_max(buffer);
+    if (!tunnel_buffers_init(nflows * 2, nflows * 2 * buffer) || !reactor_start()) {
+        tunnel_buffers_close();
+        return false;
+    }
+    origin_listen = listen_loopback(dissector ? BENCH_SNIFF_PORT : 0, &origin_port);
+    if (origin_listen == -1) {
+        goto finally;
+    }
+    if (mode == MODE_TCP && (proxy_listen = listen_loopback(0, &proxy_port)) == -1) {
+        goto finally;
+    }
+
+    for (; opened < nflows; opened++) {
+        struct bench_flow *f = flows + opened;
+        memset(f, 0, sizeof(*f));
+        f->total = per_flow;
+        if (!flow_open(f, mode, proxy_listen, proxy_port, origin_listen, origin_port)) {
+            opened++;
+            goto finally;
+        }
+    }
+
+    latencies_n = 0;
+    struct bench_probe before, after;
+    probe(&before);
+    const uint64_t start = now_ns();
+
+    size_t done = 0;
+    while (done < nflows) {
+        nfds_t n = 0;
+        for (size_t i = 0; i < nflows; i++) {
+            struct bench_flow *f = flows + i;
+            if (f->received == f->total) {
+                continue;
+            }
+            if (f->sent < f->total && f->chunks_sent - f->chunks_done < BENCH_WINDOW) {
+                pfds[n++] = (struct pollfd){ .fd = f->client_fd, .events = POLLOUT };
+            }
+            pfds[n++] = (struct pollfd){ .fd = f->origin_fd, .events = POLLIN };
+        }
+        if (poll(pfds, n, 10 * 1000) <= 0) {
+            fprintf(stderr, "transfer stalled\n");
+            goto finally;
+        }
+        for (size_t i = 0; i < nflows; i++) {
+            struct bench_flow *f = flows + i;
+            if (f->received == f->total) {
+                continue;
+            }
+            if (!flow_send(f, chunk) || !flow_receive(f, chunk)) {
+                fprintf(stderr, "transfer failed: %s\n", strerror(errno));
+                goto finally;
+            }
+            done += f->received == f->total;
+        }
+    }
+
+    const uint64_t elapsed = now_ns() - start;
+    probe(&after);
+    qsort(latencies, latencies_n, sizeof(*latencies), cmp_u64);
+
+    out->bytes    = per_flow * nflows;
+    out->seconds  = (double)elapsed / NS_PER_SEC;
+    out->ops      = (after.iterations - before.iterations)
+                  + (after.interest_applied - before.interest_applied)
+                  + (after.reads - before.reads)
+                  + (after.writes - before.writes);
+    out->p50_ns   = percentile(50);
+    out->p99_ns   = percentile(99);
+    ok = true;
+
+finally:
+    for (size_t i = 0; i < opened; i++) {
+        flow_close(flows + i);
+    }
+    if (proxy_listen != -1) {
+        close(proxy_listen);
+    }
+    if (origin_listen != -1) {
+        close(origin_listen);
+    }
+    reactor_finish();
+    tunnel_buffers_close();
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_config conf;
+    parse_bench_args(argc, argv, &conf);
+    signal(SIGPIPE, SIG_IGN);
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t)rand();
+    }
+
+    const struct selector_init init = {
+        .select_timeout = { .tv_sec = 1, .tv_nsec = 0 },
+        .backend        = SELECTOR_BACKEND_AUTO,
+        .edge_triggered = conf.edge_triggered,
+    };
+    const selector_status st = selector_init(&init);
+    if (st != SELECTOR_SUCCESS) {
+        fprintf(stderr, "selector_init: %s\n", selector_error(st));
+        return 1;
+    }
+    // sin estacionar buffers ni plazos que corten una corrida larga
+    tunnel_set_park(0);
+    const struct socks5_timeouts timeouts = { 0 };
+    socks5_set_timeouts(&timeouts);
+    if (!socks5_pool_init(BENCH_MAX_FLOWS) || !parser_pool_init(BENCH_MAX_FLOWS)) {
+        fprintf(stderr, "no memory for pools\n");
+        return 1;
+    }
+
+    int ret = 0;
+    printf("mode,buffer,chunk,flows,dissector,bytes,seconds,gbps,ops_per_mb,p50_us,p99_us\n");
+    for (size_t m = 0; m < conf.modes.n; m++)
+    for (size_t b = 0; b < conf.buffers.n; b++)
+    for (size_t c = 0; c < conf.chunks.n; c++)
+    for (size_t f = 0; f < conf.flows.n; f++)
+    for (size_t d = 0; d < conf.dissector.n; d++) {
+        struct bench_result r;
+        const enum bench_mode mode = (enum bench_mode)conf.modes.v[m];
+        if (!bench_run(mode, conf.buffers.v[b], conf.chunks.v[c], conf.flows.v[f],
+                       conf.dissector.v[d] != 0, conf.total, &r)) {
+            fprintf(stderr, "run failed: %s buffer=%lu chunk=%lu flows=%lu dissector=%lu\n",
+                    mode_names[mode], conf.buffers.v[b], conf.chunks.v[c],
+                    conf.flows.v[f], conf.dissector.v[d]);
+            ret = 1;
+            continue;
+        }
+        const double mib = (double)r.bytes / (1 << 20);
+        printf("%s,%lu,%lu,%lu,%lu,%zu,%.3f,%.3f,%.1f,%.1f,%.1f\n",
+               mode_names[mode], conf.buffers.v[b], conf.chunks.v[c], conf.flows.v[f],
+               conf.dissector.v[d], r.bytes, r.seconds,
+               r.seconds > 0 ? (double)r.bytes / r.seconds / 1e9 : 0.0,
+               mib > 0 ? (double)r.ops / mib : 0.0,
+               (double)r.p50_ns / 1000, (double)r.p99_ns / 1000);
+        fflush(stdout);
+    }
+
+    socks5_pool_close();
+    parser_pool_close();
+    selector_close();
+    free(latencies);
+    return ret;
+}
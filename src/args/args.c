@@ -6,6 +6,40 @@
 #include <getopt.h>
 
 #include "args.h"
+#include "../helpers/metrics.h"
+#include "../tunnel/tunnel.h"
+#include "../connect/connect.h"
+
+/** opciones que solo tienen forma larga */
+enum long_only_options {
+    OPT_BACKEND = 0x100,
+    OPT_EDGE_TRIGGERED,
+    OPT_LISTEN_BACKLOG,
+    OPT_LISTEN_FASTOPEN,
+    OPT_DEFER_ACCEPT,
+    OPT_HANDSHAKE_TIMEOUT,
+    OPT_CONNECT_TIMEOUT,
+    OPT_CONNECT_DELAY,
+    OPT_CONNECT_ATTEMPT_TIMEOUT,
+    OPT_CONNECT_BUDGET,
+    OPT_ORIGIN_FASTOPEN,
+    OPT_IDLE_TIMEOUT,
+    OPT_PIN_CPUS,
+    OPT_LOOP_STATS,
+    OPT_BUDGET_BYTES,
+    OPT_BUDGET_OPS,
+    OPT_POOL_PREALLOC,
+    OPT_SPLICE,
+    OPT_BUFFER_MEMORY,
+    OPT_PARK_IDLE,
+    OPT_ZEROCOPY,
+    OPT_ZEROCOPY_MIN,
+    OPT_NOTSENT_LOWAT,
+    OPT_SOCKBUF_MAX,
+    OPT_LIMIT_GLOBAL,
+    OPT_LIMIT_USER,
+    OPT_LIMIT_CONN,
+};
 
 static unsigned short
 port(const char* s)
@@ -42,6 +76,82 @@ user(char* s, struct users* user)
     }
 }
 
+static unsigned
+seconds(const char* s)
+{
+    char* end = 0;
+    errno = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || ERANGE == errno
+        || sl < 0 || sl > 24 * 60 * 60)
+    {
+        fprintf(stderr, "timeout should be in the range of 0-86400 seconds: %s\n", s);
+        exit(1);
+        return 0;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned
+threads(const char* s)
+{
+    char* end = 0;
+    errno = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || ERANGE == errno
+        || sl < 1 || sl > METRICS_MAX_REACTORS)
+    {
+        fprintf(stderr, "threads should be in the range of 1-%d: %s\n",
+                METRICS_MAX_REACTORS, s);
+        exit(1);
+        return 1;
+    }
+    return (unsigned)sl;
+}
+
+static unsigned long
+amount(const char* s, long max, const char* what)
+{
+    char* end = 0;
+    errno = 0;
+    const long sl = strtol(s, &end, 10);
+
+    if (end == s || '\0' != *end || ERANGE == errno
+        || sl < 0 || sl > max)
+    {
+        fprintf(stderr, "%s should be in the range of 0-%ld: %s\n", what, max, s);
+        exit(1);
+        return 0;
+    }
+    return (unsigned long)sl;
+}
+
+static selector_backend
+backend(const char* s)
+{
+    if (strcmp(s, "auto") == 0)
+    {
+        return SELECTOR_BACKEND_AUTO;
+    }
+    if (strcmp(s, "epoll") == 0)
+    {
+        return SELECTOR_BACKEND_EPOLL;
+    }
+    if (strcmp(s, "pselect") == 0)
+    {
+        return SELECTOR_BACKEND_PSELECT;
+    }
+    if (strcmp(s, "io_uring") == 0)
+    {
+        return SELECTOR_BACKEND_IO_URING;
+    }
+    fprintf(stderr, "backend should be one of auto, epoll, pselect, io_uring: %s\n", s);
+    exit(1);
+    return SELECTOR_BACKEND_AUTO;
+}
+
 static void
 version(void)
 {
@@ -60,11 +170,88 @@ usage(const char* progname)
             "   -L <conf  addr>  Dirección donde servirá el servicio de management.\n"
             "   -p <SOCKS port>  Puerto entrante conexiones SOCKS.\n"
             "   -P <conf port>   Puerto entrante conexiones configuracion\n"
+            "   -t <threads>     Reactores: cada uno con su selector y su socket SOCKS\n"
+            "                    (SO_REUSEPORT). Por defecto 1.\n"
             "   -u <name>:<pass> Usuario y contraseña de usuario que puede usar el proxy. Hasta 10.\n"
             "   -v               Imprime información sobre la versión versión y termina.\n"
-
-            "\n",
+            "\n"
+            "   --backend <auto|epoll|pselect|io_uring>\n"
+            "                    Multiplexor de E/S. auto usa epoll y cae a pselect;\n"
+            "                    io_uring espera con polls de io_uring (la E/S sigue\n"
+            "                    siendo read/write) y cae a epoll si no hay soporte.\n"
+            "   --edge-triggered Notificación por flanco (epoll/io_uring): los handlers\n"
+            "                    leen y escriben hasta EAGAIN.\n"
+            "   --listen-backlog <n>\n"
+            "                    Conexiones pendientes de accept en el socket SOCKS\n"
+            "                    (def. 20; el kernel lo acota a net.core.somaxconn).\n"
+            "   --listen-fastopen <n>\n"
+            "                    TCP Fast Open en el socket SOCKS: el hello puede\n"
+            "                    llegar en el SYN. <n> handshakes TFO pendientes a la\n"
+            "                    vez. 0 (def.) lo desactiva.\n"
+            "   --defer-accept <s>\n"
+            "                    TCP_DEFER_ACCEPT: accept no avisa hasta que llega el\n"
+            "                    hello (o pasan <s> segundos). 0 (def.) lo desactiva.\n"
+            "   --handshake-timeout <s>\n"
+            "                    Plazo para completar hello, auth y request (def. 10).\n"
+            "   --connect-timeout <s>\n"
+            "                    Plazo para resolver y conectar al origin (def. 10).\n"
+            "   --connect-delay <ms>\n"
+            "                    Happy Eyeballs: si un intento no conectó en <ms> se\n"
+            "                    prueba en paralelo la siguiente dirección, alternando\n"
+            "                    IPv6 e IPv4 (def. 250). 0 prueba de a una.\n"
+            "   --connect-attempt-timeout <ms>\n"
+            "                    Plazo de cada dirección; al vencer se pasa a la\n"
+            "                    siguiente. 0 (def.) espera al kernel.\n"
+            "   --connect-budget <ms>\n"
+            "                    Plazo de todos los intentos de un pedido; al vencer\n"
+            "                    se responde 0x06 (TTL expired). 0 (def.) sin plazo.\n"
+            "   --origin-fastopen\n"
+            "                    TCP Fast Open hacia el origin: lo que el cliente ya\n"
+            "                    mandó detrás del pedido viaja en el SYN.\n"
+            "   --idle-timeout <s>\n"
+            "                    Cierra túneles sin tráfico (def. 300). 0 desactiva.\n",
             progname);
+    fputs("   --pin-cpus       Fija el reactor i al CPU i (módulo los CPUs disponibles).\n"
+            "   --loop-stats     Mide la espera, el despacho y cada handler del loop\n"
+            "                    (comando LOOPSTATS del monitor).\n"
+            "   --budget-bytes <n>\n"
+            "                    Bytes que un túnel mueve por socket en cada iteración\n"
+            "                    antes de ceder el turno (def. 65536). 0 sin límite.\n"
+            "                    Solo con --edge-triggered: en level-triggered cada\n"
+            "                    handler ya hace una operación por socket.\n"
+            "   --budget-ops <n> Lecturas/escrituras por socket en cada iteración\n"
+            "                    (def. 16). 0 sin límite. Solo con --edge-triggered.\n"
+            "   --pool-prealloc <n>\n"
+            "                    Conexiones, parsers y pedidos DNS que se reservan al\n"
+            "                    arrancar (def. 64). Si se agotan, los pools crecen.\n"
+            "   --splice         Reenvía con splice(2) el tráfico que no inspecciona\n"
+            "                    ningún disector (usa un pipe por dirección).\n"
+            "   --buffer-memory <MiB>\n"
+            "                    Memoria total para buffers de túnel (def. 256). Los\n"
+            "                    buffers crecen de 4K hasta 256K mientras haya lugar.\n"
+            "   --park-idle <ms> Un túnel sin tráfico durante <ms> devuelve sus buffers\n"
+            "                    y los vuelve a pedir al recibir datos (def. 10000).\n"
+            "                    0 los conserva siempre.\n"
+            "   --zerocopy       Envía al cliente con MSG_ZEROCOPY los bloques grandes\n"
+            "                    (requiere epoll o io_uring).\n"
+            "   --zerocopy-min <n>\n"
+            "                    Bloque mínimo para --zerocopy (def. 16384).\n"
+            "   --notsent-lowat <n>\n"
+            "                    Bytes sin enviar que admite cada socket del túnel\n"
+            "                    (TCP_NOTSENT_LOWAT); el resto espera en el buffer del\n"
+            "                    túnel. 0 (def.) usa el valor del sistema.\n"
+            "   --sockbuf-max <n>\n"
+            "                    Agranda SO_SNDBUF/SO_RCVBUF de los túneles según el\n"
+            "                    BDP medido con TCP_INFO, hasta <n> bytes. 0 (def.)\n"
+            "                    deja el autoajuste del kernel.\n"
+            "   --limit-global <B/s>\n"
+            "                    Ancho de banda total de los túneles. 0 sin límite.\n"
+            "   --limit-user <B/s>\n"
+            "                    Ancho de banda de cada usuario, sumando sus conexiones.\n"
+            "   --limit-conn <B/s>\n"
+            "                    Ancho de banda de cada conexión.\n"
+            "\n",
+          stderr);
     exit(1);
 }
 
@@ -75,12 +262,30 @@ parse_args(const int argc, char** argv, struct socks5args* args)
 
     args->socks_addr = "0.0.0.0";
     args->socks_port = 1080;
+    args->listen_backlog = DEFAULT_LISTEN_BACKLOG;
 
     args->mng_addr = "127.0.0.1";
     args->mng_port = 8080;
 
     args->disectors_enabled = true;
 
+    args->backend = SELECTOR_BACKEND_AUTO;
+
+    args->handshake_timeout = 10;
+    args->connect_timeout   = 10;
+    args->idle_timeout      = 300;
+    args->connect_delay     = CONNECT_DEFAULT_ATTEMPT_DELAY_MS;
+
+    args->threads = 1;
+
+    args->budget_bytes = TUNNEL_DEFAULT_BUDGET_BYTES;
+    args->budget_ops   = TUNNEL_DEFAULT_BUDGET_OPS;
+
+    args->pool_prealloc = DEFAULT_POOL_PREALLOC;
+    args->buffer_memory = TUNNEL_DEFAULT_BUFFER_MEMORY;
+    args->zerocopy_min  = TUNNEL_DEFAULT_ZEROCOPY_MIN;
+    args->park_idle     = TUNNEL_DEFAULT_PARK_MS;
+
     int c;
     int nusers = 0;
 
@@ -88,10 +293,37 @@ parse_args(const int argc, char** argv, struct socks5args* args)
     {
         int option_index = 0;
         static struct option long_options[] = {
+            {"backend", required_argument, 0, OPT_BACKEND},
+            {"edge-triggered", no_argument, 0, OPT_EDGE_TRIGGERED},
+            {"listen-backlog", required_argument, 0, OPT_LISTEN_BACKLOG},
+            {"listen-fastopen", required_argument, 0, OPT_LISTEN_FASTOPEN},
+            {"defer-accept", required_argument, 0, OPT_DEFER_ACCEPT},
+            {"handshake-timeout", required_argument, 0, OPT_HANDSHAKE_TIMEOUT},
+            {"connect-timeout", required_argument, 0, OPT_CONNECT_TIMEOUT},
+            {"connect-delay", required_argument, 0, OPT_CONNECT_DELAY},
+            {"connect-attempt-timeout", required_argument, 0, OPT_CONNECT_ATTEMPT_TIMEOUT},
+            {"connect-budget", required_argument, 0, OPT_CONNECT_BUDGET},
+            {"origin-fastopen", no_argument, 0, OPT_ORIGIN_FASTOPEN},
+            {"idle-timeout", required_argument, 0, OPT_IDLE_TIMEOUT},
+            {"pin-cpus", no_argument, 0, OPT_PIN_CPUS},
+            {"loop-stats", no_argument, 0, OPT_LOOP_STATS},
+            {"budget-bytes", required_argument, 0, OPT_BUDGET_BYTES},
+            {"budget-ops", required_argument, 0, OPT_BUDGET_OPS},
+            {"pool-prealloc", required_argument, 0, OPT_POOL_PREALLOC},
+            {"splice", no_argument, 0, OPT_SPLICE},
+            {"buffer-memory", required_argument, 0, OPT_BUFFER_MEMORY},
+            {"park-idle", required_argument, 0, OPT_PARK_IDLE},
+            {"zerocopy", no_argument, 0, OPT_ZEROCOPY},
+            {"zerocopy-min", required_argument, 0, OPT_ZEROCOPY_MIN},
+            {"notsent-lowat", required_argument, 0, OPT_NOTSENT_LOWAT},
+            {"sockbuf-max", required_argument, 0, OPT_SOCKBUF_MAX},
+            {"limit-global", required_argument, 0, OPT_LIMIT_GLOBAL},
+            {"limit-user", required_argument, 0, OPT_LIMIT_USER},
+            {"limit-conn", required_argument, 0, OPT_LIMIT_CONN},
             {0, 0, 0, 0}
         };
 
-        c = getopt_long(argc, argv, "hl:L:Np:P:u:v", long_options, &option_index);
+        c = getopt_long(argc, argv, "hl:L:Np:P:t:u:v", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -115,6 +347,9 @@ parse_args(const int argc, char** argv, struct socks5args* args)
         case 'P':
             args->mng_port = port(optarg);
             break;
+        case 't':
+            args->threads = threads(optarg);
+            break;
         case 'u':
             if (nusers >= MAX_USERS)
             {
@@ -130,6 +365,87 @@ parse_args(const int argc, char** argv, struct socks5args* args)
         case 'v':
             version();
             exit(0);
+        case OPT_BACKEND:
+            args->backend = backend(optarg);
+            break;
+        case OPT_EDGE_TRIGGERED:
+            args->edge_triggered = true;
+            break;
+        case OPT_LISTEN_BACKLOG:
+            args->listen_backlog = (int)amount(optarg, 65535, "listen backlog");
+            break;
+        case OPT_LISTEN_FASTOPEN:
+            args->listen_fastopen = (int)amount(optarg, 65535, "listen fastopen");
+            break;
+        case OPT_DEFER_ACCEPT:
+            args->defer_accept = (int)amount(optarg, 3600, "defer accept");
+            break;
+        case OPT_HANDSHAKE_TIMEOUT:
+            args->handshake_timeout = seconds(optarg);
+            break;
+        case OPT_CONNECT_TIMEOUT:
+            args->connect_timeout = seconds(optarg);
+            break;
+        case OPT_CONNECT_DELAY:
+            args->connect_delay = amount(optarg, 60L * 1000, "connect delay");
+            break;
+        case OPT_CONNECT_ATTEMPT_TIMEOUT:
+            args->connect_attempt_timeout = amount(optarg, 24L * 60 * 60 * 1000, "connect attempt timeout");
+            break;
+        case OPT_CONNECT_BUDGET:
+            args->connect_budget = amount(optarg, 24L * 60 * 60 * 1000, "connect budget");
+            break;
+        case OPT_ORIGIN_FASTOPEN:
+            args->origin_fastopen = true;
+            break;
+        case OPT_IDLE_TIMEOUT:
+            args->idle_timeout = seconds(optarg);
+            break;
+        case OPT_PIN_CPUS:
+            args->pin_cpus = true;
+            break;
+        case OPT_LOOP_STATS:
+            args->loop_stats = true;
+            break;
+        case OPT_BUDGET_BYTES:
+            args->budget_bytes = amount(optarg, 1L << 30, "budget bytes");
+            break;
+        case OPT_BUDGET_OPS:
+            args->budget_ops = (unsigned)amount(optarg, 1000000, "budget ops");
+            break;
+        case OPT_POOL_PREALLOC:
+            args->pool_prealloc = amount(optarg, 1L << 20, "pool prealloc");
+            break;
+        case OPT_SPLICE:
+            args->splice = true;
+            break;
+        case OPT_BUFFER_MEMORY:
+            args->buffer_memory = amount(optarg, 1L << 20, "buffer memory");
+            break;
+        case OPT_PARK_IDLE:
+            args->park_idle = amount(optarg, 24L * 60 * 60 * 1000, "park idle");
+            break;
+        case OPT_ZEROCOPY:
+            args->zerocopy = true;
+            break;
+        case OPT_ZEROCOPY_MIN:
+            args->zerocopy_min = amount(optarg, 1L << 30, "zerocopy min");
+            break;
+        case OPT_NOTSENT_LOWAT:
+            args->notsent_lowat = amount(optarg, 1L << 30, "notsent lowat");
+            break;
+        case OPT_SOCKBUF_MAX:
+            args->sockbuf_max = amount(optarg, 1L << 30, "sockbuf max");
+            break;
+        case OPT_LIMIT_GLOBAL:
+            args->limit_global = amount(optarg, 1L << 40, "global limit");
+            break;
+        case OPT_LIMIT_USER:
+            args->limit_user = amount(optarg, 1L << 40, "user limit");
+            break;
+        case OPT_LIMIT_CONN:
+            args->limit_conn = amount(optarg, 1L << 40, "connection limit");
+            break;
         default:
             fprintf(stderr, "unknown argument %d.\n", c);
             exit(1);
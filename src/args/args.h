@@ -2,9 +2,16 @@
 #define ARGS_H_kFlmYm1tW9p5npzDr2opQJ9jM8
 
 #include <stdbool.h>
+#include "../helpers/selector.h"
 
 #define MAX_USERS 10
 
+/** objetos que se reservan al arrancar en cada pool (ver --pool-prealloc) */
+#define DEFAULT_POOL_PREALLOC 64
+
+/** conexiones pendientes de accept en el socket SOCKS (ver --listen-backlog) */
+#define DEFAULT_LISTEN_BACKLOG 20
+
 struct users
 {
     char* name;
@@ -15,12 +22,71 @@ struct socks5args
 {
     char* socks_addr;
     unsigned short socks_port;
+    /** backlog de listen(2), cola de TCP Fast Open (0: sin TFO) y segundos
+        de TCP_DEFER_ACCEPT (0: sin diferir) del socket SOCKS */
+    int listen_backlog;
+    int listen_fastopen;
+    int defer_accept;
 
     char* mng_addr;
     unsigned short mng_port;
 
     bool disectors_enabled;
 
+    selector_backend backend;
+    bool edge_triggered;
+    /** histogramas de latencia del loop, expuestos por el monitor */
+    bool loop_stats;
+
+    /** reactores: threads con selector y listener SO_REUSEPORT propios */
+    unsigned threads;
+    /** fija cada reactor a un CPU */
+    bool pin_cpus;
+
+    /** plazos en segundos (0: sin plazo) */
+    unsigned handshake_timeout;
+    unsigned connect_timeout;
+    unsigned idle_timeout;
+
+    /** ms entre intentos de conexión en paralelo (Happy Eyeballs; 0: de a uno) */
+    unsigned long connect_delay;
+    /** plazos en ms de cada dirección y de todos los intentos (0: sin plazo) */
+    unsigned long connect_attempt_timeout;
+    unsigned long connect_budget;
+    /** TCP Fast Open hacia el origin con los datos que el cliente ya mandó */
+    bool origin_fastopen;
+
+    /** trabajo máximo por fd en cada iteración del selector (0: sin límite) */
+    unsigned long budget_bytes;
+    unsigned budget_ops;
+
+    /** conexiones, parsers y pedidos DNS que se reservan al arrancar */
+    unsigned long pool_prealloc;
+
+    /** relay con splice(2) para el tráfico que no se inspecciona */
+    bool splice;
+
+    /** MiB para buffers de túnel (ver tunnel_buffers_init) */
+    unsigned long buffer_memory;
+
+    /** ms sin tráfico tras los que un túnel devuelve sus buffers (0: nunca) */
+    unsigned long park_idle;
+
+    /** MSG_ZEROCOPY para los bloques de al menos `zerocopy_min' bytes */
+    bool zerocopy;
+    unsigned long zerocopy_min;
+
+    /** TCP_NOTSENT_LOWAT de los sockets del túnel (0: no se fija) */
+    unsigned long notsent_lowat;
+
+    /** tope para agrandar SO_SNDBUF/SO_RCVBUF según el BDP (0: no se tocan) */
+    unsigned long sockbuf_max;
+
+    /** bytes por segundo (0: sin límite). Ver ratelimit.h */
+    unsigned long limit_global;
+    unsigned long limit_user;
+    unsigned long limit_conn;
+
     struct users users[MAX_USERS];
 };
 
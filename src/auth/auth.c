@@ -2,8 +2,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "../args/args.h"
 
+// la tabla se consulta desde todos los reactores y el monitor la modifica
+// (ADDUSER) desde el suyo
+static pthread_rwlock_t users_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static struct users configured_users[MAX_USERS];
 static int num_configured_users = 0;
 
@@ -11,6 +16,7 @@ static char *dynamic_usernames[MAX_USERS] = {NULL};
 static char *dynamic_passwords[MAX_USERS] = {NULL};
 
 void auth_set_users(struct users *users, int max_users) {
+    pthread_rwlock_wrlock(&users_lock);
     num_configured_users = 0;
     for (int i = 0; i < max_users && i < MAX_USERS; i++) {
         if (users[i].name != NULL && users[i].pass != NULL) {
@@ -19,6 +25,7 @@ void auth_set_users(struct users *users, int max_users) {
             num_configured_users++;
         }
     }
+    pthread_rwlock_unlock(&users_lock);
 }
 
 bool auth_add_user(const char *username, const char *password) {
@@ -37,14 +44,17 @@ bool auth_add_user(const char *username, const char *password) {
         return false;
     }
 
+    bool ret = false;
+    pthread_rwlock_wrlock(&users_lock);
+
     for (int i = 0; i < num_configured_users; i++) {
         if (strcmp(configured_users[i].name, username) == 0) {
-            return false;
+            goto finally;
         }
     }
 
     if (num_configured_users >= MAX_USERS) {
-        return false;
+        goto finally;
     }
 
     char *username_copy = strdup(username);
@@ -53,7 +63,7 @@ bool auth_add_user(const char *username, const char *password) {
     if (username_copy == NULL || password_copy == NULL) {
         free(username_copy);
         free(password_copy);
-        return false;
+        goto finally;
     }
 
     dynamic_usernames[num_configured_users] = username_copy;
@@ -62,8 +72,11 @@ bool auth_add_user(const char *username, const char *password) {
     configured_users[num_configured_users].name = username_copy;
     configured_users[num_configured_users].pass = password_copy;
     num_configured_users++;
+    ret = true;
 
-    return true;
+finally:
+    pthread_rwlock_unlock(&users_lock);
+    return ret;
 }
 
 void auth_init(struct auth_st *st) {
@@ -142,13 +155,15 @@ bool auth_consume(struct auth_st *st, buffer *b) {
 void auth_validate(struct auth_st *st) {
     st->success = false;
     
+    pthread_rwlock_rdlock(&users_lock);
     for (int i = 0; i < num_configured_users; i++) {
         if (strcmp(st->username, configured_users[i].name) == 0 && 
             strcmp(st->password, configured_users[i].pass) == 0) {
             st->success = true;
-            return;
+            break;
         }
     }
+    pthread_rwlock_unlock(&users_lock);
 }
 
 // ============================================================================
@@ -185,28 +200,29 @@ unsigned client_auth_read_on_read_ready(struct selector_key *key) {
     struct socks5_conn *conn = key->data;
     struct auth_st *d = &conn->client.auth;
 
-    size_t space;
-    uint8_t *ptr = buffer_write_ptr(&conn->read_buf, &space);
-    if (space == 0) {
-        return C_ERROR;
-    }
+    // idem client_hello_read_on_read_ready: se lee hasta completar el
+    // mensaje o llegar a EAGAIN
+    bool done = false;
+    while (!done) {
+        size_t space;
+        uint8_t *ptr = buffer_write_ptr(&conn->read_buf, &space);
+        if (space == 0) {
+            return C_ERROR;
+        }
 
-    const ssize_t n = recv(key->fd, ptr, space, 0);
-    if (n == 0) {
-        return C_ERROR;
-    } else if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return C_AUTH_READ;
+        const ssize_t n = recv(key->fd, ptr, space, 0);
+        if (n == 0) {
+            return C_ERROR;
+        } else if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return C_AUTH_READ;
+            }
+            return C_ERROR;
         }
-        return C_ERROR;
-    }
 
-    buffer_write_adv(&conn->read_buf, (size_t)n);
+        buffer_write_adv(&conn->read_buf, (size_t)n);
 
-    bool done = auth_consume(d, &conn->read_buf);
-    
-    if (!done) {
-        return C_AUTH_READ;
+        done = auth_consume(d, &conn->read_buf);
     }
 
     auth_validate(d);
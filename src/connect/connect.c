@@ -1,17 +1,46 @@
 #include "connect.h"
 #include "../socks5/socks5.h"
 #include "../tunnel/tunnel.h"
+#include "../helpers/metrics.h"
+#include "../resolver/resolver.h"
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>   // TCP_INFO, TCPI_OPT_SYN_DATA
+#include <arpa/inet.h>
+#include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <netdb.h>
 
 // ============================================================================
-// ESTADOS DE CONEXION AL ORIGIN
+// HAPPY EYEBALLS
 // ============================================================================
 
+enum connect_result {
+    CONNECT_PENDING,    // hay intentos en vuelo
+    CONNECT_SUCCEEDED,  // uno conectó en el acto
+    CONNECT_FAILED,     // no queda nada por probar
+};
+
+static struct connect_timing timing = {
+    .attempt_delay = CONNECT_DEFAULT_ATTEMPT_DELAY_MS,
+};
+
+void connect_set_timing(const struct connect_timing *t) {
+    timing = *t;
+}
+
+static bool fastopen = false;
+
+void connect_set_fastopen(bool enabled) {
+    fastopen = enabled;
+}
+
 static int connect_set_non_blocking(int fd) {
     const int flags = fcntl(fd, F_GETFL);
     if (flags == -1) {
@@ -20,148 +49,516 @@ static int connect_set_non_blocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-void origin_connect_on_arrival(unsigned state, struct selector_key *key) {
-    (void)state;
-    selector_set_interest_key(key, OP_WRITE);
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
-unsigned origin_connect_on_write_ready(struct selector_key *key) {
-    struct socks5_conn *conn = key->data;
-    int err = 0;
-    socklen_t len = sizeof(err);
+// Código de respuesta según el último error: un plazo vencido (propio o del
+// kernel) es 0x06 (TTL expired); sin ningún intento, 0x04.
+static uint8_t connect_reply_code(int error) {
+    switch (error) {
+        case 0:
+        case EHOSTUNREACH:
+            return 0x04;
+        case ETIMEDOUT:
+            return 0x06;
+        case ENETUNREACH:
+            return 0x03;
+        default:
+            return 0x05;
+    }
+}
 
-    if (getsockopt(key->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
-        // getsockopt falló — liberar addrinfo y reportar error
-        if (conn->addrinfo_list != NULL) {
-            freeaddrinfo(conn->addrinfo_list);
-            conn->addrinfo_list = NULL;
-            conn->addrinfo_current = NULL;
-        }
-        return O_ERROR;
-    }
-
-    if (err != 0) {
-        // ================================================================
-        // Conexión falló — intentar siguiente dirección si hay disponibles
-        // ================================================================
-        if (conn->addrinfo_current != NULL) {
-            // Desregistrar y cerrar el fd actual
-            selector_unregister_fd(key->s, key->fd);
-            close(key->fd);
-            conn->origin_fd = -1;
-
-            struct addrinfo *rp;
-            int new_fd = -1;
-            bool immediate = false;
-
-            for (rp = conn->addrinfo_current; rp != NULL; rp = rp->ai_next) {
-                new_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-                if (new_fd == -1) continue;
-
-                if (connect_set_non_blocking(new_fd) == -1) {
-                    close(new_fd);
-                    new_fd = -1;
-                    continue;
-                }
-
-                int cr = connect(new_fd, rp->ai_addr, rp->ai_addrlen);
-                if (cr == 0) {
-                    memcpy(&conn->origin_addr, rp->ai_addr, rp->ai_addrlen);
-                    conn->origin_addr_len = rp->ai_addrlen;
-                    immediate = true;
-                    conn->addrinfo_current = rp->ai_next;
-                    break;
-                }
-                if (cr == -1 && errno == EINPROGRESS) {
-                    memcpy(&conn->origin_addr, rp->ai_addr, rp->ai_addrlen);
-                    conn->origin_addr_len = rp->ai_addrlen;
-                    immediate = false;
-                    conn->addrinfo_current = rp->ai_next;
-                    break;
-                }
-
-                close(new_fd);
-                new_fd = -1;
-            }
+// Ordena los candidatos intercalando familias (RFC 8305 §4): primero la de
+// la primera dirección del resolver, que ya respeta las preferencias del
+// sistema (RFC 6724), y después una de cada familia.
+static void candidates_sort(struct connect_st *c, const struct addrinfo *list) {
+    const struct addrinfo *first[CONNECT_MAX_CANDIDATES];
+    const struct addrinfo *other[CONNECT_MAX_CANDIDATES];
+    unsigned first_n = 0, other_n = 0;
 
-            if (new_fd != -1) {
-                conn->origin_fd = new_fd;
-
-                if (immediate) {
-                    // Conexión inmediata exitosa
-                    freeaddrinfo(conn->addrinfo_list);
-                    conn->addrinfo_list = NULL;
-                    conn->addrinfo_current = NULL;
-
-                    if (selector_register(key->s, new_fd, socks5_get_handler(),
-                                          OP_WRITE, conn) != SELECTOR_SUCCESS) {
-                        close(new_fd);
-                        conn->origin_fd = -1;
-                        uint8_t addr[4] = {0, 0, 0, 0};
-                        client_set_reply(conn, 0x01, 0x01, addr, 0);
-                        conn->reply_ready = true;
-                        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-                        return O_CONNECTING;
-                    }
-                    conn->reply_code = 0x00;
-                    prepare_bound_addr(conn);
-                    conn->reply_ready = true;
-                    selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-                    selector_set_interest(key->s, new_fd, OP_NOOP);
-                    return O_CONNECTING;
-                }
-
-                // EINPROGRESS — esperar que el nuevo fd se conecte
-                if (selector_register(key->s, new_fd, socks5_get_handler(),
-                                      OP_WRITE, conn) != SELECTOR_SUCCESS) {
-                    close(new_fd);
-                    conn->origin_fd = -1;
-                    freeaddrinfo(conn->addrinfo_list);
-                    conn->addrinfo_list = NULL;
-                    conn->addrinfo_current = NULL;
-                    uint8_t addr[4] = {0, 0, 0, 0};
-                    client_set_reply(conn, 0x05, 0x01, addr, 0);
-                    conn->reply_ready = true;
-                    selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-                    return O_CONNECTING;
-                }
-                // Quedarse en O_CONNECT — el nuevo fd disparará write-ready
-                return O_CONNECT;
+    for (const struct addrinfo *rp = list; rp != NULL; rp = rp->ai_next) {
+        if (rp->ai_family == list->ai_family) {
+            if (first_n < CONNECT_MAX_CANDIDATES) {
+                first[first_n++] = rp;
             }
+        } else if (other_n < CONNECT_MAX_CANDIDATES) {
+            other[other_n++] = rp;
+        }
+    }
+
+    c->candidates_n = 0;
+    for (unsigned i = 0; c->candidates_n < CONNECT_MAX_CANDIDATES && (i < first_n || i < other_n); i++) {
+        if (i < first_n) {
+            c->candidates[c->candidates_n++] = first[i];
+        }
+        if (i < other_n && c->candidates_n < CONNECT_MAX_CANDIDATES) {
+            c->candidates[c->candidates_n++] = other[i];
+        }
+    }
+    c->next = 0;
+}
+
+// Libera el lugar `i'. Con `close_fd' además cierra su socket
+static void attempt_drop(fd_selector s, struct connect_st *c, unsigned i, bool close_fd) {
+    struct connect_attempt *a = c->attempts + i;
+    selector_timer_cancel(s, &a->timer);
+    if (close_fd) {
+        selector_unregister_fd(s, a->fd);
+        close(a->fd);
+    }
+    a->fd = -1;
+    c->attempts_n--;
+}
+
+static void attempt_expired(struct selector_key *key, struct selector_timer *t);
+
+// connect(2), o sendto(2) con MSG_FASTOPEN si corresponde. Con cookie el
+// kernel encola los bytes (`early') y manda el SYN con ellos; sin cookie
+// manda un SYN común que la pide y retorna EINPROGRESS sin encolar nada.
+// Como con connect(2), retorna -1 y errno EINPROGRESS mientras conecta.
+//
+// Solo se usa si el destino tiene una única dirección: un servidor que
+// acepta el SYN entrega los datos en el acto, así que un intento que pierde
+// la carrera, o que falla después, ya los habría entregado y el túnel los
+// mandaría de nuevo a otra dirección.
+static int attempt_connect(struct socks5_conn *conn, int fd, const struct addrinfo *rp, size_t *early) {
+    struct connect_st *c = &conn->connect;
+    *early = 0;
+
+    size_t n;
+    uint8_t *data = buffer_read_ptr(&conn->read_buf, &n);
+    if (!fastopen || c->candidates_n != 1 || n == 0) {
+        return connect(fd, rp->ai_addr, rp->ai_addrlen);
+    }
+
+    struct socks5_metrics *m = metrics_get();
+    m->tfo_attempts++;
+    const ssize_t sent = sendto(fd, data, n, MSG_FASTOPEN | MSG_NOSIGNAL, rp->ai_addr, rp->ai_addrlen);
+    if (sent > 0) {
+        *early = (size_t)sent;
+        errno = EINPROGRESS;
+        return -1;
+    }
+    if (errno == EOPNOTSUPP) {
+        // TFO de cliente deshabilitado (net.ipv4.tcp_fastopen)
+        m->tfo_fallbacks++;
+        return connect(fd, rp->ai_addr, rp->ai_addrlen);
+    }
+    if (errno == EINPROGRESS) {
+        m->tfo_fallbacks++;
+    }
+    return -1;
+}
+
+// true si el origin confirmó los datos del SYN; si no, el kernel los
+// retransmitió después del handshake
+static bool attempt_syn_data_acked(int fd) {
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) {
+        return false;
+    }
+    return (ti.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+}
+
+// Arranca el próximo candidato que se pueda. Los que fallan en el acto (p.ej.
+// una familia sin ruta) se saltean. retorna el índice del intento, o -1 si
+// no queda ninguno; `connected' indica si conectó sin esperar.
+static int attempt_launch(fd_selector s, struct socks5_conn *conn, bool *connected) {
+    struct connect_st *c = &conn->connect;
+    struct socks5_metrics *m = metrics_get();
 
-            // Todas las direcciones agotadas
-            freeaddrinfo(conn->addrinfo_list);
-            conn->addrinfo_list = NULL;
-            conn->addrinfo_current = NULL;
+    while (c->next < c->candidates_n && c->attempts_n < CONNECT_MAX_ATTEMPTS) {
+        const struct addrinfo *rp = c->candidates[c->next++];
+        const int fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        if (connect_set_non_blocking(fd) == -1) {
+            close(fd);
+            continue;
         }
 
-        // No hay más direcciones — reportar error al cliente
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x05, 0x01, addr, 0);
-        conn->reply_ready = true;
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        // Si el fd ya fue desregistrado (retry path), no usar key->fd
-        if (conn->origin_fd != -1) {
-            selector_set_interest_key(key, OP_NOOP);
+        m->connect_attempts++;
+        size_t early;
+        const int r = attempt_connect(conn, fd, rp, &early);
+        if (r == -1 && errno != EINPROGRESS) {
+            c->error = errno;
         }
-        return O_CONNECTING;
+        if ((r == -1 && errno != EINPROGRESS)
+            || selector_register(s, fd, socks5_get_handler(), OP_WRITE, conn) != SELECTOR_SUCCESS) {
+            m->connect_attempts_failed++;
+            close(fd);
+            continue;
+        }
+
+        unsigned i = 0;
+        while (c->attempts[i].fd != -1) {
+            i++;
+        }
+        struct connect_attempt *a = c->attempts + i;
+        a->fd = fd;
+        a->ai = rp;
+        a->fastopen = early;
+        c->attempts_n++;
+        *connected = r == 0;
+        if (r != 0 && timing.attempt_timeout != 0) {
+            a->timer.fd      = fd;
+            a->timer.handler = attempt_expired;
+            selector_timer_add(s, &a->timer, timing.attempt_timeout);
+        }
+        return (int)i;
+    }
+    return -1;
+}
+
+// Lanza el siguiente intento y, si quedan candidatos, programa el otro
+static enum connect_result connect_next(fd_selector s, struct socks5_conn *conn, int *winner) {
+    struct connect_st *c = &conn->connect;
+    bool connected = false;
+
+    const int i = attempt_launch(s, conn, &connected);
+    if (i == -1) {
+        return c->attempts_n == 0 ? CONNECT_FAILED : CONNECT_PENDING;
     }
+    if (connected) {
+        *winner = i;
+        return CONNECT_SUCCEEDED;
+    }
+    if (timing.attempt_delay != 0 && c->next < c->candidates_n) {
+        selector_timer_reset(s, &c->delay_timer, timing.attempt_delay);
+    }
+    return CONNECT_PENDING;
+}
+
+// Respuesta de error al cliente, sin dirección
+static void connect_reply(fd_selector s, struct socks5_conn *conn, uint8_t rep) {
+    uint8_t addr[4] = {0, 0, 0, 0};
+    client_set_reply(conn, rep, 0x01, addr, 0);
+    selector_set_interest(s, conn->client_fd, OP_WRITE);
+}
 
-    // ================================================================
-    // Conexión exitosa — liberar addrinfo si quedaba pendiente
-    // ================================================================
+void connect_abort(fd_selector s, struct socks5_conn *conn) {
+    struct connect_st *c = &conn->connect;
+    // antes de connect_start los lugares no están inicializados
+    for (unsigned i = 0; i < CONNECT_MAX_ATTEMPTS && c->attempts_n > 0; i++) {
+        if (c->attempts[i].fd != -1) {
+            attempt_drop(s, c, i, true);
+        }
+    }
+    selector_timer_cancel(s, &c->delay_timer);
+    selector_timer_cancel(s, &c->budget_timer);
+    c->candidates_n = c->next = 0;
+    c->resolve_seq = 0;
     if (conn->addrinfo_list != NULL) {
         freeaddrinfo(conn->addrinfo_list);
         conn->addrinfo_list = NULL;
-        conn->addrinfo_current = NULL;
     }
+}
+
+// Único punto de salida del motor. Con `winner' != -1 ese intento pasa a
+// ser el origin y se descartan los demás; si no, se responde según el último
+// error. `in_origin': se llama desde un evento del origin y su máquina de
+// estados avanza sola; si no, se la pasa a mano a O_CONNECTING.
+static void connect_complete(fd_selector s, struct socks5_conn *conn, int winner, bool in_origin) {
+    struct connect_st *c = &conn->connect;
+
+    if (winner == -1) {
+        const uint8_t rep = connect_reply_code(c->error);
+        connect_abort(s, conn);
+        connect_reply(s, conn, rep);
+        return;
+    }
+
+    const int fd = c->attempts[winner].fd;
+    const struct addrinfo *ai = c->attempts[winner].ai;
+    c->fastopen_sent = c->attempts[winner].fastopen;
+    attempt_drop(s, c, (unsigned)winner, false);
 
+    struct socks5_metrics *m = metrics_get();
+    if (c->fastopen_sent > 0) {
+        if (attempt_syn_data_acked(fd)) {
+            m->tfo_accepted++;
+        } else {
+            m->tfo_fallbacks++;
+        }
+    }
+    const uint64_t elapsed = now_ms() - c->started_ms;
+    if (ai->ai_family == AF_INET6) {
+        m->connect_ipv6++;
+        m->connect_ms_ipv6 += elapsed;
+    } else {
+        m->connect_ipv4++;
+        m->connect_ms_ipv4 += elapsed;
+    }
+
+    memcpy(&conn->origin_addr, ai->ai_addr, ai->ai_addrlen);
+    conn->origin_addr_len = ai->ai_addrlen;
+    connect_abort(s, conn);
+
+    conn->origin_fd = fd;
     conn->reply_code = 0x00;
     prepare_bound_addr(conn);
     conn->reply_ready = true;
-    selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-    selector_set_interest_key(key, OP_NOOP);
-    return O_CONNECTING;
+    selector_set_interest(s, conn->client_fd, OP_WRITE);
+    selector_set_interest(s, fd, OP_NOOP);
+
+    if (!in_origin) {
+        conn->origin_stm.current = conn->origin_stm.states + O_CONNECTING;
+        if (conn->origin_stm.current->on_arrival != NULL) {
+            struct selector_key origin_key = {
+                .s    = s,
+                .fd   = fd,
+                .data = conn,
+            };
+            conn->origin_stm.current->on_arrival(O_CONNECTING, &origin_key);
+        }
+    }
+}
+
+// Lanza el siguiente intento y, si con eso el pedido terminó, lo completa
+static enum connect_result connect_run(fd_selector s, struct socks5_conn *conn, bool in_origin) {
+    int winner = -1;
+    const enum connect_result r = connect_next(s, conn, &winner);
+    if (r != CONNECT_PENDING) {
+        connect_complete(s, conn, winner, in_origin);
+    }
+    return r;
+}
+
+// Venció el escalonamiento sin que conecte ningún intento: arranca otro
+static void connect_delay_expired(struct selector_key *key, struct selector_timer *t) {
+    (void)t;
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+    connect_run(key->s, conn, false);
+}
+
+// Un intento no conectó a tiempo (key->fd): se prueba la siguiente dirección
+static void attempt_expired(struct selector_key *key, struct selector_timer *t) {
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+    struct connect_st *c = &conn->connect;
+    const unsigned i = (unsigned)((struct connect_attempt *)((char *)t - offsetof(struct connect_attempt, timer)) - c->attempts);
+
+    struct socks5_metrics *m = metrics_get();
+    m->connect_attempts_failed++;
+    m->connect_attempts_timeout++;
+    c->error = ETIMEDOUT;
+    attempt_drop(key->s, c, i, true);
+    connect_run(key->s, conn, false);
+}
+
+// Se agotó el plazo del pedido: se cierra todo y se responde 0x06
+static void connect_budget_expired(struct selector_key *key, struct selector_timer *t) {
+    (void)t;
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+    metrics_get()->connect_budget_expired++;
+    conn->connect.error = ETIMEDOUT;
+    connect_complete(key->s, conn, -1, false);
+}
+
+void connect_expire(fd_selector s, struct socks5_conn *conn) {
+    // si la resolución termina más tarde, connect_resolved la descarta
+    conn->client.request.resolving = false;
+    conn->connect.resolve_seq = 0;
+    conn->connect.error = ETIMEDOUT;
+    connect_complete(s, conn, -1, false);
+}
+
+// Arranca los intentos sobre los candidatos ya cargados. `key' es la del cliente
+static void connect_start(struct selector_key *key, struct socks5_conn *conn) {
+    struct connect_st *c = &conn->connect;
+
+    for (unsigned i = 0; i < CONNECT_MAX_ATTEMPTS; i++) {
+        c->attempts[i].fd = -1;
+    }
+    c->attempts_n = 0;
+    c->error = 0;
+    c->started_ms = now_ms();
+    c->fastopen_sent = 0;
+    c->delay_timer.fd       = conn->client_fd;
+    c->delay_timer.handler  = connect_delay_expired;
+    c->budget_timer.fd      = conn->client_fd;
+    c->budget_timer.handler = connect_budget_expired;
+
+    if (connect_run(key->s, conn, false) == CONNECT_PENDING) {
+        if (timing.budget != 0) {
+            selector_timer_add(key->s, &c->budget_timer, timing.budget);
+        }
+        // el cliente espera la respuesta sin eventos
+        selector_set_interest(key->s, conn->client_fd, OP_NOOP);
+    }
+}
+
+// ============================================================================
+// DESTINOS
+// ============================================================================
+
+// Una dirección literal no pasa por getaddrinfo(3): el único candidato se
+// arma en `conn' a partir de lo que pidió el cliente.
+static bool literal_candidate(struct socks5_conn *conn) {
+    struct connect_st *c = &conn->connect;
+    struct addrinfo *ai = &c->literal;
+
+    memset(ai, 0, sizeof(*ai));
+    memset(&c->literal_addr, 0, sizeof(c->literal_addr));
+    if (conn->req_atyp == 0x01) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&c->literal_addr;
+        sin->sin_family = AF_INET;
+        sin->sin_port   = htons(conn->req_port);
+        memcpy(&sin->sin_addr, conn->req_addr, 4);
+        ai->ai_addrlen  = sizeof(*sin);
+    } else if (conn->req_atyp == 0x04) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&c->literal_addr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port   = htons(conn->req_port);
+        memcpy(&sin6->sin6_addr, conn->req_addr, 16);
+        ai->ai_addrlen    = sizeof(*sin6);
+    } else {
+        return false;
+    }
+    ai->ai_family   = c->literal_addr.ss_family;
+    ai->ai_socktype = SOCK_STREAM;
+    ai->ai_protocol = IPPROTO_TCP;
+    ai->ai_addr     = (struct sockaddr *)&c->literal_addr;
+
+    c->candidates[0] = ai;
+    c->candidates_n  = 1;
+    c->next          = 0;
+    return true;
+}
+
+// Números de pedido de resolución, compartidos por todos los reactores. Una
+// conexión cerrada mientras resolvía puede volver del pool con el mismo fd
+// (el kernel reparte el menor libre) y otro pedido en curso: solo el número
+// distingue el resultado viejo del nuevo.
+static atomic_uint_fast32_t resolve_seq;
+
+static uint32_t resolve_seq_next(void) {
+    uint32_t seq;
+    do {
+        seq = (uint32_t)atomic_fetch_add_explicit(&resolve_seq, 1, memory_order_relaxed) + 1;
+    } while (seq == 0);
+    return seq;
+}
+
+// Callback del resolver, en el thread del reactor con la key del cliente
+static void connect_resolved(struct selector_key *key, enum resolver_status status,
+                             struct addrinfo *result, void *data, uint32_t seq) {
+    struct socks5_conn *conn = (struct socks5_conn *)data;
+    struct request_st *d = &conn->client.request;
+    struct socks5_metrics *m = metrics_get();
+
+    if (!d->resolving || seq != conn->connect.resolve_seq) {
+        // venció el plazo de conexión mientras resolvíamos, o el resultado
+        // es de un pedido anterior en la misma conexión del pool
+        resolver_free_result(result);
+        return;
+    }
+    conn->connect.resolve_seq = 0;
+    d->resolving = false;
+
+    if (status != RESOLVER_SUCCESS || result == NULL) {
+        m->dns_fail++;
+        resolver_free_result(result);
+        connect_reply(key->s, conn, 0x04);
+        return;
+    }
+    m->dns_ok++;
+
+    conn->addrinfo_list = result;
+    candidates_sort(&conn->connect, result);
+    connect_start(key, conn);
+}
+
+void connect_request(struct selector_key *key, struct socks5_conn *conn) {
+    if (literal_candidate(conn)) {
+        connect_start(key, conn);
+        return;
+    }
+    if (conn->req_atyp != 0x03) {
+        connect_reply(key->s, conn, 0x08);
+        return;
+    }
+
+    char host[256];
+    char port[8];
+    memcpy(host, conn->req_addr, conn->req_addr_len);
+    host[conn->req_addr_len] = '\0';
+    snprintf(port, sizeof(port), "%u", conn->req_port);
+
+    struct request_st *d = &conn->client.request;
+    d->resolving = true;
+    conn->connect.resolve_seq = resolve_seq_next();
+    selector_set_interest(key->s, conn->client_fd, OP_NOOP);
+    if (!resolver_request(key, host, port, connect_resolved, conn, conn->connect.resolve_seq)) {
+        d->resolving = false;
+        conn->connect.resolve_seq = 0;
+        metrics_get()->dns_fail++;
+        connect_reply(key->s, conn, 0x01);
+    }
+}
+
+static int attempt_find(const struct connect_st *c, int fd) {
+    for (unsigned i = 0; i < CONNECT_MAX_ATTEMPTS && c->attempts_n > 0; i++) {
+        if (c->attempts[i].fd == fd) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool connect_is_attempt(const struct socks5_conn *conn, int fd) {
+    return attempt_find(&conn->connect, fd) != -1;
+}
+
+// ============================================================================
+// ESTADOS DE CONEXION AL ORIGIN
+// ============================================================================
+
+void origin_connect_on_arrival(unsigned state, struct selector_key *key) {
+    (void)state;
+    selector_set_interest_key(key, OP_WRITE);
+}
+
+// Se completó uno de los intentos en vuelo (key->fd)
+unsigned origin_connect_on_write_ready(struct selector_key *key) {
+    struct socks5_conn *conn = key->data;
+    struct connect_st *c = &conn->connect;
+
+    const int i = attempt_find(c, key->fd);
+    if (i == -1) {
+        return O_CONNECT;
+    }
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(key->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    if (err == 0) {
+        connect_complete(key->s, conn, i, true);
+        return O_CONNECTING;
+    }
+
+    // falló: se prueba la siguiente dirección sin esperar el escalonamiento
+    metrics_get()->connect_attempts_failed++;
+    c->error = err;
+    attempt_drop(key->s, c, (unsigned)i, true);
+
+    // si no queda nada se responde al cliente y el origin queda sin fd
+    return connect_run(key->s, conn, true) == CONNECT_PENDING ? O_CONNECT : O_CONNECTING;
 }
 
 void origin_connecting_on_arrival(unsigned state, struct selector_key *key) {
@@ -3,8 +3,97 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include "../helpers/selector.h"
 
+struct socks5_conn;
+
+// ===========================================================================
+// HAPPY EYEBALLS (RFC 8305)
+// ===========================================================================
+
+// Las direcciones del destino se prueban intercalando familias (IPv6, IPv4,
+// IPv6, ...) empezando por la que el resolver puso primero. Cada intento
+// arranca cuando falla el anterior o cuando pasa el escalonamiento sin que
+// ninguno conecte; el primero que conecta pasa a ser el origin y el resto
+// se descarta.
+//
+// Un intento que no conecta en `attempt_timeout' se da por fallido y deja
+// lugar al siguiente; si el pedido entero supera `budget' se responde
+// 0x06 (TTL expired).
+#define CONNECT_MAX_CANDIDATES              16
+#define CONNECT_MAX_ATTEMPTS                4   // intentos en vuelo a la vez
+#define CONNECT_DEFAULT_ATTEMPT_DELAY_MS    250 // RFC 8305 §5
+
+// Plazos en milisegundos. 0 desactiva cada uno.
+struct connect_timing {
+    unsigned long attempt_delay;    // escalonamiento; 0: de a un intento
+    unsigned long attempt_timeout;  // por dirección
+    unsigned long budget;           // por pedido, desde el primer intento
+};
+
+struct connect_attempt {
+    int fd;                         // -1: lugar libre
+    const struct addrinfo *ai;
+    struct selector_timer timer;    // attempt_timeout (sobre `fd')
+    size_t fastopen;                // bytes del cliente encolados con el SYN
+};
+
+struct connect_st {
+    // direcciones en el orden en que se prueban; apuntan a addrinfo_list
+    const struct addrinfo *candidates[CONNECT_MAX_CANDIDATES];
+    unsigned candidates_n;
+    unsigned next;
+
+    // los timers armados no se pueden mover: los lugares no se compactan
+    struct connect_attempt attempts[CONNECT_MAX_ATTEMPTS];
+    unsigned attempts_n;
+    // último error de un intento (errno), para el código de respuesta
+    int error;
+
+    // escalonamiento y plazo del pedido (sobre el fd del cliente)
+    struct selector_timer delay_timer;
+    struct selector_timer budget_timer;
+    // para el tiempo hasta conectar (ms, reloj monotónico)
+    uint64_t started_ms;
+
+    // resolución en curso (ver connect_resolved); 0: ninguna
+    uint32_t resolve_seq;
+
+    // TCP Fast Open: del ganador, los bytes de read_buf que ya están en el
+    // origin (ver tunnel_activate)
+    size_t fastopen_sent;
+
+    // candidato de una dirección literal (IPv4/IPv6), sin getaddrinfo
+    struct addrinfo literal;
+    struct sockaddr_storage literal_addr;
+};
+
+void connect_set_timing(const struct connect_timing *t);
+
+// TCP Fast Open hacia el origin: si el cliente ya mandó datos detrás del
+// pedido y el destino tiene una sola dirección, el intento los lleva en el
+// SYN (sendto con MSG_FASTOPEN). Sin cookie para el destino el kernel hace
+// un connect común y los datos salen por el túnel como siempre.
+void connect_set_fastopen(bool enabled);
+
+// Conecta al destino del pedido (req_atyp/req_addr/req_port): resuelve el
+// nombre si hace falta y prueba sus direcciones. `key' es la del cliente. El
+// resultado, éxito o error, queda en la respuesta al cliente.
+void connect_request(struct selector_key *key, struct socks5_conn *conn);
+
+// Se venció el plazo de la etapa (--connect-timeout): se abandona la
+// resolución o los intentos en curso y se responde como al agotar el plazo
+// del pedido, 0x06 (TTL expired)
+void connect_expire(fd_selector s, struct socks5_conn *conn);
+
+// true si `fd' es un intento de conexión en vuelo de `conn'
+bool connect_is_attempt(const struct socks5_conn *conn, int fd);
+
+// Descarta los intentos en vuelo y la lista de direcciones
+void connect_abort(fd_selector s, struct socks5_conn *conn);
+
 // ===========================================================================
 // Funciones de manejo de estados de conexión al origin
 // ===========================================================================
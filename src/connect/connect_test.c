@@ -0,0 +1,277 @@
+/**
+ * connect_test.c - un resultado de DNS tardío no llega a otra conexión
+ *
+ * Una conexión vence su plazo de conexión mientras resuelve y se cierra. La
+ * siguiente toma el mismo fd (el kernel reparte el menor libre) y la misma
+ * socks5_conn (el pool es LIFO), y también queda resolviendo. El resultado
+ * del primer pedido pasa entonces los controles del resolver (mismo fd, mismo
+ * `data') y no debe usarse para el segundo.
+ *
+ * getaddrinfo(3) se reemplaza por uno que espera a que la prueba lo suelte,
+ * así el orden de los eventos no depende del DNS del sistema. El thread
+ * principal hace de reactor.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "../helpers/selector.h"
+#include "../helpers/metrics.h"
+#include "../helpers/parser.h"
+#include "../resolver/resolver.h"
+#include "../socks5/socks5.h"
+#include "../tunnel/tunnel.h"
+
+#define TEST_CONNECT_TIMEOUT_MS 100
+#define TEST_WAIT_MS            2000
+
+#define CHECK(cond, what) do {                                          \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, what); \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+// ============================================================================
+// getaddrinfo(3) controlado por la prueba
+// ============================================================================
+
+static pthread_mutex_t gai_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gai_cond = PTHREAD_COND_INITIALIZER;
+/** llamadas empezadas y cuántas de ellas pueden terminar */
+static unsigned gai_calls;
+static unsigned gai_released;
+
+struct fake_result {
+    struct addrinfo ai;
+    struct sockaddr_in sin;
+};
+
+// 127.0.0.1 con el puerto pedido, sea cual sea el nombre
+int getaddrinfo(const char *node, const char *service,
+                const struct addrinfo *hints, struct addrinfo **res) {
+    (void)node;
+    (void)hints;
+
+    pthread_mutex_lock(&gai_lock);
+    const unsigned call = ++gai_calls;
+    pthread_cond_broadcast(&gai_cond);
+    while (gai_released < call) {
+        pthread_cond_wait(&gai_cond, &gai_lock);
+    }
+    pthread_mutex_unlock(&gai_lock);
+
+    struct fake_result *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return EAI_MEMORY;
+    }
+    r->sin.sin_family      = AF_INET;
+    r->sin.sin_port        = htons((uint16_t)atoi(service));
+    r->sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    r->ai.ai_family        = AF_INET;
+    r->ai.ai_socktype      = SOCK_STREAM;
+    r->ai.ai_protocol      = IPPROTO_TCP;
+    r->ai.ai_addrlen       = sizeof(r->sin);
+    r->ai.ai_addr          = (struct sockaddr *)&r->sin;
+    *res = &r->ai;
+    return 0;
+}
+
+void freeaddrinfo(struct addrinfo *res) {
+    free(res);
+}
+
+static unsigned gai_started(void) {
+    pthread_mutex_lock(&gai_lock);
+    const unsigned n = gai_calls;
+    pthread_mutex_unlock(&gai_lock);
+    return n;
+}
+
+static void gai_release(unsigned n) {
+    pthread_mutex_lock(&gai_lock);
+    gai_released = n;
+    pthread_cond_broadcast(&gai_cond);
+    pthread_mutex_unlock(&gai_lock);
+}
+
+// ============================================================================
+// Auxiliares
+// ============================================================================
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static fd_selector selector;
+
+static void reactor_step(void) {
+    const selector_status st = selector_select(selector);
+    CHECK(st == SELECTOR_SUCCESS, selector_error(st));
+}
+
+// Hace andar al reactor hasta que `fd' tenga `n' bytes (n == 0: hasta EOF)
+static void expect(int fd, uint8_t *out, size_t n) {
+    const uint64_t deadline = now_ms() + TEST_WAIT_MS;
+    size_t got = 0;
+    while (true) {
+        const ssize_t r = recv(fd, out + got, n - got, MSG_DONTWAIT);
+        if (n == 0 && r == 0) {
+            return;
+        }
+        if (r > 0) {
+            got += (size_t)r;
+            if (got == n) {
+                return;
+            }
+        } else {
+            CHECK(r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK), "unexpected EOF");
+        }
+        CHECK(now_ms() < deadline, "timed out waiting for the proxy");
+        reactor_step();
+    }
+}
+
+static int listen_loopback(uint16_t *port) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr   = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    socklen_t len = sizeof(addr);
+    CHECK(fd != -1, "socket");
+    CHECK(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0, "bind");
+    CHECK(listen(fd, 4) == 0, "listen");
+    CHECK(getsockname(fd, (struct sockaddr *)&addr, &len) == 0, "getsockname");
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Registra el extremo del proxy como lo haría el acceptor del servidor
+static struct socks5_conn *attach(int proxy_fd) {
+    CHECK(selector_fd_set_nio(proxy_fd) != -1, "selector_fd_set_nio");
+    struct socks5_conn *conn = socks5_new(proxy_fd);
+    CHECK(conn != NULL, "socks5_new");
+    CHECK(selector_register(selector, proxy_fd, socks5_get_handler(), OP_READ, conn) == SELECTOR_SUCCESS,
+          "selector_register");
+    socks5_start_timeout(conn, selector);
+    return conn;
+}
+
+// Saludo sin autenticación y CONNECT a `host':`port'
+static void request(int client_fd, const char *host, uint16_t port) {
+    const uint8_t hello[] = { 0x05, 0x01, 0x00 };
+    uint8_t reply[2];
+    CHECK(send(client_fd, hello, sizeof(hello), 0) == (ssize_t)sizeof(hello), "send hello");
+    expect(client_fd, reply, sizeof(reply));
+    CHECK(reply[1] == 0x00, "hello rejected");
+
+    uint8_t req[4 + 1 + 255 + 2] = { 0x05, 0x01, 0x00, 0x03 };
+    const size_t len = strlen(host);
+    req[4] = (uint8_t)len;
+    memcpy(req + 5, host, len);
+    req[5 + len] = (uint8_t)(port >> 8);
+    req[6 + len] = (uint8_t)(port & 0xFF);
+    CHECK(send(client_fd, req, 7 + len, 0) == (ssize_t)(7 + len), "send request");
+}
+
+// ============================================================================
+// Prueba
+// ============================================================================
+
+int main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    metrics_attach(0);
+
+    const struct selector_init init = {
+        .select_timeout = { .tv_sec = 0, .tv_nsec = 10 * 1000 * 1000 },
+        .backend        = SELECTOR_BACKEND_AUTO,
+    };
+    CHECK(selector_init(&init) == SELECTOR_SUCCESS, "selector_init");
+    selector = selector_new(64);
+    CHECK(selector != NULL, "selector_new");
+    CHECK(socks5_pool_init(4) && parser_pool_init(4), "pools");
+    CHECK(tunnel_buffers_init(4, 1 << 20), "tunnel_buffers_init");
+    // un solo worker: el segundo pedido espera detrás del primero
+    CHECK(resolver_init(1, 4), "resolver_init");
+    const struct socks5_timeouts timeouts = { .connect = TEST_CONNECT_TIMEOUT_MS };
+    socks5_set_timeouts(&timeouts);
+
+    uint16_t port_a, port_b;
+    const int origin_a = listen_loopback(&port_a);
+    const int origin_b = listen_loopback(&port_b);
+
+    // 1. la primera conexión vence su plazo mientras resuelve
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair");
+    const int client_fd = sv[0], proxy_fd = sv[1];
+    struct socks5_conn *first = attach(proxy_fd);
+    request(client_fd, "first.test", port_a);
+    const uint64_t deadline = now_ms() + TEST_WAIT_MS;
+    while (gai_started() < 1) {
+        CHECK(now_ms() < deadline, "first resolution never started");
+        reactor_step();
+    }
+    uint8_t reply[10];
+    expect(client_fd, reply, sizeof(reply));
+    CHECK(reply[1] == 0x06, "expected TTL expired (0x06) for the first request");
+    expect(client_fd, NULL, 0);
+    close(client_fd);
+
+    // 2. la segunda reutiliza el fd y la socks5_conn, y también resuelve
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair");
+    CHECK(sv[0] == client_fd && sv[1] == proxy_fd, "descriptors were not reused");
+    struct socks5_conn *second = attach(sv[1]);
+    CHECK(second == first, "socks5_conn was not reused");
+    request(sv[0], "second.test", port_b);
+    while (!second->client.request.resolving) {
+        CHECK(now_ms() < deadline, "second request never reached the resolver");
+        reactor_step();
+    }
+
+    // 3. llega el resultado del primero: no se debe conectar a su destino
+    gai_release(1);
+    while (gai_started() < 2) {
+        CHECK(now_ms() < deadline, "second resolution never started");
+        reactor_step();
+    }
+    for (int i = 0; i < 10; i++) {
+        reactor_step();
+    }
+    const int stray = accept(origin_a, NULL, NULL);
+    CHECK(stray == -1 && (errno == EAGAIN || errno == EWOULDBLOCK),
+          "stale DNS result was used for another connection");
+
+    // 4. el suyo sí
+    gai_release(2);
+    expect(sv[0], reply, sizeof(reply));
+    CHECK(reply[1] == 0x00, "second request failed");
+    const int origin = accept(origin_b, NULL, NULL);
+    CHECK(origin != -1, "second request did not reach its own destination");
+
+    close(origin);
+    close(sv[0]);
+    close(origin_a);
+    close(origin_b);
+    resolver_destroy();
+    selector_destroy(selector);
+    socks5_pool_close();
+    parser_pool_close();
+    tunnel_buffers_close();
+    selector_close();
+    printf("connect_test: ok\n");
+    return 0;
+}
@@ -309,46 +309,51 @@ void client_hello_read_on_departure(unsigned state, struct selector_key *key) {
 unsigned client_hello_read_on_read_ready(struct selector_key *key) {
     struct socks5_conn *conn = key->data;
     struct hello_st *d = &conn->client.hello;
-    unsigned ret = C_HELLO_READ;
-    bool error = false;
 
-    size_t space;
-    uint8_t *ptr = buffer_write_ptr(d->rb, &space);
-    if (space == 0) {
-        return C_ERROR;
-    }
+    // Se lee hasta completar el saludo o llegar a EAGAIN: en edge-triggered
+    // un saludo partido no vuelve a notificarse si quedó algo en el socket
+    while (true) {
+        bool error = false;
 
-    const ssize_t n = recv(key->fd, ptr, space, 0);
-    if (n == 0) {
-        return C_ERROR;
-    } else if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return C_HELLO_READ;
+        size_t space;
+        uint8_t *ptr = buffer_write_ptr(d->rb, &space);
+        if (space == 0) {
+            return C_ERROR;
         }
-        return C_ERROR;
-    }
 
-    buffer_write_adv(d->rb, (size_t)n);
-
-    const enum hello_state st = hello_consume(d->rb, &d->parser, &error);
-    if (hello_is_done(st, &error)) {
-        if (error) {
+        const ssize_t n = recv(key->fd, ptr, space, 0);
+        if (n == 0) {
             return C_ERROR;
-        }
-        
-        ret = client_hello_process(d);
-        if (ret == C_ERROR) {
+        } else if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return C_HELLO_READ;
+            }
             return C_ERROR;
         }
-        
-        if (selector_set_interest_key(key, OP_WRITE) != SELECTOR_SUCCESS) {
+
+        buffer_write_adv(d->rb, (size_t)n);
+
+        const enum hello_state st = hello_consume(d->rb, &d->parser, &error);
+        if (hello_is_done(st, &error)) {
+            if (error) {
+                return C_ERROR;
+            }
+
+            if (client_hello_process(d) == C_ERROR) {
+                return C_ERROR;
+            }
+
+            if (selector_set_interest_key(key, OP_WRITE) != SELECTOR_SUCCESS) {
+                return C_ERROR;
+            }
+
+            return C_HELLO_WRITE;
+        }
+
+        if (error) {
             return C_ERROR;
         }
-        
-        return C_HELLO_WRITE;
     }
-
-    return error ? C_ERROR : ret;
 }
 
 void client_hello_write_on_arrival(unsigned state, struct selector_key *key) {
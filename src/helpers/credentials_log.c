@@ -15,9 +15,10 @@ void credentials_log_record(const char *protocol,
     }
 
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+    struct tm tm_info;
+    localtime_r(&now, &tm_info);
     char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
 
     fprintf(file, "%s PROTO=%s SRC=%s DST=%s:%u USER=%s PASS=%s\n",
             timestamp, protocol, src_ip, dst_host, dst_port,
@@ -0,0 +1,287 @@
+/**
+ * flows.c - mediciones de TCP_INFO por túnel
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>   // struct tcp_info completo (delivery rate, *_limited)
+
+#include "flows.h"
+#include "metrics.h"     // METRICS_MAX_REACTORS
+
+#define US_PER_SEC 1000000ULL
+/** lecturas de un slot que cambia antes de darlo por perdido en FLOWS */
+#define FLOWS_READ_TRIES 4
+
+/**
+ * lo escribe solo el reactor dueño. `seq' es impar mientras lo hace: el
+ * monitor copia el slot y lo descarta si `seq' cambió en el medio.
+ */
+struct flow_slot {
+    atomic_uint seq;
+    bool used;
+    struct flow_info info;
+};
+
+struct flow_table {
+    /** id del primer slot */
+    int base;
+    /** primer slot que puede estar libre */
+    size_t hint;
+    struct flow_slot slots[FLOWS_MAX];
+};
+
+static _Atomic(struct flow_table *) tables[METRICS_MAX_REACTORS];
+static _Thread_local struct flow_table *local_table;
+
+/** topes efectivos de SO_SNDBUF y SO_RCVBUF (0: no se tocan) */
+static size_t sndbuf_max;
+static size_t rcvbuf_max;
+
+/**
+ * el kernel recorta setsockopt(2) a net.core.[wr]mem_max sin avisar, y eso
+ * puede quedar por debajo de lo que ya había alcanzado el autoajuste.
+ */
+static size_t
+sysctl_cap(const char *path, size_t max) {
+    unsigned long value = 0;
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        goto finally;
+    }
+    if(fscanf(f, "%lu", &value) == 1 && value < max) {
+        max = value;
+    }
+    fclose(f);
+finally:
+    return max;
+}
+
+void
+flows_set_sockbuf_max(size_t max) {
+    sndbuf_max = max == 0 ? 0 : sysctl_cap("/proc/sys/net/core/wmem_max", max);
+    rcvbuf_max = max == 0 ? 0 : sysctl_cap("/proc/sys/net/core/rmem_max", max);
+}
+
+bool
+flows_attach(unsigned reactor) {
+    if(reactor >= METRICS_MAX_REACTORS) {
+        return false;
+    }
+    struct flow_table *t = atomic_load_explicit(&tables[reactor], memory_order_acquire);
+    if(t == NULL) {
+        t = calloc(1, sizeof(*t));
+        if(t == NULL) {
+            return false;
+        }
+        t->base = (int)reactor * FLOWS_MAX;
+        atomic_store_explicit(&tables[reactor], t, memory_order_release);
+    }
+    local_table = t;
+    return true;
+}
+
+static void
+slot_write_begin(struct flow_slot *s) {
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void
+slot_write_end(struct flow_slot *s) {
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
+/** slot de `id' en la tabla del thread, o NULL si no es suyo */
+static struct flow_slot *
+slot_get(int id) {
+    struct flow_table *t = local_table;
+    if(t == NULL || id < t->base || id >= t->base + FLOWS_MAX) {
+        return NULL;
+    }
+    return t->slots + (id - t->base);
+}
+
+int
+flows_register(const char *user, const char *dest) {
+    struct flow_table *t = local_table;
+    if(t == NULL) {
+        return -1;
+    }
+    for(size_t i = t->hint; i < FLOWS_MAX; i++) {
+        struct flow_slot *s = t->slots + i;
+        if(s->used) {
+            continue;
+        }
+        slot_write_begin(s);
+        s->used = true;
+        memset(&s->info, 0, sizeof(s->info));
+        s->info.id = t->base + (int)i;
+        strncpy(s->info.user, user, sizeof(s->info.user) - 1);
+        strncpy(s->info.dest, dest, sizeof(s->info.dest) - 1);
+        slot_write_end(s);
+        t->hint = i + 1;
+        return s->info.id;
+    }
+    return -1;
+}
+
+void
+flows_unregister(int id) {
+    struct flow_slot *s = slot_get(id);
+    if(s == NULL) {
+        return;
+    }
+    slot_write_begin(s);
+    s->used = false;
+    slot_write_end(s);
+    if((size_t)(id - local_table->base) < local_table->hint) {
+        local_table->hint = (size_t)(id - local_table->base);
+    }
+}
+
+/** agranda `opt' (SO_SNDBUF o SO_RCVBUF) para que entren `want' bytes */
+static bool
+sockbuf_grow(int fd, int opt, uint64_t want, size_t max, uint32_t current) {
+    if(want > max) {
+        want = max;
+    }
+    // el kernel duplica lo pedido para cubrir su overhead y reporta el doble
+    if(want * 2 <= current) {
+        return false;
+    }
+    const int value = (int)want;
+    return setsockopt(fd, SOL_SOCKET, opt, &value, sizeof(value)) == 0;
+}
+
+static int
+sockbuf_get(int fd, int opt) {
+    int value = 0;
+    socklen_t len = sizeof(value);
+    if(getsockopt(fd, SOL_SOCKET, opt, &value, &len) == -1) {
+        value = 0;
+    }
+    return value;
+}
+
+/**
+ * mide `fd' en `leg'. Si hay tope agranda los buffers al doble del BDP: uno
+ * para lo que está en vuelo y otro para lo que llega mientras se confirma.
+ * Del lado de recepción se usa rcv_space, la estimación del kernel de lo que
+ * el otro extremo envía por RTT.
+ */
+static unsigned
+leg_sample(int fd, struct flow_leg *leg) {
+    unsigned grown = 0;
+    if(fd == -1) {
+        goto finally;
+    }
+
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    memset(&ti, 0, sizeof(ti));   // un kernel viejo completa menos campos
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1) {
+        goto finally;
+    }
+    leg->rtt_us            = ti.tcpi_rtt;
+    leg->min_rtt_us        = ti.tcpi_min_rtt;
+    leg->cwnd              = ti.tcpi_snd_cwnd;
+    leg->mss               = ti.tcpi_snd_mss;
+    leg->retrans           = ti.tcpi_total_retrans;
+    leg->delivery_rate     = ti.tcpi_delivery_rate;
+    leg->rwnd_limited_us   = ti.tcpi_rwnd_limited;
+    leg->sndbuf_limited_us = ti.tcpi_sndbuf_limited;
+    leg->bdp = leg->delivery_rate * (leg->min_rtt_us != 0 ? leg->min_rtt_us : leg->rtt_us)
+             / US_PER_SEC;
+    leg->sndbuf = (uint32_t)sockbuf_get(fd, SO_SNDBUF);
+    leg->rcvbuf = (uint32_t)sockbuf_get(fd, SO_RCVBUF);
+
+    if(leg->bdp != 0 && sndbuf_max != 0
+       && sockbuf_grow(fd, SO_SNDBUF, leg->bdp * 2, sndbuf_max, leg->sndbuf)) {
+        leg->sndbuf = (uint32_t)sockbuf_get(fd, SO_SNDBUF);
+        grown++;
+    }
+    if(ti.tcpi_rcv_space != 0 && rcvbuf_max != 0
+       && sockbuf_grow(fd, SO_RCVBUF, (uint64_t)ti.tcpi_rcv_space * 2, rcvbuf_max, leg->rcvbuf)) {
+        leg->rcvbuf = (uint32_t)sockbuf_get(fd, SO_RCVBUF);
+        grown++;
+    }
+finally:
+    return grown;
+}
+
+unsigned
+flows_sample(int id, struct flow_leg *client, int client_fd,
+             struct flow_leg *origin, int origin_fd) {
+    const unsigned grown = leg_sample(client_fd, client) + leg_sample(origin_fd, origin);
+
+    struct flow_slot *s = slot_get(id);
+    if(s != NULL) {
+        slot_write_begin(s);
+        s->info.client = *client;
+        s->info.origin = *origin;
+        slot_write_end(s);
+    }
+    return grown;
+}
+
+static uint64_t
+flow_rate(const struct flow_info *f) {
+    return f->client.delivery_rate > f->origin.delivery_rate
+         ? f->client.delivery_rate : f->origin.delivery_rate;
+}
+
+/** copia el slot si está en uso y no cambió mientras se leía */
+static bool
+slot_read(struct flow_slot *s, struct flow_info *out) {
+    for(int i = 0; i < FLOWS_READ_TRIES; i++) {
+        const unsigned seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if(seq & 1) {
+            continue;
+        }
+        const bool used = s->used;
+        memcpy(out, &s->info, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            return used;
+        }
+    }
+    return false;
+}
+
+size_t
+flows_snapshot(struct flow_info *out, size_t max) {
+    size_t n = 0;
+    struct flow_info f;
+
+    for(unsigned r = 0; r < METRICS_MAX_REACTORS && max > 0; r++) {
+        struct flow_table *t = atomic_load_explicit(&tables[r], memory_order_acquire);
+        if(t == NULL) {
+            continue;
+        }
+        for(size_t i = 0; i < FLOWS_MAX; i++) {
+            if(!slot_read(t->slots + i, &f)) {
+                continue;
+            }
+            // inserción ordenada; si no hay lugar se descarta el más lento
+            const uint64_t rate = flow_rate(&f);
+            size_t pos = n;
+            while(pos > 0 && flow_rate(out + pos - 1) < rate) {
+                pos--;
+            }
+            if(pos == max) {
+                continue;
+            }
+            const size_t keep = n < max ? n : max - 1;
+            memmove(out + pos + 1, out + pos, (keep - pos) * sizeof(*out));
+            out[pos] = f;
+            if(n < max) {
+                n++;
+            }
+        }
+    }
+    return n;
+}
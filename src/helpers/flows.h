@@ -0,0 +1,99 @@
+#ifndef FLOWS_H_Jc5rVn8WqT2xLm6PbZ4sKd9Gh3E
+#define FLOWS_H_Jc5rVn8WqT2xLm6PbZ4sKd9Gh3E
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * flows.c - mediciones de TCP_INFO por túnel
+ *
+ * Cada túnel guarda la medición de sus dos sockets (cliente y origen) en
+ * su propia conexión y la renueva cada FLOWS_SAMPLE_MS si movió datos desde
+ * la anterior. Además la publica en la tabla de su reactor, que el monitor
+ * lista con FLOWS. Cada reactor escribe solo la suya, sin locks (ver
+ * flows_attach); un túnel que no entra en la tabla se sigue midiendo, pero
+ * no aparece en FLOWS.
+ *
+ * Con `flows_set_sockbuf_max' además se agrandan SO_SNDBUF y SO_RCVBUF de
+ * cada socket hasta el doble del producto ancho de banda × demora (BDP)
+ * medido, sin pasar de ese tope. Nunca se achican: el kernel deja de
+ * ajustar solo un buffer fijado con setsockopt(2), así que se toca recién
+ * cuando la medición pide más de lo que hay.
+ */
+/** túneles publicados por reactor */
+#define FLOWS_MAX        1024
+#define FLOWS_SAMPLE_MS  1000
+
+/** última medición de un socket */
+struct flow_leg {
+    uint32_t rtt_us;
+    uint32_t min_rtt_us;
+    /** ventana de congestión, en segmentos de `mss' bytes */
+    uint32_t cwnd;
+    uint32_t mss;
+    uint32_t retrans;
+    /** bytes por segundo, según el kernel */
+    uint64_t delivery_rate;
+    /** delivery_rate × min_rtt */
+    uint64_t bdp;
+    /** tamaños vigentes (lo que reporta getsockopt, que incluye overhead) */
+    uint32_t sndbuf;
+    uint32_t rcvbuf;
+    /** tiempo acumulado limitado por la ventana del otro extremo y por SO_SNDBUF */
+    uint64_t rwnd_limited_us;
+    uint64_t sndbuf_limited_us;
+};
+
+struct flow_info {
+    int  id;
+    char user[64];
+    /** destino pedido, "host:puerto" */
+    char dest[96];
+    struct flow_leg client;
+    struct flow_leg origin;
+};
+
+/**
+ * tope para SO_SNDBUF/SO_RCVBUF. 0 (default): no se tocan. Se recorta a
+ * net.core.wmem_max y net.core.rmem_max, que el kernel impone igual.
+ */
+void
+flows_set_sockbuf_max(size_t max);
+
+/**
+ * asocia el thread que llama con la tabla del reactor `reactor', que se
+ * crea si hace falta. Un thread sin tabla mide igual pero no publica.
+ */
+bool
+flows_attach(unsigned reactor);
+
+/**
+ * publica un túnel en la tabla del reactor que llama.
+ * retorna su id, o -1 si la tabla está llena o no hay tabla.
+ */
+int
+flows_register(const char *user, const char *dest);
+
+/** da de baja `id', desde el reactor que lo registró. Acepta -1 */
+void
+flows_unregister(int id);
+
+/**
+ * mide los sockets del túnel en `client' y `origin', ajusta sus buffers y,
+ * si `id' no es -1, publica el resultado. Un fd -1 (lado ya cerrado)
+ * conserva la medición anterior. Solo desde el reactor dueño del túnel.
+ * retorna cuántos buffers se agrandaron.
+ */
+unsigned
+flows_sample(int id, struct flow_leg *client, int client_fd,
+             struct flow_leg *origin, int origin_fd);
+
+/**
+ * copia hasta `max' túneles, los de mayor delivery rate primero.
+ * retorna cuántos se copiaron.
+ */
+size_t
+flows_snapshot(struct flow_info *out, size_t max);
+
+#endif
@@ -1,12 +1,74 @@
 #include "metrics.h"
 #include <string.h>
+#include <stdatomic.h>
 
-static struct socks5_metrics global_metrics = {0};
+/** alineadas a línea de cache para que los reactores no se pisen */
+static struct reactor_metrics {
+    _Alignas(64) struct socks5_metrics m;
+} reactor_metrics[METRICS_MAX_REACTORS];
+
+static _Thread_local struct socks5_metrics *local_metrics = &reactor_metrics[0].m;
+
+static atomic_uint_fast64_t current_connections;
+static atomic_uint_fast64_t max_concurrent_connections;
 
 struct socks5_metrics * metrics_get(void) {
-    return &global_metrics;
+    return local_metrics;
+}
+
+bool metrics_attach(unsigned reactor) {
+    if (reactor >= METRICS_MAX_REACTORS) {
+        return false;
+    }
+    local_metrics = &reactor_metrics[reactor].m;
+    return true;
+}
+
+void metrics_aggregate(struct socks5_metrics *out) {
+    memset(out, 0, sizeof(*out));
+
+    // todos los campos son uint64_t: se recorren como arreglo. Los reactores
+    // escriben sin sincronizar, así que cada lectura es atómica pero el
+    // conjunto es aproximado
+    const size_t n = sizeof(*out) / sizeof(uint64_t);
+    uint64_t *dst = (uint64_t *)out;
+    for (unsigned r = 0; r < METRICS_MAX_REACTORS; r++) {
+        uint64_t *src = (uint64_t *)&reactor_metrics[r].m;
+        for (size_t i = 0; i < n; i++) {
+            dst[i] += __atomic_load_n(src + i, __ATOMIC_RELAXED);
+        }
+    }
+
+    out->current_connections        = atomic_load_explicit(&current_connections,
+                                                           memory_order_relaxed);
+    out->max_concurrent_connections = atomic_load_explicit(&max_concurrent_connections,
+                                                           memory_order_relaxed);
+}
+
+void metrics_connection_opened(void) {
+    local_metrics->total_connections++;
+
+    const uint64_t now = atomic_fetch_add_explicit(&current_connections, 1,
+                                                   memory_order_relaxed) + 1;
+    uint64_t max = atomic_load_explicit(&max_concurrent_connections,
+                                        memory_order_relaxed);
+    while (now > max && !atomic_compare_exchange_weak_explicit(
+                &max_concurrent_connections, &max, now,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void metrics_connection_closed(void) {
+    uint64_t now = atomic_load_explicit(&current_connections, memory_order_relaxed);
+    while (now > 0 && !atomic_compare_exchange_weak_explicit(
+                &current_connections, &now, now - 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
 }
 
 void metrics_reset(void) {
-    memset(&global_metrics, 0, sizeof(global_metrics));
+    memset(local_metrics, 0, sizeof(*local_metrics));
+    atomic_store_explicit(&max_concurrent_connections,
+                          atomic_load_explicit(&current_connections, memory_order_relaxed),
+                          memory_order_relaxed);
 }
@@ -2,6 +2,10 @@
 #define METRICS_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+/** cantidad máxima de reactores (threads con selector propio) */
+#define METRICS_MAX_REACTORS 64
 
 struct socks5_metrics {
     uint64_t total_connections;
@@ -10,6 +14,18 @@ struct socks5_metrics {
 
     uint64_t bytes_client_to_origin;
     uint64_t bytes_origin_to_client;
+    uint64_t bytes_spliced;          // de los anteriores, los movidos con splice(2)
+    uint64_t bytes_zerocopy;         // de los anteriores, los enviados con MSG_ZEROCOPY
+
+    uint64_t zerocopy_sends;         // envíos con MSG_ZEROCOPY
+    uint64_t zerocopy_copied;        // de ésos, los que el kernel igual copió
+    uint64_t zerocopy_fallback;      // envíos grandes que fueron por copia (sin lugar/ENOBUFS)
+    uint64_t zerocopy_drains;        // conexiones cerradas con envíos sin confirmar
+    uint64_t zerocopy_drain_resets;  // de ésas, las que no se confirmaron a tiempo (RST)
+    uint64_t zerocopy_orphaned_bytes; // buffers retenidos que se soltaron sin drain
+    uint64_t tunnel_reads;           // readv/splice del túnel desde un socket
+    uint64_t tunnel_writes;          // sendmsg/splice del túnel hacia un socket
+    uint64_t writes_deferred;        // escrituras del túnel que el socket no aceptó enteras
 
     uint64_t auth_ok;
     uint64_t auth_fail;
@@ -17,11 +33,68 @@ struct socks5_metrics {
     uint64_t dns_ok;
     uint64_t dns_fail;
 
+    uint64_t connect_attempts;       // connect(2) al origin (varios por pedido con Happy Eyeballs)
+    uint64_t connect_attempts_failed;
+    uint64_t connect_attempts_timeout; // de los fallidos, los que vencieron --connect-attempt-timeout
+    uint64_t connect_budget_expired;   // pedidos que agotaron --connect-budget (REP 0x06)
+    uint64_t connect_ipv4;           // pedidos conectados, según la familia que ganó
+    uint64_t connect_ipv6;
+    uint64_t connect_ms_ipv4;        // ms desde el primer intento hasta conectar
+    uint64_t connect_ms_ipv6;
+    uint64_t tfo_attempts;           // intentos abiertos con datos en el SYN (--origin-fastopen)
+    uint64_t tfo_accepted;           // el origin confirmó los datos del SYN
+    uint64_t tfo_fallbacks;          // sin cookie o datos no confirmados: handshake común
+
+    uint64_t timeouts_handshake;
+    uint64_t timeouts_connect;
+    uint64_t timeouts_idle;
+
+    uint64_t budget_bytes_exhausted; // fd que agotó los bytes de la iteración
+    uint64_t budget_ops_exhausted;   // fd que agotó las operaciones de la iteración
+
+    uint64_t buffer_grows;           // buffers de túnel que pasaron a una clase mayor
+    uint64_t buffer_shrinks;         // buffers de túnel que volvieron a una clase menor
+    uint64_t buffer_grow_denied;     // crecimientos rechazados por --buffer-memory
+    uint64_t buffer_parks;           // túneles inactivos que devolvieron sus buffers
+    uint64_t buffer_unparks;         // de ésos, los que volvieron a tener tráfico
+
+    uint64_t sockbuf_grows;          // SO_SNDBUF/SO_RCVBUF agrandados según el BDP medido
+    uint64_t flows_untracked;        // túneles medidos que no entraron en la tabla de FLOWS
+
+    uint64_t throttle_events;        // lecturas postergadas por falta de tokens
+    uint64_t throttled_ms_global;    // ms de espera por nivel que la impuso
+    uint64_t throttled_ms_user;
+    uint64_t throttled_ms_conn;
+    uint64_t ratelimit_untracked;    // túneles sin balde de usuario: la tabla estaba llena
+
     uint64_t rep_code_count[256];    // contador por código REP (0x00..0xFF)
 };
 
+/**
+ * Cada reactor acumula en su propia copia de las métricas, sin
+ * sincronización: metrics_get() retorna la del thread que llama. Los threads
+ * que no llamaron a metrics_attach usan la copia del reactor 0.
+ *
+ * current_connections y max_concurrent_connections son globales (ver
+ * metrics_connection_opened) y solo se leen con metrics_aggregate.
+ */
 struct socks5_metrics * metrics_get(void);
 
+/** asocia el thread que llama con la copia del reactor `reactor' */
+bool metrics_attach(unsigned reactor);
+
+/** suma en `out' las copias de todos los reactores */
+void metrics_aggregate(struct socks5_metrics *out);
+
+/** registra el alta / baja de una conexión */
+void metrics_connection_opened(void);
+void metrics_connection_closed(void);
+
+/**
+ * pone en cero la copia del thread que llama. Para no pisar contadores que
+ * otro thread está incrementando, cada reactor debe resetear la propia.
+ * El máximo de conexiones concurrentes vuelve al valor actual.
+ */
 void metrics_reset(void);
 
 #endif
@@ -1,9 +1,14 @@
 #include "monitor.h"
 #include "metrics.h"
 #include "selector.h"
+#include "pool.h"
 #include "../auth/auth.h"
+#include "../tunnel/tunnel.h"
+#include "ratelimit.h"
+#include "flows.h"
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <ctype.h>
@@ -12,9 +17,23 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <stdatomic.h>
+#include <stdarg.h>
 
 static int monitor_fd = -1;
 
+/**
+ * reactores cuyas métricas agrega el monitor. `reset' viaja por el canal de
+ * completitudes del selector para que cada reactor ponga en cero sus propios
+ * contadores.
+ */
+static struct monitor_reactor {
+    struct selector_completion reset;
+    fd_selector s;
+    atomic_bool reset_pending;
+} reactors[METRICS_MAX_REACTORS];
+static unsigned reactors_n = 0;
+
 struct monitor_client {
     char buffer[8192];
     size_t len;
@@ -26,12 +45,21 @@ struct monitor_client {
     size_t recv_len;
 };
 
+/** túneles que lista FLOWS: los que entran en `buffer' */
+#define MONITOR_FLOWS_MAX 16
+
+/** clientes del monitor que se reservan de antemano */
+#define MONITOR_CLIENT_PREALLOC 4
+
+static struct pool *clients;
+
 static void monitor_accept(struct selector_key *key);
 static void monitor_client_read(struct selector_key *key);
 static void monitor_client_write(struct selector_key *key);
 static void monitor_client_close(struct selector_key *key);
 
 static const struct fd_handler monitor_handler = {
+    .name         = "monitor",
     .handle_read  = monitor_accept,
     .handle_write = NULL,
     .handle_block = NULL,
@@ -39,6 +67,7 @@ static const struct fd_handler monitor_handler = {
 };
 
 static const struct fd_handler monitor_client_handler = {
+    .name         = "monitor",
     .handle_read  = monitor_client_read,
     .handle_write = monitor_client_write,
     .handle_block = NULL,
@@ -49,11 +78,54 @@ const struct fd_handler * monitor_get_handler(void) {
     return &monitor_handler;
 }
 
+bool monitor_add_reactor(fd_selector s) {
+    if (s == NULL || reactors_n >= METRICS_MAX_REACTORS) {
+        return false;
+    }
+    struct monitor_reactor *r = reactors + reactors_n++;
+    r->s = s;
+    atomic_init(&r->reset_pending, false);
+    return true;
+}
+
+static void monitor_reactor_reset(struct selector_key *key,
+                                  struct selector_completion *c) {
+    struct monitor_reactor *r = (struct monitor_reactor *)c;
+    metrics_reset();
+    selector_reset_stats(key->s);
+    atomic_store(&r->reset_pending, false);
+}
+
+static void monitor_reset_all(void) {
+    for (unsigned i = 0; i < reactors_n; i++) {
+        struct monitor_reactor *r = reactors + i;
+        // si el reset anterior todavía no llegó, ese mismo alcanza
+        if (atomic_exchange(&r->reset_pending, true)) {
+            continue;
+        }
+        r->reset.fd       = -1;
+        r->reset.callback = monitor_reactor_reset;
+        r->reset.name     = "monitor";
+        if (selector_notify_completion(r->s, &r->reset) != SELECTOR_SUCCESS) {
+            atomic_store(&r->reset_pending, false);
+        }
+    }
+}
+
 int monitor_init(fd_selector s, const char *addr, const char *port) {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
     int listen_fd = -1;
 
+    if (clients == NULL) {
+        clients = pool_new("monitor_client", sizeof(struct monitor_client),
+                           MONITOR_CLIENT_PREALLOC);
+        if (clients == NULL) {
+            fprintf(stderr, "monitor: no hay memoria para los clientes\n");
+            return -1;
+        }
+    }
+
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;     // IPv4 o IPv6
     hints.ai_socktype = SOCK_STREAM;
@@ -113,7 +185,7 @@ int monitor_init(fd_selector s, const char *addr, const char *port) {
     return 0;
 }
 
-static void monitor_accept(struct selector_key *key) {
+static bool monitor_accept_one(struct selector_key *key) {
     struct sockaddr_storage client_addr;
     socklen_t client_len = sizeof(client_addr);
 
@@ -122,25 +194,27 @@ static void monitor_accept(struct selector_key *key) {
         if (errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("monitor accept");
         }
-        return;
+        return false;
     }
 
     if (selector_fd_set_nio(client_fd) == -1) {
         perror("monitor: selector_fd_set_nio");
         close(client_fd);
-        return;
+        return true;
     }
 
-    struct monitor_client *mc = malloc(sizeof(*mc));
+    struct monitor_client *mc = pool_get(clients);
     if (mc == NULL) {
-        perror("monitor: malloc monitor_client");
+        perror("monitor: pool_get monitor_client");
         close(client_fd);
-        return;
+        return true;
     }
 
     memset(mc, 0, sizeof(*mc));
 
-    struct socks5_metrics *m = metrics_get();
+    struct socks5_metrics aggregated;
+    struct socks5_metrics *m = &aggregated;
+    metrics_aggregate(m);
 
     int offset = 0;
 
@@ -165,8 +239,41 @@ static void monitor_accept(struct selector_key *key) {
                       "  bytes_client_to_origin: %llu\n",
                       (unsigned long long)m->bytes_client_to_origin);
     offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
-                      "  bytes_origin_to_client: %llu\n\n",
+                      "  bytes_origin_to_client: %llu\n",
                       (unsigned long long)m->bytes_origin_to_client);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  bytes_spliced:          %llu\n",
+                      (unsigned long long)m->bytes_spliced);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  bytes_zerocopy:         %llu\n",
+                      (unsigned long long)m->bytes_zerocopy);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_sends:         %llu\n",
+                      (unsigned long long)m->zerocopy_sends);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_copied:        %llu\n",
+                      (unsigned long long)m->zerocopy_copied);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_fallback:      %llu\n",
+                      (unsigned long long)m->zerocopy_fallback);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_drains:        %llu\n",
+                      (unsigned long long)m->zerocopy_drains);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_drain_resets:  %llu\n",
+                      (unsigned long long)m->zerocopy_drain_resets);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  zerocopy_orphaned_bytes: %llu\n",
+                      (unsigned long long)m->zerocopy_orphaned_bytes);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  tunnel_reads:           %llu\n",
+                      (unsigned long long)m->tunnel_reads);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  tunnel_writes:          %llu\n",
+                      (unsigned long long)m->tunnel_writes);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  writes_deferred:        %llu\n\n",
+                      (unsigned long long)m->writes_deferred);
 
     offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
                       "Authentication:\n");
@@ -186,6 +293,171 @@ static void monitor_accept(struct selector_key *key) {
                       "  dns_fail:               %llu\n\n",
                       (unsigned long long)m->dns_fail);
 
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Origin Connect:\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_attempts:       %llu\n",
+                      (unsigned long long)m->connect_attempts);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_attempts_failed: %llu\n",
+                      (unsigned long long)m->connect_attempts_failed);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_attempts_timeout: %llu\n",
+                      (unsigned long long)m->connect_attempts_timeout);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_budget_expired: %llu\n",
+                      (unsigned long long)m->connect_budget_expired);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_ipv4:           %llu\n",
+                      (unsigned long long)m->connect_ipv4);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_ipv6:           %llu\n",
+                      (unsigned long long)m->connect_ipv6);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_ms_ipv4:        %llu\n",
+                      (unsigned long long)m->connect_ms_ipv4);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  connect_ms_ipv6:        %llu\n",
+                      (unsigned long long)m->connect_ms_ipv6);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  tfo_attempts:           %llu\n",
+                      (unsigned long long)m->tfo_attempts);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  tfo_accepted:           %llu\n",
+                      (unsigned long long)m->tfo_accepted);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  tfo_fallbacks:          %llu\n\n",
+                      (unsigned long long)m->tfo_fallbacks);
+
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Timeouts:\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  timeouts_handshake:     %llu\n",
+                      (unsigned long long)m->timeouts_handshake);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  timeouts_connect:       %llu\n",
+                      (unsigned long long)m->timeouts_connect);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  timeouts_idle:          %llu\n\n",
+                      (unsigned long long)m->timeouts_idle);
+
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Fairness:\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  budget_bytes_exhausted: %llu\n",
+                      (unsigned long long)m->budget_bytes_exhausted);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  budget_ops_exhausted:   %llu\n\n",
+                      (unsigned long long)m->budget_ops_exhausted);
+
+    struct selector_stats ss = {0};
+    for (unsigned i = 0; i < reactors_n; i++) {
+        struct selector_stats rs;
+        selector_get_stats(reactors[i].s, &rs);
+        ss.interest_changes   += rs.interest_changes;
+        ss.interest_applied   += rs.interest_applied;
+        ss.interest_collapsed += rs.interest_collapsed;
+    }
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Selector:\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  reactors:               %u\n", reactors_n);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  interest_changes:       %llu\n",
+                      (unsigned long long)ss.interest_changes);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  interest_applied:       %llu\n",
+                      (unsigned long long)ss.interest_applied);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  interest_collapsed:     %llu\n\n",
+                      (unsigned long long)ss.interest_collapsed);
+
+    struct pool_stats ps[POOL_MAX_POOLS];
+    const size_t pools_n = pool_stats_all(ps, POOL_MAX_POOLS);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Pools (en uso / máximo / capacidad, crecimientos):\n");
+    for (size_t i = 0; i < pools_n; i++) {
+        offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                          "  %-23s %zu / %zu / %zu, %llu\n",
+                          ps[i].name, ps[i].in_use, ps[i].high_water,
+                          ps[i].capacity, (unsigned long long)ps[i].grows);
+    }
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset, "\n");
+
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Shaping (bytes/s, 0 sin límite):\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  limit_global:           %llu\n",
+                      (unsigned long long)ratelimit_get(RATELIMIT_GLOBAL, NULL));
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  limit_user:             %llu\n",
+                      (unsigned long long)ratelimit_get(RATELIMIT_USER, NULL));
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  limit_conn:             %llu\n",
+                      (unsigned long long)ratelimit_get(RATELIMIT_CONN, NULL));
+    const char *limit_names[RATELIMIT_MAX_USERS];
+    uint64_t limit_rates[RATELIMIT_MAX_USERS];
+    const size_t limits_n = ratelimit_users(limit_names, limit_rates, RATELIMIT_MAX_USERS);
+    // nombres acotados: la respuesta entera tiene que entrar en el buffer
+    for (size_t i = 0; i < limits_n && offset < (int)sizeof(mc->buffer) / 2; i++) {
+        offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                          "  limit_user[%.32s]: %llu\n",
+                          limit_names[i], (unsigned long long)limit_rates[i]);
+    }
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  throttle_events:        %llu\n",
+                      (unsigned long long)m->throttle_events);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  throttled_ms_global:    %llu\n",
+                      (unsigned long long)m->throttled_ms_global);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  throttled_ms_user:      %llu\n",
+                      (unsigned long long)m->throttled_ms_user);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  throttled_ms_conn:      %llu\n",
+                      (unsigned long long)m->throttled_ms_conn);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  ratelimit_untracked:    %llu\n\n",
+                      (unsigned long long)m->ratelimit_untracked);
+
+    struct tunnel_buffers_stats bs;
+    tunnel_buffers_stats(&bs);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "Tunnel Buffers:\n");
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  memory:                 %zu / %zu\n",
+                      bs.memory, bs.memory_max);
+    for (unsigned i = 0; i < TUNNEL_BUFFER_CLASSES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "in_use_%zuk:", bs.size[i] / 1024);
+        offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                          "  %-23s %zu\n", name, bs.in_use[i]);
+    }
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  buffer_grows:           %llu\n",
+                      (unsigned long long)m->buffer_grows);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  buffer_shrinks:         %llu\n",
+                      (unsigned long long)m->buffer_shrinks);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  buffer_grow_denied:     %llu\n",
+                      (unsigned long long)m->buffer_grow_denied);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  parked_tunnels:         %zu\n",
+                      bs.parked);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  buffer_parks:           %llu\n",
+                      (unsigned long long)m->buffer_parks);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  buffer_unparks:         %llu\n",
+                      (unsigned long long)m->buffer_unparks);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  sockbuf_grows:          %llu\n",
+                      (unsigned long long)m->sockbuf_grows);
+    offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
+                      "  flows_untracked:        %llu\n\n",
+                      (unsigned long long)m->flows_untracked);
+
     offset += snprintf(mc->buffer + offset, sizeof(mc->buffer) - offset,
                       "Reply Codes:\n");
 
@@ -207,9 +479,169 @@ static void monitor_accept(struct selector_key *key) {
     if (st != SELECTOR_SUCCESS) {
         fprintf(stderr, "monitor: selector_register client falló: %s\n", selector_error(st));
         close(client_fd);
-        free(mc);
+        pool_put(clients, mc);
+    }
+    return true;
+}
+
+// snprintf acumulativo que no se pasa del buffer aunque la salida se trunque
+static void appendf(char *buf, size_t size, size_t *offset, const char *fmt, ...) {
+    if (*offset >= size) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(buf + *offset, size - *offset, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        *offset += (size_t)n;
+        if (*offset >= size) {
+            *offset = size - 1;
+        }
+    }
+}
+
+// cota superior del percentil `p' (0-100) según los baldes del histograma
+static uint64_t histogram_percentile(const struct selector_histogram *h, unsigned p) {
+    const uint64_t target = (h->count * p + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < SELECTOR_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0) {
+            return i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+        }
+    }
+    return h->max;
+}
+
+static void append_histogram(char *buf, size_t size, size_t *offset,
+                             const char *name, const struct selector_histogram *h) {
+    appendf(buf, size, offset, "  %s:\n", name);
+    appendf(buf, size, offset,
+            "    count=%llu avg=%llu p50<=%llu p99<=%llu max=%llu\n",
+            (unsigned long long)h->count,
+            (unsigned long long)(h->count == 0 ? 0 : h->sum / h->count),
+            (unsigned long long)histogram_percentile(h, 50),
+            (unsigned long long)histogram_percentile(h, 99),
+            (unsigned long long)h->max);
+    if (h->count == 0) {
         return;
     }
+    appendf(buf, size, offset, "   ");
+    for (unsigned i = 0; i < SELECTOR_HIST_BUCKETS; i++) {
+        if (h->buckets[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            appendf(buf, size, offset, " 0:%llu", (unsigned long long)h->buckets[i]);
+        } else {
+            appendf(buf, size, offset, " <%llu:%llu",
+                    (unsigned long long)1 << i, (unsigned long long)h->buckets[i]);
+        }
+    }
+    appendf(buf, size, offset, "\n");
+}
+
+// Histogramas del loop sumados entre todos los reactores. Retorna 0 si la
+// instrumentación está apagada.
+static size_t monitor_loop_stats(char *buf, size_t size) {
+    // ~4KB cada una; el monitor corre en un único thread
+    static struct selector_loop_stats total, rs;
+    memset(&total, 0, sizeof(total));
+
+    bool enabled = false;
+    for (unsigned i = 0; i < reactors_n; i++) {
+        if (selector_get_loop_stats(reactors[i].s, &rs)) {
+            selector_loop_stats_merge(&total, &rs);
+            enabled = true;
+        }
+    }
+    if (!enabled) {
+        return 0;
+    }
+
+    size_t offset = 0;
+    appendf(buf, size, &offset, "=== Event Loop ===\n\n");
+    appendf(buf, size, &offset, "Loop:\n");
+    appendf(buf, size, &offset, "  reactors:               %u\n", reactors_n);
+    appendf(buf, size, &offset, "  iterations:             %llu\n",
+            (unsigned long long)total.iterations);
+    append_histogram(buf, size, &offset, "wait_us", &total.wait_us);
+    append_histogram(buf, size, &offset, "dispatch_us", &total.dispatch_us);
+    append_histogram(buf, size, &offset, "ready", &total.ready);
+    appendf(buf, size, &offset, "\nHandlers (us):\n");
+    for (unsigned i = 0; i < total.handlers_n; i++) {
+        append_histogram(buf, size, &offset, total.handlers[i].name,
+                         &total.handlers[i].time_us);
+    }
+    appendf(buf, size, &offset, "\n");
+    return offset;
+}
+
+static void append_flow_leg(char *buf, size_t size, size_t *offset,
+                            const char *name, const struct flow_leg *l) {
+    appendf(buf, size, offset,
+            "  %s: rtt=%uus min_rtt=%uus cwnd=%ux%u rate=%llu bdp=%llu"
+            " sndbuf=%u rcvbuf=%u retrans=%u rwnd_limited=%llums sndbuf_limited=%llums\n",
+            name, l->rtt_us, l->min_rtt_us, l->cwnd, l->mss,
+            (unsigned long long)l->delivery_rate, (unsigned long long)l->bdp,
+            l->sndbuf, l->rcvbuf, l->retrans,
+            (unsigned long long)(l->rwnd_limited_us / 1000),
+            (unsigned long long)(l->sndbuf_limited_us / 1000));
+}
+
+// Última medición de TCP_INFO de los túneles más rápidos (ver flows.h)
+static size_t monitor_flows(char *buf, size_t size) {
+    static struct flow_info flows[MONITOR_FLOWS_MAX];
+    const size_t n = flows_snapshot(flows, MONITOR_FLOWS_MAX);
+
+    size_t offset = 0;
+    appendf(buf, size, &offset, "=== Flows ===\n\n");
+    appendf(buf, size, &offset, "flows: %zu (máximo %d, por delivery rate)\n\n",
+            n, MONITOR_FLOWS_MAX);
+    for (size_t i = 0; i < n; i++) {
+        appendf(buf, size, &offset, "#%d %s -> %s\n", flows[i].id, flows[i].user, flows[i].dest);
+        append_flow_leg(buf, size, &offset, "client", &flows[i].client);
+        append_flow_leg(buf, size, &offset, "origin", &flows[i].origin);
+    }
+    appendf(buf, size, &offset, "\n");
+    return offset;
+}
+
+// SETLIMIT <GLOBAL|USER|CONN> [<usuario>] <bytes/s>
+static const char *monitor_setlimit(char **tokens, int token_count) {
+    static const char *levels[RATELIMIT_LEVELS] = {
+        [RATELIMIT_GLOBAL] = "GLOBAL",
+        [RATELIMIT_USER]   = "USER",
+        [RATELIMIT_CONN]   = "CONN",
+    };
+    int level = -1;
+    for (int i = 0; i < RATELIMIT_LEVELS; i++) {
+        if (strcasecmp(tokens[1], levels[i]) == 0) {
+            level = i;
+        }
+    }
+    const bool named = token_count == 4;
+    if (level == -1 || (named && level != RATELIMIT_USER)) {
+        return "ERROR: invalid limit\n";
+    }
+
+    const char *value = tokens[token_count - 1];
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long rate = strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE || value[0] == '-') {
+        return "ERROR: invalid limit\n";
+    }
+    if (!ratelimit_set((enum ratelimit_level)level, named ? tokens[2] : NULL, rate)) {
+        return "ERROR: too many users\n";
+    }
+    return "OK: limit set\n";
+}
+
+static void monitor_accept(struct selector_key *key) {
+    while (monitor_accept_one(key) && selector_is_edge_triggered(key->s)) {
+    }
 }
 
 static void monitor_client_read(struct selector_key *key) {
@@ -261,18 +693,18 @@ static void monitor_client_read(struct selector_key *key) {
         mc->sent = 0;
 
         // Parsear comando
-        char *tokens[3] = {NULL, NULL, NULL};
+        char *tokens[4] = {NULL, NULL, NULL, NULL};
         int token_count = 0;
         char *saveptr = NULL;
         char *token = strtok_r(mc->recv_buffer, " ", &saveptr);
         
-        while (token != NULL && token_count < 3) {
+        while (token != NULL && token_count < 4) {
             tokens[token_count++] = token;
             token = strtok_r(NULL, " ", &saveptr);
         }
 
         if (token_count == 1 && strcmp(tokens[0], "RESET") == 0) {
-            metrics_reset();
+            monitor_reset_all();
 
             const char *response = "OK: metrics reset\n";
             size_t resp_len = strlen(response);
@@ -281,6 +713,21 @@ static void monitor_client_read(struct selector_key *key) {
                 memcpy(mc->buffer, response, resp_len);
                 mc->len = resp_len;
             }
+        } else if (token_count == 1 && strcmp(tokens[0], "LOOPSTATS") == 0) {
+            mc->len = monitor_loop_stats(mc->buffer, sizeof(mc->buffer));
+            if (mc->len == 0) {
+                const char *response = "ERROR: loop stats disabled\n";
+                size_t resp_len = strlen(response);
+                memcpy(mc->buffer, response, resp_len);
+                mc->len = resp_len;
+            }
+        } else if (token_count == 1 && strcmp(tokens[0], "FLOWS") == 0) {
+            mc->len = monitor_flows(mc->buffer, sizeof(mc->buffer));
+        } else if ((token_count == 3 || token_count == 4) && strcmp(tokens[0], "SETLIMIT") == 0) {
+            const char *response = monitor_setlimit(tokens, token_count);
+            size_t resp_len = strlen(response);
+            memcpy(mc->buffer, response, resp_len);
+            mc->len = resp_len;
         } else if (token_count == 3 && strcmp(tokens[0], "ADDUSER") == 0) {
             const char *username = tokens[1];
             const char *password = tokens[2];
@@ -363,7 +810,7 @@ static void monitor_client_write(struct selector_key *key) {
 static void monitor_client_close(struct selector_key *key) {
     struct monitor_client *mc = key->data;
     if (mc != NULL) {
-        free(mc);
+        pool_put(clients, mc);
         key->data = NULL;
     }
 }
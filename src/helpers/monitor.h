@@ -1,8 +1,15 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+#include <stdbool.h>
 #include "selector.h"
 
+/**
+ * suma `s' a los reactores cuyas métricas y contadores del selector expone
+ * el monitor. Llamar antes de que los reactores empiecen a correr.
+ */
+bool monitor_add_reactor(fd_selector s);
+
 int monitor_init(fd_selector s, const char *addr, const char *port);
 
 const struct fd_handler * monitor_get_handler(void);
@@ -4,6 +4,7 @@
 #include <assert.h>
 
 #include "parser.h"
+#include "pool.h"
 
 /* CDT del parser */
 struct parser {
@@ -21,17 +22,39 @@ struct parser {
     struct parser_event e2;
 };
 
+/** si no es NULL los parsers salen de acá en vez de malloc(3) */
+static struct pool *parsers;
+
+bool
+parser_pool_init(size_t prealloc) {
+    if(parsers == NULL) {
+        parsers = pool_new("parser", sizeof(struct parser), prealloc);
+    }
+    return parsers != NULL;
+}
+
+void
+parser_pool_close(void) {
+    pool_destroy(parsers);
+    parsers = NULL;
+}
+
 void
 parser_destroy(struct parser *p) {
     if(p != NULL) {
-        free(p);
+        if(parsers != NULL) {
+            pool_put(parsers, p);
+        } else {
+            free(p);
+        }
     }
 }
 
 struct parser *
 parser_init(const unsigned *classes,
             const struct parser_definition *def) {
-    struct parser *ret = malloc(sizeof(*ret));
+    struct parser *ret = parsers != NULL ? pool_get(parsers)
+                                         : malloc(sizeof(*ret));
     if(ret != NULL) {
         memset(ret, 0, sizeof(*ret));
         ret->classes = classes;
@@ -12,6 +12,7 @@
  */
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 /**
  * Evento que retorna el parser.
@@ -57,6 +58,17 @@ struct parser_definition {
     const unsigned                         start_state;
 };
 
+/**
+ * hace que los parsers se obtengan de un pool con `prealloc' lugares ya
+ * reservados en vez de malloc(3). Llamar antes de crear el primero (y
+ * `parser_pool_close' después de destruir el último).
+ */
+bool
+parser_pool_init(size_t prealloc);
+
+void
+parser_pool_close(void);
+
 /**
  * inicializa el parser.
  *
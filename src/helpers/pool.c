@@ -0,0 +1,182 @@
+/**
+ * pool.c - pool de objetos de tamaño fijo
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+/**
+ * bytes por slab cuando la freelist se vacía durante la ejecución. Se mide en
+ * bytes y no en objetos para que un pool de buffers grandes no reserve megas
+ * de golpe; siempre se agrega al menos un objeto.
+ */
+#define POOL_GROW_BYTES (128 * 1024)
+
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/** un bloque de objetos contiguos. Los objetos empiezan tras el encabezado */
+struct slab {
+    struct slab *next;
+};
+
+#define SLAB_HEADER ALIGN_UP(sizeof(struct slab), _Alignof(max_align_t))
+
+/** un objeto libre guarda en sus primeros bytes el siguiente de la lista */
+struct free_object {
+    struct free_object *next;
+};
+
+struct pool {
+    const char         *name;
+    size_t              size;
+    pthread_mutex_t     lock;
+    struct free_object *free;
+    struct slab        *slabs;
+
+    size_t   capacity;
+    size_t   in_use;
+    size_t   high_water;
+    uint64_t grows;
+};
+
+/** pools vivos, para `pool_stats_all' */
+static struct pool    *pools[POOL_MAX_POOLS];
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** agrega a la freelist un slab de `n' objetos. Se llama con el lock tomado */
+static bool
+pool_grow(struct pool *p, size_t n) {
+    struct slab *slab = malloc(SLAB_HEADER + n * p->size);
+    if(slab == NULL) {
+        return false;
+    }
+    slab->next = p->slabs;
+    p->slabs   = slab;
+
+    char *objects = (char *)slab + SLAB_HEADER;
+    for(size_t i = n; i > 0; i--) {
+        struct free_object *o = (struct free_object *)(objects + (i - 1) * p->size);
+        o->next = p->free;
+        p->free = o;
+    }
+    p->capacity += n;
+    return true;
+}
+
+struct pool *
+pool_new(const char *name, size_t size, size_t prealloc) {
+    struct pool *p = calloc(1, sizeof(*p));
+    if(p == NULL) {
+        goto finally;
+    }
+    p->name = name;
+    p->size = ALIGN_UP(size < sizeof(struct free_object)
+                       ? sizeof(struct free_object) : size,
+                       _Alignof(max_align_t));
+    pthread_mutex_init(&p->lock, NULL);
+
+    if(prealloc > 0 && !pool_grow(p, prealloc)) {
+        pthread_mutex_destroy(&p->lock);
+        free(p);
+        p = NULL;
+        goto finally;
+    }
+
+    pthread_mutex_lock(&pools_lock);
+    for(size_t i = 0; i < POOL_MAX_POOLS; i++) {
+        if(pools[i] == NULL) {
+            pools[i] = p;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+finally:
+    return p;
+}
+
+void
+pool_destroy(struct pool *p) {
+    if(p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pools_lock);
+    for(size_t i = 0; i < POOL_MAX_POOLS; i++) {
+        if(pools[i] == p) {
+            pools[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+
+    struct slab *next;
+    for(struct slab *slab = p->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+void *
+pool_get(struct pool *p) {
+    struct free_object *o = NULL;
+
+    pthread_mutex_lock(&p->lock);
+    if(p->free == NULL) {
+        const size_t n = p->size < POOL_GROW_BYTES ? POOL_GROW_BYTES / p->size : 1;
+        if(!pool_grow(p, n)) {
+            goto finally;
+        }
+        p->grows++;
+    }
+    o       = p->free;
+    p->free = o->next;
+    p->in_use++;
+    if(p->in_use > p->high_water) {
+        p->high_water = p->in_use;
+    }
+finally:
+    pthread_mutex_unlock(&p->lock);
+    return o;
+}
+
+void
+pool_put(struct pool *p, void *obj) {
+    if(obj == NULL) {
+        return;
+    }
+    struct free_object *o = obj;
+
+    pthread_mutex_lock(&p->lock);
+    o->next = p->free;
+    p->free = o;
+    p->in_use--;
+    pthread_mutex_unlock(&p->lock);
+}
+
+void
+pool_get_stats(struct pool *p, struct pool_stats *out) {
+    pthread_mutex_lock(&p->lock);
+    out->name        = p->name;
+    out->object_size = p->size;
+    out->capacity    = p->capacity;
+    out->in_use      = p->in_use;
+    out->high_water  = p->high_water;
+    out->grows       = p->grows;
+    pthread_mutex_unlock(&p->lock);
+}
+
+size_t
+pool_stats_all(struct pool_stats *out, size_t max) {
+    size_t n = 0;
+
+    pthread_mutex_lock(&pools_lock);
+    for(size_t i = 0; i < POOL_MAX_POOLS && n < max; i++) {
+        if(pools[i] != NULL) {
+            pool_get_stats(pools[i], out + n++);
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+    return n;
+}
@@ -0,0 +1,78 @@
+#ifndef POOL_H_Vb3kR8sNw2YtLq6ZcJ1mXe5HdA9
+#define POOL_H_Vb3kR8sNw2YtLq6ZcJ1mXe5HdA9
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * pool.c - pool de objetos de tamaño fijo
+ *
+ * Cada tipo de objeto que se crea y destruye en el camino caliente (una
+ * conexión, un pedido al resolver, ...) tiene su propio pool: una freelist
+ * de objetos libres que se alimenta de bloques (slabs) pedidos de a muchos
+ * objetos por vez. Un objeto devuelto con `pool_put' queda en la freelist
+ * para el próximo `pool_get', así que en régimen no se llama a malloc(3).
+ *
+ * Los slabs solo se liberan al destruir el pool. El pool se puede usar desde
+ * varios threads (p.ej. un trabajo que se crea en un reactor y se libera en
+ * otro): las operaciones toman un mutex propio del pool.
+ */
+struct pool;
+
+/** estado de un pool, para monitoreo */
+struct pool_stats {
+    const char *name;
+    /** tamaño de cada objeto (ya alineado) */
+    size_t   object_size;
+    /** objetos creados en total (libres + en uso) */
+    size_t   capacity;
+    size_t   in_use;
+    /** máximo de `in_use' desde que se creó el pool */
+    size_t   high_water;
+    /** veces que la freelist estaba vacía y hubo que pedir un slab nuevo */
+    uint64_t grows;
+};
+
+/** cantidad máxima de pools que lista `pool_stats_all' */
+#define POOL_MAX_POOLS 16
+
+/**
+ * crea un pool de objetos de `size' bytes con `prealloc' objetos ya
+ * reservados. `name' debe vivir tanto como el pool.
+ *
+ * retorna NULL si no hay memoria.
+ */
+struct pool *
+pool_new(const char *name, size_t size, size_t prealloc);
+
+/**
+ * destruye el pool y todos sus objetos, incluso los que sigan en uso.
+ * Tolera NULLs.
+ */
+void
+pool_destroy(struct pool *p);
+
+/**
+ * obtiene un objeto del pool. Su contenido es indefinido (como el de
+ * malloc(3)). retorna NULL si no hay memoria.
+ */
+void *
+pool_get(struct pool *p);
+
+/** devuelve al pool un objeto obtenido con `pool_get'. Tolera NULLs */
+void
+pool_put(struct pool *p, void *obj);
+
+/** copia en `out' el estado del pool */
+void
+pool_get_stats(struct pool *p, struct pool_stats *out);
+
+/**
+ * copia en `out' el estado de hasta `max' pools vivos.
+ * retorna cuántos se copiaron.
+ */
+size_t
+pool_stats_all(struct pool_stats *out, size_t max);
+
+#endif
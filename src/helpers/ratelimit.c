@@ -0,0 +1,288 @@
+/**
+ * ratelimit.c - límites de ancho de banda con token buckets
+ */
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ratelimit.h"
+
+/** tope de los límites, para que el cálculo de tokens no desborde */
+#define RATELIMIT_MAX_RATE (1ULL << 40)
+
+#define US_PER_SEC 1000000ULL
+
+struct ratelimit_user {
+    char name[256];
+    /** si no tiene límite propio vale el de RATELIMIT_USER */
+    bool     custom;
+    uint64_t rate;
+    /** conexiones que lo usan. Sin límite propio y en 0 se puede reciclar */
+    unsigned refs;
+    struct token_bucket bucket;
+};
+
+/**
+ * el balde global, los de usuario y los límites se comparten entre
+ * reactores; el de cada conexión solo lo toca su reactor.
+ */
+static pthread_mutex_t       lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t              rates[RATELIMIT_LEVELS];
+static struct token_bucket   global;
+static struct ratelimit_user users[RATELIMIT_MAX_USERS];
+static size_t                users_n;
+
+/** hay algún límite: si no, no se toma el lock */
+static atomic_bool limited;
+
+static uint64_t
+now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * US_PER_SEC + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static int64_t
+bucket_burst(uint64_t rate) {
+    const uint64_t burst = rate * RATELIMIT_BURST_MS / 1000;
+    return (int64_t)(burst < RATELIMIT_MIN_BURST ? RATELIMIT_MIN_BURST : burst);
+}
+
+/**
+ * agrega los tokens acumulados desde la última vez. Si todavía no se juntó
+ * un token entero no se avanza el reloj, así no se pierden fracciones.
+ */
+static void
+bucket_refill(struct token_bucket *b, uint64_t rate, uint64_t now) {
+    uint64_t elapsed = now - b->last_us;
+    if(elapsed > US_PER_SEC) {
+        // más de un segundo sin uso: el balde ya está lleno
+        elapsed = US_PER_SEC;
+    }
+    const uint64_t added = elapsed * rate / US_PER_SEC;
+    if(added == 0 && elapsed < US_PER_SEC) {
+        return;
+    }
+    b->last_us = now;
+    b->tokens += (int64_t)added;
+    const int64_t burst = bucket_burst(rate);
+    if(b->tokens > burst) {
+        b->tokens = burst;
+    }
+}
+
+/**
+ * milisegundos hasta juntar un cuarto del balde (al menos
+ * RATELIMIT_MIN_BURST): despertar por cada pocos bytes no vale la pena.
+ */
+static unsigned long
+bucket_wait_ms(const struct token_bucket *b, uint64_t rate) {
+    int64_t want = bucket_burst(rate) / 4;
+    if(want < RATELIMIT_MIN_BURST) {
+        want = RATELIMIT_MIN_BURST;
+    }
+    const uint64_t missing = (uint64_t)(want - b->tokens);
+    const uint64_t us = (missing * US_PER_SEC + rate - 1) / rate;
+    return (unsigned long)((us + 999) / 1000);
+}
+
+/** límite de un usuario. Se llama con el lock tomado */
+static uint64_t
+user_rate(const struct ratelimit_user *u) {
+    return u->custom ? u->rate : rates[RATELIMIT_USER];
+}
+
+/**
+ * busca (o crea, si `create') la entrada de `name'. Si la tabla está llena
+ * recicla la de un usuario sin límite propio ni conexiones. Con el lock tomado
+ */
+static struct ratelimit_user *
+user_find(const char *name, bool create) {
+    struct ratelimit_user *idle = NULL;
+    for(size_t i = 0; i < users_n; i++) {
+        if(strcmp(users[i].name, name) == 0) {
+            return users + i;
+        }
+        if(idle == NULL && !users[i].custom && users[i].refs == 0) {
+            idle = users + i;
+        }
+    }
+    if(!create) {
+        return NULL;
+    }
+    struct ratelimit_user *u = idle;
+    if(users_n < RATELIMIT_MAX_USERS) {
+        u = users + users_n++;
+    } else if(u == NULL) {
+        return NULL;
+    }
+    memset(u, 0, sizeof(*u));
+    strncpy(u->name, name, sizeof(u->name) - 1);
+    return u;
+}
+
+/** recalcula `limited'. Con el lock tomado */
+static void
+update_limited(void) {
+    bool any = false;
+    for(int i = 0; i < RATELIMIT_LEVELS; i++) {
+        any = any || rates[i] != 0;
+    }
+    for(size_t i = 0; i < users_n; i++) {
+        any = any || (users[i].custom && users[i].rate != 0);
+    }
+    atomic_store(&limited, any);
+}
+
+bool
+ratelimit_set(enum ratelimit_level level, const char *user, uint64_t rate) {
+    bool ret = true;
+    if(rate > RATELIMIT_MAX_RATE) {
+        rate = RATELIMIT_MAX_RATE;
+    }
+
+    pthread_mutex_lock(&lock);
+    if(level == RATELIMIT_USER && user != NULL) {
+        struct ratelimit_user *u = user_find(user, true);
+        if(u == NULL) {
+            ret = false;
+            goto finally;
+        }
+        u->custom = true;
+        u->rate   = rate;
+    } else {
+        rates[level] = rate;
+    }
+    update_limited();
+finally:
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+uint64_t
+ratelimit_get(enum ratelimit_level level, const char *user) {
+    pthread_mutex_lock(&lock);
+    uint64_t rate = rates[level];
+    if(level == RATELIMIT_USER && user != NULL) {
+        const struct ratelimit_user *u = user_find(user, false);
+        if(u != NULL) {
+            rate = user_rate(u);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return rate;
+}
+
+size_t
+ratelimit_users(const char **names, uint64_t *out, size_t max) {
+    size_t n = 0;
+    pthread_mutex_lock(&lock);
+    for(size_t i = 0; i < users_n && n < max; i++) {
+        if(users[i].custom) {
+            names[n] = users[i].name;
+            out[n]   = users[i].rate;
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+bool
+ratelimit_attach(struct ratelimit *rl, const char *user) {
+    memset(&rl->conn, 0, sizeof(rl->conn));
+    pthread_mutex_lock(&lock);
+    rl->user = user_find(user, true);
+    if(rl->user != NULL) {
+        rl->user->refs++;
+    }
+    pthread_mutex_unlock(&lock);
+    return rl->user != NULL;
+}
+
+void
+ratelimit_detach(struct ratelimit *rl) {
+    if(rl->user == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    rl->user->refs--;
+    pthread_mutex_unlock(&lock);
+    rl->user = NULL;
+}
+
+size_t
+ratelimit_allow(struct ratelimit *rl, size_t want, unsigned long *wait_ms,
+                enum ratelimit_level *level) {
+    if(!atomic_load_explicit(&limited, memory_order_relaxed)) {
+        return want;
+    }
+
+    const uint64_t now = now_us();
+    uint64_t            rate[RATELIMIT_LEVELS];
+    struct token_bucket b[RATELIMIT_LEVELS];
+
+    pthread_mutex_lock(&lock);
+    rate[RATELIMIT_GLOBAL] = rates[RATELIMIT_GLOBAL];
+    if(rate[RATELIMIT_GLOBAL] != 0) {
+        bucket_refill(&global, rate[RATELIMIT_GLOBAL], now);
+    }
+    b[RATELIMIT_GLOBAL] = global;
+
+    rate[RATELIMIT_USER] = rl->user == NULL ? 0 : user_rate(rl->user);
+    if(rate[RATELIMIT_USER] != 0) {
+        bucket_refill(&rl->user->bucket, rate[RATELIMIT_USER], now);
+        b[RATELIMIT_USER] = rl->user->bucket;
+    }
+    rate[RATELIMIT_CONN] = rates[RATELIMIT_CONN];
+    pthread_mutex_unlock(&lock);
+
+    if(rate[RATELIMIT_CONN] != 0) {
+        bucket_refill(&rl->conn, rate[RATELIMIT_CONN], now);
+        b[RATELIMIT_CONN] = rl->conn;
+    }
+
+    size_t        allow = want;
+    unsigned long wait  = 0;
+    for(int i = 0; i < RATELIMIT_LEVELS; i++) {
+        if(rate[i] == 0) {
+            continue;
+        }
+        if(b[i].tokens <= 0) {
+            const unsigned long w = bucket_wait_ms(b + i, rate[i]);
+            if(allow != 0 || w > wait) {
+                wait   = w;
+                *level = (enum ratelimit_level)i;
+            }
+            allow = 0;
+        } else if(allow > (uint64_t)b[i].tokens) {
+            allow = (size_t)b[i].tokens;
+        }
+    }
+    if(allow == 0) {
+        *wait_ms = wait == 0 ? 1 : wait;
+    }
+    return allow;
+}
+
+void
+ratelimit_charge(struct ratelimit *rl, size_t n) {
+    if(n == 0 || !atomic_load_explicit(&limited, memory_order_relaxed)) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    if(rates[RATELIMIT_GLOBAL] != 0) {
+        global.tokens -= (int64_t)n;
+    }
+    if(rl->user != NULL && user_rate(rl->user) != 0) {
+        rl->user->bucket.tokens -= (int64_t)n;
+    }
+    const bool conn = rates[RATELIMIT_CONN] != 0;
+    pthread_mutex_unlock(&lock);
+
+    if(conn) {
+        rl->conn.tokens -= (int64_t)n;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef RATELIMIT_H_Qm7tZc2WvK9pLx4RnB6sJd1Hy8F
+#define RATELIMIT_H_Qm7tZc2WvK9pLx4RnB6sJd1Hy8F
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * ratelimit.c - límites de ancho de banda con token buckets
+ *
+ * Hay tres niveles: uno global, uno por usuario (todas las conexiones de un
+ * mismo usuario comparten el balde) y uno por conexión. Cada byte que entra
+ * a un túnel, en cualquier dirección, consume un token de cada nivel que
+ * tenga límite. Un balde se llena a `rate' bytes por segundo hasta
+ * RATELIMIT_BURST_MS de tráfico (como mínimo RATELIMIT_MIN_BURST).
+ *
+ * Los límites se pueden cambiar en cualquier momento (p.ej. desde el
+ * monitor) y valen también para las conexiones ya abiertas. 0: sin límite.
+ */
+enum ratelimit_level {
+    RATELIMIT_GLOBAL = 0,
+    RATELIMIT_USER,
+    RATELIMIT_CONN,
+    RATELIMIT_LEVELS,
+};
+
+#define RATELIMIT_BURST_MS   100
+#define RATELIMIT_MIN_BURST  (4 * 1024)
+/**
+ * usuarios con balde propio a la vez. Los que tienen límite propio ocupan
+ * su lugar siempre; el resto, mientras tenga alguna conexión abierta. Las
+ * conexiones de un usuario que no entra no tienen límite por usuario.
+ */
+#define RATELIMIT_MAX_USERS  64
+
+struct ratelimit_user;
+
+/** balde de un nivel. Los compartidos se protegen dentro de ratelimit.c */
+struct token_bucket {
+    int64_t  tokens;
+    uint64_t last_us;
+};
+
+/** estado de una conexión: su balde y el de su usuario */
+struct ratelimit {
+    struct token_bucket    conn;
+    struct ratelimit_user *user;
+};
+
+/**
+ * cambia el límite (bytes por segundo) de un nivel. Con RATELIMIT_USER,
+ * `user' elige un usuario puntual y NULL el límite de todos los demás.
+ *
+ * retorna false si no hay lugar para otro usuario.
+ */
+bool
+ratelimit_set(enum ratelimit_level level, const char *user, uint64_t rate);
+
+/** límite vigente de un nivel (idem `ratelimit_set') */
+uint64_t
+ratelimit_get(enum ratelimit_level level, const char *user);
+
+/**
+ * copia en `names'/`rates' hasta `max' usuarios con límite propio.
+ * retorna cuántos se copiaron. Los nombres viven tanto como el proceso.
+ */
+size_t
+ratelimit_users(const char **names, uint64_t *rates, size_t max);
+
+/**
+ * prepara el estado de una conexión del usuario `user'.
+ *
+ * retorna false si el usuario no tiene balde (la tabla está llena): la
+ * conexión queda sin límite por usuario.
+ */
+bool
+ratelimit_attach(struct ratelimit *rl, const char *user);
+
+/** suelta el balde de usuario de la conexión. Se puede llamar de más */
+void
+ratelimit_detach(struct ratelimit *rl);
+
+/**
+ * bytes que la conexión puede mover ahora, como mucho `want'. Si retorna 0
+ * completa `wait_ms' con el tiempo hasta que vuelva a haber tokens y `level'
+ * con el nivel que más lo demora.
+ */
+size_t
+ratelimit_allow(struct ratelimit *rl, size_t want, unsigned long *wait_ms,
+                enum ratelimit_level *level);
+
+/** descuenta `n' bytes ya movidos de todos los niveles */
+void
+ratelimit_charge(struct ratelimit *rl, size_t n);
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * ring.c - buffer circular para I/O vectorizada
+ */
+#include <assert.h>
+
+#include "ring.h"
+
+void
+ring_init(struct ring *r, size_t n, uint8_t *data) {
+    r->data = data;
+    r->size = n;
+    ring_reset(r);
+}
+
+void
+ring_reset(struct ring *r) {
+    r->read = 0;
+    r->len  = 0;
+    r->held = 0;
+}
+
+bool
+ring_can_read(const struct ring *r) {
+    return r->len > 0;
+}
+
+bool
+ring_can_write(const struct ring *r) {
+    return r->len + r->held < r->size;
+}
+
+size_t
+ring_len(const struct ring *r) {
+    return r->len;
+}
+
+int
+ring_read_iov(const struct ring *r, struct iovec iov[2]) {
+    if(r->len == 0) {
+        return 0;
+    }
+    const size_t first = r->size - r->read < r->len ? r->size - r->read : r->len;
+    iov[0].iov_base = r->data + r->read;
+    iov[0].iov_len  = first;
+    if(first == r->len) {
+        return 1;
+    }
+    iov[1].iov_base = r->data;
+    iov[1].iov_len  = r->len - first;
+    return 2;
+}
+
+void
+ring_read_adv(struct ring *r, size_t n) {
+    assert(n <= r->len);
+    r->len -= n;
+    if(r->len == 0 && r->held == 0) {
+        // vacío: el próximo readv arranca con un solo tramo
+        r->read = 0;
+    } else {
+        r->read = (r->read + n) % r->size;
+    }
+}
+
+void
+ring_hold_adv(struct ring *r, size_t n) {
+    assert(n <= r->len);
+    r->len  -= n;
+    r->held += n;
+    r->read  = (r->read + n) % r->size;
+}
+
+void
+ring_release(struct ring *r, size_t n) {
+    assert(n <= r->held);
+    r->held -= n;
+    if(r->len == 0 && r->held == 0) {
+        r->read = 0;
+    }
+}
+
+size_t
+ring_held(const struct ring *r) {
+    return r->held;
+}
+
+int
+ring_write_iov(const struct ring *r, struct iovec iov[2]) {
+    const size_t space = r->size - r->len - r->held;
+    if(space == 0) {
+        return 0;
+    }
+    const size_t w     = (r->read + r->len) % r->size;
+    const size_t first = r->size - w < space ? r->size - w : space;
+    iov[0].iov_base = r->data + w;
+    iov[0].iov_len  = first;
+    if(first == space) {
+        return 1;
+    }
+    iov[1].iov_base = r->data;
+    iov[1].iov_len  = space - first;
+    return 2;
+}
+
+void
+ring_write_adv(struct ring *r, size_t n) {
+    assert(n <= r->size - r->len - r->held);
+    r->len += n;
+}
+
+size_t
+ring_iov_len(const struct iovec *iov, int n) {
+    size_t total = 0;
+    for(int i = 0; i < n; i++) {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+int
+ring_iov_trim(struct iovec *iov, int n, size_t max) {
+    for(int i = 0; i < n; i++) {
+        if(iov[i].iov_len >= max) {
+            iov[i].iov_len = max;
+            return i + 1;
+        }
+        max -= iov[i].iov_len;
+    }
+    return n;
+}
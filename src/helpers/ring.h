@@ -0,0 +1,107 @@
+#ifndef RING_H_Xw4pN7cQe2LmTz9RbKs6VhJy3Fd
+#define RING_H_Xw4pN7cQe2LmTz9RbKs6VhJy3Fd
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>   // struct iovec
+
+/**
+ * ring.c - buffer circular para I/O vectorizada
+ *
+ * A diferencia de `buffer', el espacio libre no depende de que se compacte:
+ * cuando los datos llegan al final del arreglo siguen desde el principio.
+ * Tanto los datos pendientes como el espacio libre pueden quedar partidos en
+ * dos tramos, así que se exponen como hasta dos `struct iovec' listos para
+ * readv(2)/writev(2). Nunca se mueven bytes dentro del buffer.
+ *
+ *        R=4         W=2 (dio la vuelta)
+ * +---+---+---+---+---+---+
+ * | C | D |   |   | A | B |      lectura: [4, 6) y [0, 2)
+ * +---+---+---+---+---+---+      escritura: [2, 4)
+ *
+ * Cuando se vacía, la lectura vuelve al inicio para que el próximo readv use
+ * un solo tramo.
+ *
+ * Los bytes ya leídos se pueden retener (`ring_hold_adv'): dejan de estar
+ * pendientes pero siguen ocupando lugar hasta `ring_release'. Sirve cuando
+ * el kernel sigue usando la memoria después de enviarla (MSG_ZEROCOPY).
+ */
+struct ring {
+    uint8_t *data;
+    /** capacidad. inmutable */
+    size_t   size;
+    /** posición del primer byte sin leer */
+    size_t   read;
+    /** bytes guardados */
+    size_t   len;
+    /** bytes retenidos, inmediatamente antes de `read' */
+    size_t   held;
+};
+
+/** inicializa el ring sobre `data' (de `n' bytes) sin utilizar el heap */
+void
+ring_init(struct ring *r, size_t n, uint8_t *data);
+
+/** descarta el contenido */
+void
+ring_reset(struct ring *r);
+
+/** retorna true si hay bytes para leer */
+bool
+ring_can_read(const struct ring *r);
+
+/** retorna true si hay lugar para escribir */
+bool
+ring_can_write(const struct ring *r);
+
+/** bytes guardados */
+size_t
+ring_len(const struct ring *r);
+
+/**
+ * completa `iov' con los tramos que se pueden leer (enviar).
+ * retorna la cantidad de tramos: 0, 1 o 2.
+ * Se debe notificar lo consumido mediante `ring_read_adv'.
+ */
+int
+ring_read_iov(const struct ring *r, struct iovec iov[2]);
+
+void
+ring_read_adv(struct ring *r, size_t n);
+
+/** como `ring_read_adv', pero el lugar no se libera hasta `ring_release' */
+void
+ring_hold_adv(struct ring *r, size_t n);
+
+/** libera los `n' bytes retenidos más antiguos */
+void
+ring_release(struct ring *r, size_t n);
+
+/** bytes retenidos */
+size_t
+ring_held(const struct ring *r);
+
+/**
+ * completa `iov' con los tramos libres donde se puede escribir (recibir).
+ * retorna la cantidad de tramos: 0, 1 o 2.
+ * Se debe notificar lo escrito mediante `ring_write_adv'.
+ */
+int
+ring_write_iov(const struct ring *r, struct iovec iov[2]);
+
+void
+ring_write_adv(struct ring *r, size_t n);
+
+/** suma de las longitudes de los primeros `n' tramos de `iov' */
+size_t
+ring_iov_len(const struct iovec *iov, int n);
+
+/**
+ * acorta los `n' tramos de `iov' para que sumen como mucho `max' bytes.
+ * retorna la cantidad de tramos que quedan.
+ */
+int
+ring_iov_trim(struct iovec *iov, int n, size_t max);
+
+#endif
@@ -6,7 +6,6 @@
 #include <string.h> // memset
 #include <assert.h> // :)
 #include <errno.h>  // :)
-#include <pthread.h>
 
 #include <stdint.h> // SIZE_MAX
 #include <unistd.h>
@@ -14,8 +13,14 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
 #include "selector.h"
+#include "uring.h"
+#include "pool.h"
 
 #define N(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -47,57 +52,52 @@ selector_error(const selector_status status) {
     return msg;
 }
 
-
-static void
-wake_handler(const int signal) {
-    (void)signal; // Suprimir warning de parámetro no usado
-    // nada que hacer. está solo para interrumpir el select
+const char *
+selector_backend_name(const selector_backend backend) {
+    const char *msg;
+    switch(backend) {
+        case SELECTOR_BACKEND_EPOLL:
+            msg = "epoll";
+            break;
+        case SELECTOR_BACKEND_PSELECT:
+            msg = "pselect";
+            break;
+        case SELECTOR_BACKEND_IO_URING:
+            msg = "io_uring";
+            break;
+        default:
+            msg = "auto";
+    }
+    return msg;
 }
 
-// señal a usar para las notificaciones de resolución
 struct selector_init conf;
-static sigset_t emptyset, blockset;
+
+/** trabajo de selector_notify_block() */
+struct blocking_job {
+    struct selector_completion completion;
+    fd_selector s;
+};
+
+/** trabajos de selector_notify_block(), compartidos por todos los selectores */
+static struct pool *blocking_jobs;
 
 selector_status
 selector_init(const struct selector_init  *c) {
     memcpy(&conf, c, sizeof(conf));
 
-    // inicializamos el sistema de comunicación entre threads y el selector
-    // principal. La técnica se encuentra descripta en
-    // "The new pselect() system call" <https://lwn.net/Articles/176911/>
-    //  March 24, 2006
-    selector_status   ret = SELECTOR_SUCCESS;
-    struct sigaction act = {
-        .sa_handler = wake_handler,
-    };
-
-    // 0. calculamos mascara para evitar que se interrumpa antes de llegar al
-    //    select
-    sigemptyset(&blockset);
-    sigaddset  (&blockset, conf.signal);
-    if(-1 == sigprocmask(SIG_BLOCK, &blockset, NULL)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-
-    // 1. Registramos una función que atenderá la señal de interrupción
-    //    del selector.
-    //    Esta interrupción es útil en entornos multi-hilos.
-
-    if (sigaction(conf.signal, &act, 0)) {
-        ret = SELECTOR_IO;
-        goto finally;
-    }
-    sigemptyset(&emptyset);
-
-finally:
-    return ret;
+    // los threads auxiliares despiertan al selector con un eventfd propio de
+    // cada instancia (ver selector_notify_completion), así que no hace falta
+    // reservar una señal.
+    blocking_jobs = pool_new("selector_job", sizeof(struct blocking_job),
+                             conf.job_prealloc);
+    return blocking_jobs == NULL ? SELECTOR_ENOMEM : SELECTOR_SUCCESS;
 }
 
 selector_status
 selector_close(void) {
-    // Nada para liberar.
-    // TODO(juan): podriamos reestablecer el handler de la señal.
+    pool_destroy(blocking_jobs);
+    blocking_jobs = NULL;
     return SELECTOR_SUCCESS;
 }
 
@@ -107,20 +107,25 @@ struct item {
    fd_interest         interest;
    const fd_handler   *handler;
    void *              data;
-};
-
-/* tarea bloqueante */
-struct blocking_job {
-    /** selector dueño de la resolucion */
-    fd_selector  s;
-    /** file descriptor dueño de la resolucion */
-    int fd;
-
-    /** datos del trabajo provisto por el usuario */
-    void *data;
-
-    /** el siguiente en la lista */
-    struct blocking_job *next;
+   /**
+    * se incrementa en cada registración. Permite descartar eventos de epoll
+    * que quedaron pendientes para un fd que se cerró y se volvió a usar
+    * durante la misma iteración.
+    */
+   uint32_t            generation;
+   /** interés actualmente cargado en el epoll (OP_NOOP: fuera del set) */
+   fd_interest         epoll_interest;
+
+   /** interés del poll armado en el io_uring (OP_NOOP: no hay poll) */
+   fd_interest         uring_interest;
+   /** identifica el poll armado; descarta completitudes de polls viejos */
+   uint32_t            uring_seq;
+   /** el item está en la lista de cambios pendientes de enviar */
+   bool                dirty;
+   /** hay que volver a pedir la notificación aunque el interés no cambie */
+   bool                rearm;
+   /** pedidos de cambio de interés desde el último envío al kernel */
+   uint32_t            changes;
 };
 
 /** marca para usar en item->fd para saber que no está en uso */
@@ -129,6 +134,14 @@ static const int FD_UNUSED = -1;
 /** verifica si el item está usado */
 #define ITEM_USED(i) ( ( FD_UNUSED != (i)->fd) )
 
+/** timers: niveles de la rueda, y casilleros por nivel (2^WHEEL_BITS) */
+#define WHEEL_LEVELS            4
+#define WHEEL_BITS              6
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+#define WHEEL_MASK              (WHEEL_SLOTS - 1)
+/** ticks (ms) que cubre la rueda completa */
+#define WHEEL_RANGE             ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
 struct fdselector {
     // almacenamos en una jump table donde la entrada es el file descriptor.
     // Asumimos que el espacio de file descriptors no va a ser esparso; pero
@@ -139,6 +152,38 @@ struct fdselector {
     /** fd maximo para usar en select() */
     int max_fd;  // max(.fds[].fd)
 
+    /** implementación del multiplexor en uso */
+    selector_backend backend;
+    /** cantidad máxima de descriptores soportados por el backend */
+    size_t          max_items;
+    /** notificación por flanco en lugar de por nivel */
+    bool            edge_triggered;
+
+    /** descriptor de epoll(7). -1 si se usa pselect(2) */
+    int             epoll_fd;
+    /** eventos retornados por epoll_pwait() */
+    struct epoll_event *events;
+
+    /** ring de io_uring. NULL si no se usa ese backend */
+    struct uring       *ring;
+    /** completitudes retiradas del ring en la iteración */
+    struct uring_completion *completions;
+    /**
+     * fds cuyo interés cambió durante la iteración. Se envían al kernel una
+     * única vez antes de la próxima espera (ver items_flush_changes).
+     */
+    int                *dirty;
+    size_t              dirty_n;
+    size_t              dirty_cap;
+    /** contadores expuestos con selector_get_stats */
+    struct selector_stats stats;
+    /** máscara de señales durante la espera (ver selector_new) */
+    sigset_t        wait_sigmask;
+    /** instrumentación del loop. NULL si está apagada */
+    struct selector_loop_stats *loop;
+    /** llamadas a selector_select (ver selector_iteration) */
+    uint64_t        iteration;
+
     /** descriptores prototipicos ser usados en select */
     fd_set master_r, master_w;
     /** para ser usado en el select() (recordar que select cambia el valor) */
@@ -149,28 +194,58 @@ struct fdselector {
     /** tambien select() puede cambiar el valor */
     struct timespec slave_t;
 
-    // notificaciónes entre blocking jobs y el selector
-    volatile pthread_t      selector_thread;
-    /** protege el acceso a resolutions jobs */
-    pthread_mutex_t         resolution_mutex;
     /**
-     * lista de trabajos blockeantes que finalizaron y que pueden ser
-     * notificados.
+     * rueda de timers: nivel `l' casillero `i' es la lista de timers que
+     * vencen en el bloque de 64^l ticks cuyo número módulo 64 es `i'
+     */
+    struct selector_timer  *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    /** último tick (ms de CLOCK_MONOTONIC) procesado por la rueda */
+    uint64_t                wheel_now;
+    /** cantidad de timers armados */
+    size_t                  timers_armed;
+
+    // notificaciones entre threads auxiliares y el selector
+    /** eventfd(2) registrado en el propio selector para despertarlo */
+    int                     wake_fd;
+    /**
+     * pila (lock-free) de trabajos terminados que todavía no se despacharon.
+     * Los productores hacen push con CAS; el selector la vacía de un swap.
+     */
+    _Atomic(struct selector_completion *) completions_head;
+    /**
+     * hay una escritura al eventfd que el selector todavía no atendió.
+     * Permite agrupar muchas notificaciones en un único despertar.
      */
-    struct blocking_job    *resolution_jobs;
+    atomic_bool             wakeup_pending;
 };
 
-/** cantidad máxima de file descriptors que la plataforma puede manejar */
+/** cantidad máxima de file descriptors que select(2) puede manejar */
 #define ITEMS_MAX_SIZE      FD_SETSIZE
 
-// en esta implementación el máximo está dado por el límite natural de select(2).
+/**
+ * con epoll(7) no hay un límite natural más allá de RLIMIT_NOFILE; acotamos
+ * la jump table para no crecer sin control ante un fd espurio.
+ */
+#define EPOLL_ITEMS_MAX_SIZE    (1 << 20)
+
+/** cantidad de eventos que se retiran del kernel por iteración */
+#define EPOLL_MAX_EVENTS        256
+
+/** tamaño del submission queue de io_uring */
+#define URING_ENTRIES           4096
+
+/** user_data de operaciones cuya completitud no nos interesa */
+#define URING_IGNORE            UINT64_MAX
+
+/** user_data del poll armado para un item */
+#define URING_DATA(item)  (((uint64_t)(item)->uring_seq << 32) | (uint32_t)(item)->fd)
 
 /**
  * determina el tamaño a crecer, generando algo de slack para no tener
  * que realocar constantemente.
  */
 static
-size_t next_capacity(const size_t n) {
+size_t next_capacity(const size_t n, const size_t max) {
     unsigned bits = 0;
     size_t tmp = n;
     while(tmp != 0) {
@@ -180,8 +255,8 @@ size_t next_capacity(const size_t n) {
     tmp = 1UL << bits;
 
     assert(tmp >= n);
-    if(tmp > ITEMS_MAX_SIZE) {
-        tmp = ITEMS_MAX_SIZE;
+    if(tmp > max) {
+        tmp = max;
     }
 
     return tmp + 1;
@@ -221,8 +296,130 @@ items_max_fd(fd_selector s) {
     return max;
 }
 
+static uint32_t
+epoll_events_for(const fd_interest interest) {
+    uint32_t events = 0;
+    if(interest & OP_READ) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if(interest & OP_WRITE) {
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+/**
+ * sincroniza el interés del item con el set de epoll.
+ *
+ * Un fd sin interés se quita del set: epoll reporta EPOLLHUP/EPOLLERR aunque
+ * no se los pida, y un fd colgado sin interés nos haría girar en vacío
+ * (pselect(2) simplemente no lo miraba).
+ */
+static selector_status
+items_update_epoll_for_fd(fd_selector s, struct item * item) {
+    const fd_interest want = ITEM_USED(item) ? item->interest : OP_NOOP;
+    if(want == item->epoll_interest && !(item->rearm && want != OP_NOOP)) {
+        return SELECTOR_SUCCESS;
+    }
+    // OP_ERROR no tiene bit propio (epoll siempre reporta EPOLLERR): si solo
+    // cambió ese interés no hay nada que enviar al kernel
+    if(want != OP_NOOP && item->epoll_interest != OP_NOOP && !item->rearm
+       && epoll_events_for(want) == epoll_events_for(item->epoll_interest)) {
+        item->epoll_interest = want;
+        return SELECTOR_SUCCESS;
+    }
+
+    struct epoll_event ev = {
+        .events   = epoll_events_for(want) | (s->edge_triggered ? EPOLLET : 0),
+        .data.u64 = ((uint64_t)item->generation << 32) | (uint32_t)item->fd,
+    };
+    int op;
+    if(want == OP_NOOP) {
+        op = EPOLL_CTL_DEL;
+    } else if(item->epoll_interest == OP_NOOP) {
+        op = EPOLL_CTL_ADD;
+    } else {
+        op = EPOLL_CTL_MOD;
+    }
+
+    if(-1 == epoll_ctl(s->epoll_fd, op, item->fd, &ev)) {
+        // si el fd ya se cerró el kernel lo sacó del set por nosotros
+        if(!(op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT))) {
+            return SELECTOR_IO;
+        }
+    }
+    item->epoll_interest = want;
+    return SELECTOR_SUCCESS;
+}
+
+/** encola el item para que su interés se envíe antes de la próxima espera */
+static selector_status
+items_mark_dirty(fd_selector s, struct item *item) {
+    if(item->dirty) {
+        return SELECTOR_SUCCESS;
+    }
+    if(s->dirty_n == s->dirty_cap) {
+        const size_t cap = s->dirty_cap == 0 ? 64 : s->dirty_cap * 2;
+        int *tmp = realloc(s->dirty, cap * sizeof(*tmp));
+        if(tmp == NULL) {
+            return SELECTOR_ENOMEM;
+        }
+        s->dirty     = tmp;
+        s->dirty_cap = cap;
+    }
+    item->dirty = true;
+    s->dirty[s->dirty_n++] = item->fd;
+    return SELECTOR_SUCCESS;
+}
+
+/** encola la cancelación del poll armado para el item (si lo hay) */
+static void
+uring_disarm(fd_selector s, struct item *item) {
+    if(item->uring_interest != OP_NOOP) {
+        uring_poll_remove(s->ring, URING_DATA(item), URING_IGNORE);
+        item->uring_interest = OP_NOOP;
+    }
+}
+
+/**
+ * deja armado en el ring un poll acorde al interés del item.
+ *
+ * En modo level-triggered los polls son de un solo disparo: tras cada
+ * completitud el item vuelve a la lista de cambios y se rearma en el mismo
+ * io_uring_enter(2) que espera la siguiente iteración. El rearmado evalúa el
+ * estado actual del fd, así que se conserva la semántica de los otros
+ * backends.
+ *
+ * En modo edge-triggered se usan polls multishot, que generan una
+ * completitud por cada despertar del fd y no necesitan rearmarse.
+ */
+static selector_status
+uring_arm(fd_selector s, struct item *item) {
+    const fd_interest want = item->interest;
+    if(want == item->uring_interest) {
+        return SELECTOR_SUCCESS;
+    }
+    // idem epoll: el poll armado ya reporta POLLERR
+    if(want != OP_NOOP && item->uring_interest != OP_NOOP
+       && epoll_events_for(want) == epoll_events_for(item->uring_interest)) {
+        item->uring_interest = want;
+        return SELECTOR_SUCCESS;
+    }
+    uring_disarm(s, item);
+    if(want != OP_NOOP) {
+        item->uring_seq++;
+        if(!uring_poll_add(s->ring, item->fd, epoll_events_for(want),
+                           URING_DATA(item), s->edge_triggered)) {
+            return SELECTOR_IO;
+        }
+        item->uring_interest = want;
+    }
+    return SELECTOR_SUCCESS;
+}
+
+/** refleja el interés del item en los fd_set de pselect(2) */
 static void
-items_update_fdset_for_fd(fd_selector s, const struct item * item) {
+items_update_select_for_fd(fd_selector s, struct item * item) {
     FD_CLR(item->fd, &s->master_r);
     FD_CLR(item->fd, &s->master_w);
 
@@ -237,6 +434,96 @@ items_update_fdset_for_fd(fd_selector s, const struct item * item) {
     }
 }
 
+/**
+ * actualiza el interés del item en el backend en el momento. Lo usan la
+ * registración y la desregistración; los cambios de interés van por la lista
+ * de cambios.
+ */
+static selector_status
+items_update_fdset_for_fd(fd_selector s, struct item * item) {
+    if(s->backend == SELECTOR_BACKEND_EPOLL) {
+        return items_update_epoll_for_fd(s, item);
+    }
+    if(s->backend == SELECTOR_BACKEND_IO_URING) {
+        return items_mark_dirty(s, item);
+    }
+    items_update_select_for_fd(s, item);
+    return SELECTOR_SUCCESS;
+}
+
+/** true si el interés del item difiere de lo que tiene cargado el kernel */
+static bool
+items_interest_pending(fd_selector s, const struct item *item) {
+    const bool rearm = item->rearm && item->interest != OP_NOOP;
+    switch(s->backend) {
+        case SELECTOR_BACKEND_EPOLL:
+            return rearm || item->interest != item->epoll_interest;
+        case SELECTOR_BACKEND_IO_URING:
+            return rearm || item->interest != item->uring_interest;
+        default: {
+            fd_interest loaded = OP_NOOP;
+            if(FD_ISSET(item->fd, &s->master_r)) {
+                loaded |= OP_READ;
+            }
+            if(FD_ISSET(item->fd, &s->master_w)) {
+                loaded |= OP_WRITE;
+            }
+            return loaded != (item->interest & (OP_READ | OP_WRITE));
+        }
+    }
+}
+
+/**
+ * aplica los cambios de interés acumulados durante la iteración. Se llama una
+ * vez antes de cada espera: varios cambios sobre el mismo fd (o uno que deja
+ * el interés como estaba) terminan en a lo sumo una actualización.
+ */
+static void
+items_flush_changes(fd_selector s) {
+    for(size_t i = 0; i < s->dirty_n; i++) {
+        struct item *item = s->fds + s->dirty[i];
+        if(!item->dirty) {
+            // se desregistró mientras estaba en la lista
+            continue;
+        }
+        item->dirty = false;
+        if(!ITEM_USED(item)) {
+            continue;
+        }
+
+        const bool pending = items_interest_pending(s, item);
+        if(pending) {
+            selector_status st = SELECTOR_SUCCESS;
+            switch(s->backend) {
+                case SELECTOR_BACKEND_EPOLL:
+                    st = items_update_epoll_for_fd(s, item);
+                    break;
+                case SELECTOR_BACKEND_IO_URING:
+                    if(item->rearm) {
+                        // un poll nuevo arranca mirando el estado actual
+                        uring_disarm(s, item);
+                    }
+                    st = uring_arm(s, item);
+                    break;
+                default:
+                    items_update_select_for_fd(s, item);
+                    break;
+            }
+            if(SELECTOR_SUCCESS != st) {
+                fprintf(stderr, "selector: no se pudo actualizar el interés "
+                                "de fd %d\n", item->fd);
+            }
+            s->stats.interest_applied++;
+        }
+        if(item->changes > 0) {
+            s->stats.interest_collapsed += item->changes - (pending ? 1 : 0);
+        }
+        item->changes = 0;
+        item->rearm   = false;
+    }
+    s->dirty_n = 0;
+}
+
 /**
  * garantizar cierta cantidad de elemenos en `fds'.
  * Se asegura de que `n' sea un número que la plataforma donde corremos lo
@@ -250,12 +537,12 @@ ensure_capacity(fd_selector s, const size_t n) {
     if(n < s->fd_size) {
         // nada para hacer, entra...
         ret = SELECTOR_SUCCESS;
-    } else if(n > ITEMS_MAX_SIZE) {
+    } else if(n > s->max_items) {
         // me estás pidiendo más de lo que se puede.
         ret = SELECTOR_MAXFD;
     } else if(NULL == s->fds) {
         // primera vez.. alocamos
-        const size_t new_size = next_capacity(n);
+        const size_t new_size = next_capacity(n, s->max_items);
 
         s->fds = calloc(new_size, element_size);
         if(NULL == s->fds) {
@@ -266,7 +553,7 @@ ensure_capacity(fd_selector s, const size_t n) {
         }
     } else {
         // hay que agrandar...
-        const size_t new_size = next_capacity(n);
+        const size_t new_size = next_capacity(n, s->max_items);
         if (new_size > SIZE_MAX/element_size) { // ver MEM07-C
             ret = SELECTOR_ENOMEM;
         } else {
@@ -286,6 +573,38 @@ ensure_capacity(fd_selector s, const size_t n) {
     return ret;
 }
 
+/** vacía el eventfd. Las notificaciones se despachan al final de la iteración */
+static void
+wake_read(struct selector_key *key) {
+    uint64_t n;
+    // una lectura devuelve (y pone en cero) el contador completo
+    if(read(key->fd, &n, sizeof(n)) == -1 && errno != EAGAIN) {
+        perror("selector: read eventfd");
+    }
+    // a partir de acá un productor nuevo tiene que volver a escribir; lo que
+    // ya estaba en la pila lo retira handle_completions()
+    atomic_store(&key->s->wakeup_pending, false);
+}
+
+static const struct fd_handler wake_fd_handler = {
+    .name         = "wakeup",
+    .handle_read  = wake_read,
+    .handle_write = NULL,
+    .handle_block = NULL,
+    .handle_close = NULL,
+};
+
+static void
+handle_completions(fd_selector s);
+
+/** reloj de los timers: milisegundos de CLOCK_MONOTONIC */
+static uint64_t
+timers_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
 fd_selector
 selector_new(const size_t initial_elements) {
     size_t size = sizeof(struct fdselector);
@@ -295,9 +614,76 @@ selector_new(const size_t initial_elements) {
         ret->master_t.tv_sec  = conf.select_timeout.tv_sec;
         ret->master_t.tv_nsec = conf.select_timeout.tv_nsec;
         assert(ret->max_fd == 0);
-        ret->resolution_jobs  = 0;
-        pthread_mutex_init(&ret->resolution_mutex, 0);
-        if(0 != ensure_capacity(ret, initial_elements)) {
+        atomic_init(&ret->completions_head, NULL);
+        atomic_init(&ret->wakeup_pending, false);
+        ret->wake_fd   = -1;
+        ret->wheel_now = timers_clock();
+        // la espera deja pasar las mismas señales que el thread que crea el
+        // selector: así un reactor auxiliar puede dejar SIGINT/SIGTERM al
+        // thread principal
+        pthread_sigmask(SIG_BLOCK, NULL, &ret->wait_sigmask);
+
+        ret->backend   = SELECTOR_BACKEND_PSELECT;
+        ret->max_items = ITEMS_MAX_SIZE;
+        ret->epoll_fd  = -1;
+        if(conf.backend == SELECTOR_BACKEND_IO_URING) {
+            ret->ring        = uring_new(URING_ENTRIES);
+            ret->completions = calloc(EPOLL_MAX_EVENTS, sizeof(*ret->completions));
+            if(ret->ring != NULL && ret->completions != NULL) {
+                ret->backend   = SELECTOR_BACKEND_IO_URING;
+                ret->edge_triggered = conf.edge_triggered;
+                ret->max_items = EPOLL_ITEMS_MAX_SIZE;
+            } else {
+                // el kernel no lo soporta (o seccomp lo bloquea): epoll
+                uring_destroy(ret->ring);
+                ret->ring = NULL;
+                free(ret->completions);
+                ret->completions = NULL;
+            }
+        }
+        if(ret->backend == SELECTOR_BACKEND_PSELECT
+           && conf.backend != SELECTOR_BACKEND_PSELECT) {
+            ret->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            ret->events   = calloc(EPOLL_MAX_EVENTS, sizeof(*ret->events));
+            if(ret->epoll_fd != -1 && ret->events != NULL) {
+                ret->backend   = SELECTOR_BACKEND_EPOLL;
+                ret->edge_triggered = conf.edge_triggered;
+                ret->max_items = EPOLL_ITEMS_MAX_SIZE;
+            } else if(conf.backend == SELECTOR_BACKEND_EPOLL) {
+                selector_destroy(ret);
+                return NULL;
+            } else {
+                // AUTO: seguimos con pselect(2)
+                if(ret->epoll_fd != -1) {
+                    close(ret->epoll_fd);
+                    ret->epoll_fd = -1;
+                }
+                free(ret->events);
+                ret->events = NULL;
+            }
+        }
+
+        size_t initial = initial_elements;
+        if(initial > ret->max_items) {
+            initial = ret->max_items;
+        }
+        if(0 != ensure_capacity(ret, initial)) {
+            selector_destroy(ret);
+            return NULL;
+        }
+        if(conf.loop_stats) {
+            ret->loop = calloc(1, sizeof(*ret->loop));
+            if(ret->loop == NULL) {
+                selector_destroy(ret);
+                return NULL;
+            }
+        }
+
+        ret->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(ret->wake_fd == -1
+           || SELECTOR_SUCCESS != selector_register(ret, ret->wake_fd,
+                                                    &wake_fd_handler, OP_READ,
+                                                    NULL)) {
             selector_destroy(ret);
             ret = NULL;
         }
@@ -315,22 +701,207 @@ selector_destroy(fd_selector s) {
                     selector_unregister_fd(s, i);
                 }
             }
-            pthread_mutex_destroy(&s->resolution_mutex);
-            struct blocking_job* j = s->resolution_jobs;
-            while (j != NULL) {
-                struct blocking_job* aux = j;
-                j = j->next;
-                free(aux);
-            }
+            // lo que quedó pendiente se entrega con todos los fds ya
+            // desregistrados para que sus dueños lo liberen
+            handle_completions(s);
             free(s->fds);
             s->fds     = NULL;
             s->fd_size = 0;
         }
+        if(s->wake_fd != -1) {
+            close(s->wake_fd);
+        }
+        if(s->epoll_fd != -1) {
+            close(s->epoll_fd);
+        }
+        free(s->events);
+        uring_destroy(s->ring);
+        free(s->completions);
+        free(s->dirty);
+        free(s->loop);
         free(s);
     }
 }
 
-#define INVALID_FD(fd)  ((fd) < 0 || (fd) >= ITEMS_MAX_SIZE)
+selector_backend
+selector_get_backend(fd_selector s) {
+    return s->backend;
+}
+
+bool
+selector_is_edge_triggered(fd_selector s) {
+    return s->edge_triggered;
+}
+
+uint64_t
+selector_iteration(fd_selector s) {
+    return s->iteration;
+}
+
+void
+selector_get_stats(fd_selector s, struct selector_stats *stats) {
+    stats->interest_changes   = __atomic_load_n(&s->stats.interest_changes,
+                                                __ATOMIC_RELAXED);
+    stats->interest_applied   = __atomic_load_n(&s->stats.interest_applied,
+                                                __ATOMIC_RELAXED);
+    stats->interest_collapsed = __atomic_load_n(&s->stats.interest_collapsed,
+                                                __ATOMIC_RELAXED);
+}
+
+void
+selector_reset_stats(fd_selector s) {
+    memset(&s->stats, 0, sizeof(s->stats));
+    if(s->loop != NULL) {
+        // los nombres quedan: otro thread puede estar leyéndolos
+        struct selector_loop_stats *l = s->loop;
+        l->iterations = 0;
+        memset(&l->wait_us,     0, sizeof(l->wait_us));
+        memset(&l->dispatch_us, 0, sizeof(l->dispatch_us));
+        memset(&l->ready,       0, sizeof(l->ready));
+        for(unsigned i = 0; i < l->handlers_n; i++) {
+            memset(&l->handlers[i].time_us, 0, sizeof(l->handlers[i].time_us));
+        }
+    }
+}
+
+/** reloj de la instrumentación, en microsegundos */
+static uint64_t
+loop_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void
+histogram_add(struct selector_histogram *h, const uint64_t v) {
+    unsigned b = v == 0 ? 0 : 64 - (unsigned)__builtin_clzll(v);
+    if(b >= SELECTOR_HIST_BUCKETS) {
+        b = SELECTOR_HIST_BUCKETS - 1;
+    }
+    h->count++;
+    h->sum += v;
+    if(v > h->max) {
+        h->max = v;
+    }
+    h->buckets[b]++;
+}
+
+static void
+histogram_load(struct selector_histogram *dst,
+               const struct selector_histogram *src) {
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum   = __atomic_load_n(&src->sum,   __ATOMIC_RELAXED);
+    dst->max   = __atomic_load_n(&src->max,   __ATOMIC_RELAXED);
+    for(unsigned i = 0; i < SELECTOR_HIST_BUCKETS; i++) {
+        dst->buckets[i] = __atomic_load_n(src->buckets + i, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+histogram_merge(struct selector_histogram *dst,
+                const struct selector_histogram *src) {
+    dst->count += src->count;
+    dst->sum   += src->sum;
+    if(src->max > dst->max) {
+        dst->max = src->max;
+    }
+    for(unsigned i = 0; i < SELECTOR_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+/**
+ * histograma de tiempos del handler `name'. Lo agrega a la tabla si no
+ * estaba; el último lugar queda reservado para "other".
+ */
+static struct selector_histogram *
+loop_handler(struct selector_loop_stats *l, const char *name) {
+    for(unsigned i = 0; i < l->handlers_n; i++) {
+        if(l->handlers[i].name == name || 0 == strcmp(l->handlers[i].name, name)) {
+            return &l->handlers[i].time_us;
+        }
+    }
+    if(l->handlers_n + 1 >= SELECTOR_LOOP_HANDLERS && 0 != strcmp(name, "other")) {
+        return loop_handler(l, "other");
+    }
+    l->handlers[l->handlers_n].name = name;
+    // el nombre tiene que estar escrito antes de que un lector lo vea
+    __atomic_store_n(&l->handlers_n, l->handlers_n + 1, __ATOMIC_RELEASE);
+    return &l->handlers[l->handlers_n - 1].time_us;
+}
+
+/** inicio de una medición. 0 si la instrumentación está apagada */
+static inline uint64_t
+loop_begin(fd_selector s) {
+    return s->loop == NULL ? 0 : loop_clock();
+}
+
+/** cierra la medición de un handler empezada en `start' */
+static inline void
+loop_end(fd_selector s, const char *name, const uint64_t start) {
+    if(s->loop != NULL) {
+        histogram_add(loop_handler(s->loop, name == NULL ? "other" : name),
+                      loop_clock() - start);
+    }
+}
+
+/** registra la espera empezada en `start'. Retorna el inicio del despacho */
+static uint64_t
+loop_waited(fd_selector s, const uint64_t start) {
+    if(s->loop == NULL) {
+        return 0;
+    }
+    const uint64_t now = loop_clock();
+    histogram_add(&s->loop->wait_us, now - start);
+    return now;
+}
+
+/** cierra la iteración: despacho empezado en `start' con `ready' eventos */
+static void
+loop_dispatched(fd_selector s, const uint64_t start, const uint64_t ready) {
+    if(s->loop == NULL) {
+        return;
+    }
+    s->loop->iterations++;
+    histogram_add(&s->loop->dispatch_us, loop_clock() - start);
+    histogram_add(&s->loop->ready, ready);
+}
+
+bool
+selector_get_loop_stats(fd_selector s, struct selector_loop_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    const struct selector_loop_stats *l = s->loop;
+    if(l == NULL) {
+        return false;
+    }
+    stats->iterations = __atomic_load_n(&l->iterations, __ATOMIC_RELAXED);
+    histogram_load(&stats->wait_us,     &l->wait_us);
+    histogram_load(&stats->dispatch_us, &l->dispatch_us);
+    histogram_load(&stats->ready,       &l->ready);
+
+    const unsigned n = __atomic_load_n(&l->handlers_n, __ATOMIC_ACQUIRE);
+    for(unsigned i = 0; i < n; i++) {
+        stats->handlers[i].name = l->handlers[i].name;
+        histogram_load(&stats->handlers[i].time_us, &l->handlers[i].time_us);
+    }
+    stats->handlers_n = n;
+    return true;
+}
+
+void
+selector_loop_stats_merge(struct selector_loop_stats *dst,
+                          const struct selector_loop_stats *src) {
+    dst->iterations += src->iterations;
+    histogram_merge(&dst->wait_us,     &src->wait_us);
+    histogram_merge(&dst->dispatch_us, &src->dispatch_us);
+    histogram_merge(&dst->ready,       &src->ready);
+    for(unsigned i = 0; i < src->handlers_n; i++) {
+        histogram_merge(loop_handler(dst, src->handlers[i].name),
+                        &src->handlers[i].time_us);
+    }
+}
+
+#define INVALID_FD(s, fd)  ((fd) < 0 || (size_t)(fd) >= (s)->max_items)
 
 selector_status
 selector_register(fd_selector        s,
@@ -340,13 +911,13 @@ selector_register(fd_selector        s,
                      void *data) {
     selector_status ret = SELECTOR_SUCCESS;
     // 0. validación de argumentos
-    if(s == NULL || INVALID_FD(fd) || handler == NULL) {
+    if(s == NULL || INVALID_FD(s, fd) || handler == NULL) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
     // 1. tenemos espacio?
     size_t ufd = (size_t)fd;
-    if(ufd > s->fd_size) {
+    if(ufd >= s->fd_size) {
         ret = ensure_capacity(s, ufd);
         if(SELECTOR_SUCCESS != ret) {
             goto finally;
@@ -363,12 +934,19 @@ selector_register(fd_selector        s,
         item->handler  = handler;
         item->interest = interest;
         item->data     = data;
+        item->generation++;
+        item->epoll_interest = OP_NOOP;
+
+        ret = items_update_fdset_for_fd(s, item);
+        if(SELECTOR_SUCCESS != ret) {
+            item_init(item);
+            goto finally;
+        }
 
         // actualizo colaterales
         if(fd > s->max_fd) {
             s->max_fd = fd;
         }
-        items_update_fdset_for_fd(s, item);
     }
 
 finally:
@@ -380,7 +958,7 @@ selector_unregister_fd(fd_selector       s,
                        const int         fd) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    if(NULL == s || INVALID_FD(fd)) {
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -401,11 +979,26 @@ selector_unregister_fd(fd_selector       s,
     }
 
     item->interest = OP_NOOP;
-    items_update_fdset_for_fd(s, item);
+    if(s->backend == SELECTOR_BACKEND_IO_URING) {
+        // el poll retiene una referencia al archivo: hay que cancelarlo
+        // aunque el fd se cierre a continuación
+        uring_disarm(s, item);
+    } else {
+        items_update_fdset_for_fd(s, item);
+    }
+    // lo que estaba pendiente para el fd quedó anulado por la baja
+    s->stats.interest_collapsed += item->changes;
 
+    const uint32_t generation = item->generation;
+    const uint32_t uring_seq  = item->uring_seq;
     memset(item, 0x00, sizeof(*item));
     item_init(item);
-    s->max_fd = items_max_fd(s);
+    item->generation = generation;
+    item->uring_seq  = uring_seq;
+    if(s->backend == SELECTOR_BACKEND_PSELECT) {
+        // con epoll no recorremos hasta max_fd; evitamos el barrido O(max_fd)
+        s->max_fd = items_max_fd(s);
+    }
 
 finally:
     return ret;
@@ -415,7 +1008,7 @@ selector_status
 selector_set_interest(fd_selector s, int fd, fd_interest i) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    if(NULL == s || INVALID_FD(fd)) {
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
         ret = SELECTOR_IARGS;
         goto finally;
     }
@@ -425,7 +1018,9 @@ selector_set_interest(fd_selector s, int fd, fd_interest i) {
         goto finally;
     }
     item->interest = i;
-    items_update_fdset_for_fd(s, item);
+    item->changes++;
+    s->stats.interest_changes++;
+    ret = items_mark_dirty(s, item);
 finally:
     return ret;
 }
@@ -434,7 +1029,7 @@ selector_status
 selector_set_interest_key(struct selector_key *key, fd_interest i) {
     selector_status ret;
 
-    if(NULL == key || NULL == key->s || INVALID_FD(key->fd)) {
+    if(NULL == key || NULL == key->s || INVALID_FD(key->s, key->fd)) {
         ret = SELECTOR_IARGS;
     } else {
         ret = selector_set_interest(key->s, key->fd, i);
@@ -443,6 +1038,33 @@ selector_set_interest_key(struct selector_key *key, fd_interest i) {
     return ret;
 }
 
+selector_status
+selector_rearm(fd_selector s, int fd) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    if(NULL == s || INVALID_FD(s, fd) || (size_t)fd >= s->fd_size) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    struct item *item = s->fds + fd;
+    if(!ITEM_USED(item)) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+    if(!s->edge_triggered) {
+        goto finally;
+    }
+
+    // EPOLL_CTL_MOD (o un poll nuevo en io_uring) reevalúa el estado del fd
+    // y lo vuelve a reportar si ya está listo
+    item->rearm = true;
+    item->changes++;
+    s->stats.interest_changes++;
+    ret = items_mark_dirty(s, item);
+finally:
+    return ret;
+}
+
 /**
  * se encarga de manejar los resultados del select.
  * se encuentra separado para facilitar el testing
@@ -464,16 +1086,24 @@ handle_iteration(fd_selector s) {
                     if(0 == item->handler->handle_read) {
                         assert(("OP_READ arrived but no handler. bug!" == 0));
                     } else {
+                        const char *name = item->handler->name;
+                        const uint64_t start = loop_begin(s);
                         item->handler->handle_read(&key);
+                        loop_end(s, name, start);
                     }
                 }
             }
+            // el handler pudo haber registrado fds y realocado la tabla
+            item = s->fds + i;
             if(FD_ISSET(i, &s->slave_w)) {
                 if(OP_WRITE & item->interest) {
                     if(0 == item->handler->handle_write) {
                         assert(("OP_WRITE arrived but no handler. bug!" == 0));
                     } else {
+                        const char *name = item->handler->name;
+                        const uint64_t start = loop_begin(s);
                         item->handler->handle_write(&key);
+                        loop_end(s, name, start);
                     }
                 }
             }
@@ -481,54 +1111,486 @@ handle_iteration(fd_selector s) {
     }
 }
 
+/**
+ * despacha un evento de readiness (máscara estilo poll(2)) para el item que
+ * estaba registrado en `fd' con la generación `generation'.
+ */
 static void
-handle_block_notifications(fd_selector s) {
+handle_ready(fd_selector s, const int fd, const uint32_t generation,
+             const uint32_t events) {
+    // un handler anterior pudo haber desregistrado (y reusado) el fd
+    struct item *item = s->fds + fd;
+    if(!ITEM_USED(item) || item->generation != generation) {
+        return;
+    }
     struct selector_key key = {
-        .s = s,
+        .s    = s,
+        .fd   = item->fd,
+        .data = item->data,
     };
-    pthread_mutex_lock(&s->resolution_mutex);
-    struct blocking_job* j = s->resolution_jobs;
-    while (j != NULL) {
 
-        struct item* item = s->fds + j->fd;
-        if (ITEM_USED(item)) {
-            key.fd = item->fd;
+    if((events & EPOLLERR) && (OP_ERROR & item->interest)
+       && item->handler->handle_error != NULL) {
+        const char *name = item->handler->name;
+        const uint64_t start = loop_begin(s);
+        item->handler->handle_error(&key);
+        loop_end(s, name, start);
+
+        item = s->fds + fd;
+        if(!ITEM_USED(item) || item->generation != generation) {
+            return;
+        }
+    }
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        if(OP_READ & item->interest) {
+            if(0 == item->handler->handle_read) {
+                assert(("OP_READ arrived but no handler. bug!" == 0));
+            } else {
+                const char *name = item->handler->name;
+                const uint64_t start = loop_begin(s);
+                item->handler->handle_read(&key);
+                loop_end(s, name, start);
+            }
+        }
+    }
+    // el handler pudo haber registrado fds y realocado la tabla
+    item = s->fds + fd;
+    if(!ITEM_USED(item) || item->generation != generation) {
+        return;
+    }
+    if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+        if(OP_WRITE & item->interest) {
+            if(0 == item->handler->handle_write) {
+                assert(("OP_WRITE arrived but no handler. bug!" == 0));
+            } else {
+                key.data = item->data;
+                const char *name = item->handler->name;
+                const uint64_t start = loop_begin(s);
+                item->handler->handle_write(&key);
+                loop_end(s, name, start);
+            }
+        }
+    }
+}
+
+/**
+ * despacha los eventos retornados por epoll_pwait(). A diferencia de
+ * `handle_iteration' el costo es proporcional a los descriptores listos.
+ */
+static void
+handle_epoll_iteration(fd_selector s, const int n) {
+    for(int i = 0; i < n; i++) {
+        const struct epoll_event *ev = s->events + i;
+        handle_ready(s, (int)(uint32_t)ev->data.u64,
+                     (uint32_t)(ev->data.u64 >> 32), ev->events);
+    }
+}
+
+/** despacha las completitudes de poll retiradas del io_uring */
+static void
+handle_uring_iteration(fd_selector s, const unsigned n) {
+    for(unsigned i = 0; i < n; i++) {
+        const struct uring_completion *c = s->completions + i;
+        if(c->user_data == URING_IGNORE) {
+            continue;
+        }
+        const int      fd  = (int)(uint32_t)c->user_data;
+        const uint32_t seq = (uint32_t)(c->user_data >> 32);
+        if((size_t)fd >= s->fd_size) {
+            continue;
+        }
+        struct item *item = s->fds + fd;
+        if(!ITEM_USED(item) || item->uring_seq != seq
+           || item->uring_interest == OP_NOOP) {
+            // completitud de un poll que ya cancelamos o reemplazamos
+            continue;
+        }
+        if(!c->more) {
+            // el poll terminó (un solo disparo, o el kernel cortó el
+            // multishot): se rearma antes de la próxima espera
+            item->uring_interest = OP_NOOP;
+            items_mark_dirty(s, item);
+        }
+
+        const uint32_t events = c->res < 0 ? EPOLLERR : (uint32_t)c->res;
+        handle_ready(s, fd, item->generation, events);
+    }
+}
+
+/**
+ * despacha los trabajos terminados en otros threads, en orden de llegada.
+ * El callback recibe el dato registrado para el fd, o fd -1 si el fd ya no
+ * está registrado.
+ */
+static void
+handle_completions(fd_selector s) {
+    if(NULL == atomic_load_explicit(&s->completions_head,
+                                    memory_order_relaxed)) {
+        return;
+    }
+    struct selector_completion *c = atomic_exchange_explicit(
+                          &s->completions_head, NULL, memory_order_acquire);
+
+    // la pila quedó al revés
+    struct selector_completion *fifo = NULL;
+    while(c != NULL) {
+        struct selector_completion *next = c->next;
+        c->next = fifo;
+        fifo    = c;
+        c       = next;
+    }
+
+    struct selector_key key = {
+        .s = s,
+    };
+    while(fifo != NULL) {
+        c    = fifo;
+        fifo = c->next;
+
+        // el callback puede registrar fds y mover `s->fds'
+        const struct item *item = NULL;
+        if(c->fd >= 0 && (size_t)c->fd < s->fd_size) {
+            item = s->fds + c->fd;
+        }
+        if(item != NULL && ITEM_USED(item)) {
+            key.fd   = item->fd;
             key.data = item->data;
-            item->handler->handle_block(&key);
+        } else {
+            key.fd   = -1;
+            key.data = NULL;
         }
+        // el callback es dueño de `c' y puede liberarlo
+        const char *name = c->name == NULL ? "completions" : c->name;
+        const uint64_t start = loop_begin(s);
+        c->callback(&key, c);
+        loop_end(s, name, start);
+    }
+}
+
+selector_status
+selector_notify_completion(fd_selector s, struct selector_completion *c) {
+    selector_status ret = SELECTOR_SUCCESS;
 
-        struct blocking_job* aux = j;
-        j = j->next;
-        free(aux);
+    if(NULL == s || NULL == c || NULL == c->callback) {
+        ret = SELECTOR_IARGS;
+        goto finally;
     }
-    s->resolution_jobs = 0;
-    pthread_mutex_unlock(&s->resolution_mutex);
+
+    struct selector_completion *head =
+        atomic_load_explicit(&s->completions_head, memory_order_relaxed);
+    do {
+        c->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&s->completions_head,
+                        &head, c, memory_order_release, memory_order_relaxed));
+
+    // solo el primero desde que el selector atendió el último despertar
+    // escribe al eventfd; el resto viaja en el mismo despertar
+    if(!atomic_exchange(&s->wakeup_pending, true)) {
+        const uint64_t one = 1;
+        if(write(s->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            ret = SELECTOR_IO;
+        }
+    }
+finally:
+    return ret;
 }
 
+static void
+blocking_job_done(struct selector_key *key, struct selector_completion *c) {
+    struct blocking_job *job = (struct blocking_job *)c;
+    if(key->fd != -1) {
+        const struct item *item = job->s->fds + key->fd;
+        if(item->handler->handle_block != NULL) {
+            item->handler->handle_block(key);
+        }
+    }
+    pool_put(blocking_jobs, job);
+}
 
 selector_status
 selector_notify_block(fd_selector  s,
                  const int    fd) {
     selector_status ret = SELECTOR_SUCCESS;
 
-    // TODO(juan): usar un pool
-    struct blocking_job *job = malloc(sizeof(*job));
+    // quien notifica seguido debería embeber su propia selector_completion
+    struct blocking_job *job = pool_get(blocking_jobs);
     if(job == NULL) {
         ret = SELECTOR_ENOMEM;
         goto finally;
     }
-    job->s  = s;
-    job->fd = fd;
+    job->s                   = s;
+    job->completion.fd       = fd;
+    job->completion.callback = blocking_job_done;
+    job->completion.name     = "block";
+
+    ret = selector_notify_completion(s, &job->completion);
+    if(ret == SELECTOR_IARGS) {
+        pool_put(blocking_jobs, job);
+    }
+finally:
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// timers
+// ---------------------------------------------------------------------------
+
+/** cuelga el timer del casillero que le corresponde según su vencimiento */
+static void
+timers_link(fd_selector s, struct selector_timer *t) {
+    const uint64_t delta = t->expires - s->wheel_now;
+    uint64_t when = t->expires;
+    if(delta >= WHEEL_RANGE) {
+        // no entra: se ubica en el último bloque y se reubica al llegar
+        when = s->wheel_now + WHEEL_RANGE - 1;
+    }
+    unsigned level = 0;
+    while(level < WHEEL_LEVELS - 1
+          && (when - s->wheel_now) >= ((uint64_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    struct selector_timer **head =
+        &s->wheel[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK];
 
-    // encolamos en el selector los resultados
-    pthread_mutex_lock(&s->resolution_mutex);
-    job->next = s->resolution_jobs;
-    s->resolution_jobs = job;
-    pthread_mutex_unlock(&s->resolution_mutex);
+    t->next  = *head;
+    t->pprev = head;
+    if(t->next != NULL) {
+        t->next->pprev = &t->next;
+    }
+    *head = t;
+}
 
-    // notificamos al hilo principal
-    pthread_kill(s->selector_thread, conf.signal);
+static void
+timers_unlink(struct selector_timer *t) {
+    *t->pprev = t->next;
+    if(t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    t->next  = NULL;
+    t->pprev = NULL;
+}
 
+bool
+selector_timer_armed(const struct selector_timer *t) {
+    return t->pprev != NULL;
+}
+
+selector_status
+selector_timer_reset(fd_selector s, struct selector_timer *t, unsigned long ms) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    if(NULL == s || NULL == t || NULL == t->handler) {
+        ret = SELECTOR_IARGS;
+        goto finally;
+    }
+
+    uint64_t expires = timers_clock() + ms;
+    if(expires <= s->wheel_now) {
+        // el tick actual ya se procesó
+        expires = s->wheel_now + 1;
+    }
+    if(selector_timer_armed(t)) {
+        if(t->expires == expires) {
+            // caso común: varios reinicios dentro del mismo milisegundo
+            goto finally;
+        }
+        timers_unlink(t);
+    } else {
+        s->timers_armed++;
+    }
+    t->expires = expires;
+    timers_link(s, t);
+finally:
+    return ret;
+}
+
+selector_status
+selector_timer_add(fd_selector s, struct selector_timer *t, unsigned long ms) {
+    if(NULL == t || selector_timer_armed(t)) {
+        return SELECTOR_IARGS;
+    }
+    return selector_timer_reset(s, t, ms);
+}
+
+void
+selector_timer_cancel(fd_selector s, struct selector_timer *t) {
+    if(t != NULL && selector_timer_armed(t)) {
+        timers_unlink(t);
+        s->timers_armed--;
+    }
+}
+
+/** redistribuye un casillero de un nivel superior en los niveles inferiores */
+static void
+timers_cascade(fd_selector s, const unsigned level) {
+    struct selector_timer **head =
+        &s->wheel[level][(s->wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    struct selector_timer *t = *head;
+    *head = NULL;
+    while(t != NULL) {
+        struct selector_timer *next = t->next;
+        timers_link(s, t);
+        t = next;
+    }
+}
+
+/** avanza la rueda hasta el reloj actual disparando lo que venció */
+static void
+timers_run(fd_selector s) {
+    const uint64_t target = timers_clock();
+    struct selector_key key = {
+        .s = s,
+    };
+
+    while(s->wheel_now < target) {
+        if(s->timers_armed == 0) {
+            s->wheel_now = target;
+            break;
+        }
+        s->wheel_now++;
+
+        // al completar una vuelta de un nivel se baja el casillero siguiente
+        // del nivel de arriba
+        for(unsigned level = 1; level < WHEEL_LEVELS; level++) {
+            if((s->wheel_now & (((uint64_t)1 << (WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            timers_cascade(s, level);
+        }
+
+        struct selector_timer **head = &s->wheel[0][s->wheel_now & WHEEL_MASK];
+        struct selector_timer *t;
+        while((t = *head) != NULL) {
+            timers_unlink(t);
+            if(t->expires > s->wheel_now) {
+                // venía de un plazo más largo que la rueda
+                timers_link(s, t);
+                continue;
+            }
+            s->timers_armed--;
+
+            const struct item *item = NULL;
+            if(t->fd >= 0 && (size_t)t->fd < s->fd_size) {
+                item = s->fds + t->fd;
+            }
+            if(item != NULL && ITEM_USED(item)) {
+                key.fd   = item->fd;
+                key.data = item->data;
+            } else {
+                key.fd   = -1;
+                key.data = NULL;
+            }
+            const uint64_t start = loop_begin(s);
+            t->handler(&key, t);
+            loop_end(s, "timers", start);
+        }
+    }
+}
+
+/**
+ * tiempo máximo de espera: el timeout configurado, acotado por el próximo
+ * tick en el que la rueda tiene algo que hacer (disparar o redistribuir).
+ */
+static struct timespec
+timers_wait_timeout(fd_selector s) {
+    struct timespec ret = s->master_t;
+    if(s->timers_armed == 0) {
+        return ret;
+    }
+
+    uint64_t next = UINT64_MAX;
+    for(unsigned level = 0; level < WHEEL_LEVELS; level++) {
+        const unsigned shift = WHEEL_BITS * level;
+        const uint64_t block = s->wheel_now >> shift;
+        for(uint64_t d = 1; d <= WHEEL_SLOTS; d++) {
+            if(s->wheel[level][(block + d) & WHEEL_MASK] != NULL) {
+                const uint64_t tick = (block + d) << shift;
+                if(tick < next) {
+                    next = tick;
+                }
+                break;
+            }
+        }
+    }
+
+    const uint64_t now = timers_clock();
+    const uint64_t ms  = next > now ? next - now : 0;
+    const uint64_t max = (uint64_t)ret.tv_sec * 1000 + ret.tv_nsec / 1000000;
+    if(ms < max) {
+        ret.tv_sec  = (time_t)(ms / 1000);
+        ret.tv_nsec = (long)(ms % 1000) * 1000000;
+    }
+    return ret;
+}
+
+/** espera y despacha eventos utilizando epoll(7) */
+static selector_status
+selector_select_epoll(fd_selector s) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    const struct timespec wait = timers_wait_timeout(s);
+    const long long ms = (long long)wait.tv_sec * 1000
+                       + wait.tv_nsec / 1000000;
+    const int timeout  = ms > INT32_MAX ? INT32_MAX : (int)ms;
+
+    items_flush_changes(s);
+
+    // como pselect(2), las señales solo se desbloquean durante la espera
+    const uint64_t wait_start = loop_begin(s);
+    int fds = epoll_pwait(s->epoll_fd, s->events, EPOLL_MAX_EVENTS, timeout,
+                          &s->wait_sigmask);
+    const uint64_t dispatch_start = loop_waited(s, wait_start);
+    if(-1 == fds) {
+        if(errno != EINTR && errno != EAGAIN) {
+            ret = SELECTOR_IO;
+            goto finally;
+        }
+    } else {
+        handle_epoll_iteration(s, fds);
+    }
+    handle_completions(s);
+    timers_run(s);
+    loop_dispatched(s, dispatch_start, fds > 0 ? (uint64_t)fds : 0);
+finally:
+    return ret;
+}
+
+/**
+ * espera y despacha eventos utilizando io_uring(7). Los cambios de interés
+ * de la iteración anterior viajan en la misma llamada que espera.
+ */
+static selector_status
+selector_select_uring(fd_selector s) {
+    selector_status ret = SELECTOR_SUCCESS;
+
+    items_flush_changes(s);
+    const struct timespec wait = timers_wait_timeout(s);
+    const uint64_t wait_start = loop_begin(s);
+    const int waited = uring_submit_and_wait(s->ring, &wait, &s->wait_sigmask);
+    const uint64_t dispatch_start = loop_waited(s, wait_start);
+    if(-1 == waited) {
+        switch(errno) {
+            case EINTR:
+            case EAGAIN:
+            case EBUSY:
+            case ETIME:
+                break;
+            default:
+                ret = SELECTOR_IO;
+                goto finally;
+        }
+    }
+
+    unsigned n;
+    uint64_t ready = 0;
+    do {
+        n = uring_reap(s->ring, s->completions, EPOLL_MAX_EVENTS);
+        handle_uring_iteration(s, n);
+        ready += n;
+    } while(n == EPOLL_MAX_EVENTS);
+    handle_completions(s);
+    timers_run(s);
+    loop_dispatched(s, dispatch_start, ready);
 finally:
     return ret;
 }
@@ -537,14 +1599,24 @@ selector_status
 selector_select(fd_selector s) {
     selector_status ret = SELECTOR_SUCCESS;
 
+    s->iteration++;
+    if(s->backend == SELECTOR_BACKEND_EPOLL) {
+        return selector_select_epoll(s);
+    }
+    if(s->backend == SELECTOR_BACKEND_IO_URING) {
+        return selector_select_uring(s);
+    }
+
+    items_flush_changes(s);
+
     memcpy(&s->slave_r, &s->master_r, sizeof(s->slave_r));
     memcpy(&s->slave_w, &s->master_w, sizeof(s->slave_w));
-    memcpy(&s->slave_t, &s->master_t, sizeof(s->slave_t));
-
-    s->selector_thread = pthread_self();
+    s->slave_t = timers_wait_timeout(s);
 
+    const uint64_t wait_start = loop_begin(s);
     int fds = pselect(s->max_fd + 1, &s->slave_r, &s->slave_w, 0, &s->slave_t,
-                      &emptyset);
+                      &s->wait_sigmask);
+    const uint64_t dispatch_start = loop_waited(s, wait_start);
     if(-1 == fds) {
         switch(errno) {
             case EAGAIN:
@@ -572,7 +1644,9 @@ selector_select(fd_selector s) {
         handle_iteration(s);
     }
     if(ret == SELECTOR_SUCCESS) {
-        handle_block_notifications(s);
+        handle_completions(s);
+        timers_run(s);
+        loop_dispatched(s, dispatch_start, fds > 0 ? (uint64_t)fds : 0);
     }
 finally:
     return ret;
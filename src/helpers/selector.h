@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * selector.c - un muliplexor de entrada salida
@@ -14,6 +15,7 @@
  * de file descriptors de forma no bloqueante.
  *
  * Esconde la implementación final (select(2) / poll(2) / epoll(2) / ..)
+ * La implementación se elige al iniciar la librería (ver `selector_backend').
  *
  * El usuario registra para un file descriptor especificando:
  *  1. un handler: provee funciones callback que manejarán los eventos de
@@ -30,8 +32,9 @@
  * la iteración normal. Los handlers no se tienen que preocupar por la
  * concurrencia.
  *
- * Dicha señalización se realiza mediante señales, y es por eso que al
- * iniciar la librería `selector_init' se debe configurar una señal a utilizar.
+ * Dicha señalización se realiza con un eventfd(2) propio de cada selector
+ * (ver `selector_notify_completion'). Cada selector debe ser usado desde un
+ * único thread; para aprovechar varios núcleos se crea un selector por thread.
  *
  * Todos métodos retornan su estado (éxito / error) de forma uniforme.
  * Puede utilizar `selector_error' para obtener una representación human
@@ -67,13 +70,53 @@ typedef enum {
 const char *
 selector_error(const selector_status status);
 
+/** implementación del multiplexor a utilizar */
+typedef enum {
+    /** epoll(7) si la plataforma lo soporta, sino pselect(2) */
+    SELECTOR_BACKEND_AUTO    = 0,
+    /** epoll(7): el costo de despacho escala con los eventos listos */
+    SELECTOR_BACKEND_EPOLL   = 1,
+    /** pselect(2): limitado a FD_SETSIZE descriptores */
+    SELECTOR_BACKEND_PSELECT = 2,
+    /**
+     * io_uring(7) como selector de disponibilidad: un IORING_OP_POLL_ADD por
+     * fd; los cambios de interés se acumulan y se envían junto con la espera
+     * en una única io_uring_enter(2) por iteración. La E/S no pasa por el
+     * ring. En level-triggered los polls son de un disparo y se rearman en
+     * cada iteración. Si el kernel no lo soporta se usa epoll(7).
+     */
+    SELECTOR_BACKEND_IO_URING = 3,
+} selector_backend;
+
+/** retorna un nombre legible del backend */
+const char *
+selector_backend_name(const selector_backend backend);
+
 /** opciones de inicialización del selector */
 struct selector_init {
-    /** señal a utilizar para notificaciones internas */
-    const int signal;
-
     /** tiempo máximo de bloqueo durante `selector_iteratate' */
     struct timespec select_timeout;
+
+    /** backend preferido. si no está disponible se usa el siguiente más simple */
+    selector_backend backend;
+
+    /**
+     * notificación edge-triggered (epoll, io_uring): un fd solo se reporta
+     * cuando cambia su estado, por lo que los handlers deben leer/escribir
+     * hasta EAGAIN (o hasta que no tengan más lugar/datos). Cambiar el
+     * interés de un fd vuelve a evaluar su estado. pselect lo ignora.
+     */
+    bool edge_triggered;
+
+    /**
+     * instrumenta el loop: tiempos de espera y de despacho, fds listos por
+     * iteración y tiempo por handler (ver `selector_get_loop_stats').
+     * Apagado solo cuesta una comparación por evento.
+     */
+    bool loop_stats;
+
+    /** trabajos de `selector_notify_block' que se reservan de antemano */
+    size_t job_prealloc;
 };
 
 /** inicializa la librería */
@@ -84,7 +127,12 @@ selector_init(const struct selector_init *c);
 selector_status
 selector_close(void);
 
-/* instancia un nuevo selector. returna NULL si no puede instanciar  */
+/**
+ * instancia un nuevo selector. returna NULL si no puede instanciar.
+ *
+ * Durante la espera rige la máscara de señales que tiene el thread que lo
+ * crea: las señales bloqueadas en ese momento no interrumpen la espera.
+ */
 fd_selector
 selector_new(const size_t initial_elements);
 
@@ -92,6 +140,103 @@ selector_new(const size_t initial_elements);
 void
 selector_destroy(fd_selector s);
 
+/** backend efectivamente utilizado por el selector */
+selector_backend
+selector_get_backend(fd_selector s);
+
+/** true si el selector notifica por flanco (ver `selector_init') */
+bool
+selector_is_edge_triggered(fd_selector s);
+
+/**
+ * número de la iteración en curso (cuenta las llamadas a `selector_select').
+ * Permite a los handlers llevar contadores por iteración.
+ */
+uint64_t
+selector_iteration(fd_selector s);
+
+/** contadores del selector, para monitoreo */
+struct selector_stats {
+    /** llamadas a selector_set_interest() y selector_rearm() */
+    uint64_t interest_changes;
+    /** actualizaciones de interés enviadas al kernel (o a los fd_set) */
+    uint64_t interest_applied;
+    /**
+     * cambios que no llegaron al kernel porque otro posterior sobre el mismo
+     * fd en la misma iteración los reemplazó, porque dejaban el interés como
+     * estaba, o porque el fd se desregistró antes de enviarlos.
+     */
+    uint64_t interest_collapsed;
+};
+
+/**
+ * copia los contadores del selector en `stats'. Se puede llamar desde otro
+ * thread: cada contador se lee de forma atómica, aunque el conjunto no es
+ * una foto consistente.
+ */
+void
+selector_get_stats(fd_selector s, struct selector_stats *stats);
+
+/**
+ * pone los contadores del selector (incluida la instrumentación del loop) en
+ * cero. Solo desde su propio thread
+ */
+void
+selector_reset_stats(fd_selector s);
+
+/** cantidad de baldes de `struct selector_histogram' */
+#define SELECTOR_HIST_BUCKETS 32
+
+/**
+ * histograma logarítmico: el balde 0 cuenta las muestras en 0 y el balde `i'
+ * las que cumplen 2^(i-1) <= v < 2^i. El último acumula también las mayores.
+ */
+struct selector_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[SELECTOR_HIST_BUCKETS];
+};
+
+/** cantidad máxima de handlers distintos que se miden por separado */
+#define SELECTOR_LOOP_HANDLERS 12
+
+/** instrumentación del loop (ver `selector_init.loop_stats') */
+struct selector_loop_stats {
+    uint64_t iterations;
+    /** microsegundos bloqueado en la espera */
+    struct selector_histogram wait_us;
+    /** microsegundos despachando eventos, completitudes y timers */
+    struct selector_histogram dispatch_us;
+    /** eventos listos por iteración */
+    struct selector_histogram ready;
+    /**
+     * microsegundos por invocación, agrupados por `fd_handler.name' (o
+     * `selector_completion.name'). Los timers se agrupan en "timers"; si la
+     * tabla se llena, lo que no entra va a "other".
+     */
+    struct {
+        const char *name;
+        struct selector_histogram time_us;
+    } handlers[SELECTOR_LOOP_HANDLERS];
+    unsigned handlers_n;
+};
+
+/**
+ * copia la instrumentación del loop en `stats'. Como `selector_get_stats' se
+ * puede llamar desde otro thread. Retorna false si está apagada.
+ */
+bool
+selector_get_loop_stats(fd_selector s, struct selector_loop_stats *stats);
+
+/**
+ * suma `src' en `dst', juntando los handlers por nombre. Sirve para agregar
+ * varios selectores.
+ */
+void
+selector_loop_stats_merge(struct selector_loop_stats *dst,
+                          const struct selector_loop_stats *src);
+
 /**
  * Intereses sobre un file descriptor (quiero leer, quiero escribir, …)
  *
@@ -99,11 +244,16 @@ selector_destroy(fd_selector s);
  * de bits.
  *
  * OP_NOOP es útil para cuando no se tiene ningún interés.
+ *
+ * OP_ERROR pide que se avise (con `handle_error') cuando el socket tiene algo
+ * en su cola de errores, p.ej. las notificaciones de MSG_ZEROCOPY. Solo lo
+ * soportan los backends epoll e io_uring; pselect(2) lo ignora.
  */
 typedef enum {
     OP_NOOP    = 0,
     OP_READ    = 1 << 0,
     OP_WRITE   = 1 << 2,
+    OP_ERROR   = 1 << 3,
 } fd_interest ;
 
 /**
@@ -127,9 +277,14 @@ struct selector_key {
  * Manejador de los diferentes eventos..
  */
 typedef struct fd_handler {
+  /** nombre para la instrumentación del loop. Puede ser NULL */
+  const char *name;
+
   void (*handle_read)      (struct selector_key *key);
   void (*handle_write)     (struct selector_key *key);
   void (*handle_block)     (struct selector_key *key);
+  /** con OP_ERROR: hay algo en la cola de errores del socket. Puede ser NULL */
+  void (*handle_error)     (struct selector_key *key);
 
   /**
    * llamado cuando se se desregistra el fd
@@ -164,7 +319,13 @@ selector_status
 selector_unregister_fd(fd_selector   s,
                        const int     fd);
 
-/** permite cambiar los intereses para un file descriptor */
+/**
+ * permite cambiar los intereses para un file descriptor.
+ *
+ * El cambio se anota y se envía al kernel una sola vez antes de la próxima
+ * espera, junto con el resto de los cambios de la iteración; si el mismo fd
+ * cambia varias veces solo cuenta el último valor.
+ */
 selector_status
 selector_set_interest(fd_selector s, int fd, fd_interest i);
 
@@ -172,6 +333,16 @@ selector_set_interest(fd_selector s, int fd, fd_interest i);
 selector_status
 selector_set_interest_key(struct selector_key *key, fd_interest i);
 
+/**
+ * en modo edge-triggered vuelve a pedir la notificación de `fd' aunque su
+ * interés no haya cambiado: si el fd ya está listo se despacha en la próxima
+ * iteración. Sirve cuando un handler cambia de estado y el estado nuevo
+ * espera un evento que ya ocurrió (p.ej. pasa a querer escribir en un socket
+ * que ya era escribible). En level-triggered no hace nada.
+ */
+selector_status
+selector_rearm(fd_selector s, int fd);
+
 
 /**
  * se bloquea hasta que hay eventos disponible y los despacha.
@@ -188,7 +359,97 @@ selector_select(fd_selector s);
 int
 selector_fd_set_nio(const int fd);
 
-/** notifica que un trabajo bloqueante terminó */
+/**
+ * Aviso de que terminó un trabajo hecho en otro thread (p.ej. una resolución
+ * de nombres). Se embebe en la estructura del trabajo, así notificar no
+ * reserva memoria.
+ */
+struct selector_completion {
+    /** fd al que pertenece el trabajo */
+    int fd;
+    /**
+     * se invoca en el thread del selector. `key->data' es el dato registrado
+     * para `fd'; si el fd ya no está registrado (o el selector se está
+     * destruyendo) `key->fd' es -1. El callback queda como dueño de `c'.
+     */
+    void (*callback)(struct selector_key *key, struct selector_completion *c);
+    /** nombre para la instrumentación del loop. Puede ser NULL */
+    const char *name;
+
+    /** uso interno del selector */
+    struct selector_completion *next;
+};
+
+/**
+ * encola `c' para que el selector lo despache al final de su iteración.
+ * Se puede llamar desde cualquier thread: el encolado es lock-free y las
+ * notificaciones que llegan antes de que el selector se despierte comparten
+ * un único despertar (una escritura a un eventfd(2)).
+ *
+ * Si retorna SELECTOR_IO no se pudo despertar al selector, pero `c' igual
+ * quedó encolado.
+ */
+selector_status
+selector_notify_completion(fd_selector s, struct selector_completion *c);
+
+/**
+ * Timers
+ * ======
+ *
+ * Vencimientos que se disparan en el thread del selector, al final de la
+ * iteración. Agregar, mover y cancelar son O(1): se guardan en una rueda
+ * jerárquica de 4 niveles de 64 casilleros con resolución de 1ms. Los
+ * plazos que exceden lo que cubre la rueda (~4.6 horas) se reubican al
+ * llegar al último casillero.
+ *
+ * El timer se embebe en la estructura de su dueño, que debe inicializarlo en
+ * cero y cancelarlo antes de liberarlo.
+ */
+struct selector_timer;
+
+/**
+ * se invoca cuando vence `t'. `key' se arma como en selector_completion:
+ * `key->fd' es -1 si el fd del timer ya no está registrado. Al invocarse el
+ * timer ya está desarmado; el callback puede volver a agregarlo.
+ */
+typedef void (*selector_timer_handler)(struct selector_key *key,
+                                       struct selector_timer *t);
+
+struct selector_timer {
+    /** fd al que pertenece el timer */
+    int                     fd;
+    selector_timer_handler  handler;
+
+    /** uso interno del selector */
+    uint64_t                expires;
+    struct selector_timer  *next;
+    struct selector_timer **pprev;
+};
+
+/**
+ * arma `t' para que venza dentro de `ms' milisegundos.
+ * retorna SELECTOR_IARGS si ya estaba armado.
+ */
+selector_status
+selector_timer_add(fd_selector s, struct selector_timer *t, unsigned long ms);
+
+/** como selector_timer_add, pero si `t' ya estaba armado mueve su plazo */
+selector_status
+selector_timer_reset(fd_selector s, struct selector_timer *t, unsigned long ms);
+
+/** desarma `t'. Tolera timers no armados */
+void
+selector_timer_cancel(fd_selector s, struct selector_timer *t);
+
+/** true si `t' está esperando vencer */
+bool
+selector_timer_armed(const struct selector_timer *t);
+
+/**
+ * notifica que un trabajo bloqueante terminó: el selector llamará a
+ * `handle_block' de `fd'. Reserva memoria en cada llamada; ver
+ * selector_notify_completion.
+ */
 selector_status
 selector_notify_block(fd_selector s,
                  const int   fd);
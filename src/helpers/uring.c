@@ -0,0 +1,254 @@
+/**
+ * uring.c - envoltorio mínimo sobre io_uring(7) usando las syscalls crudas
+ */
+#define _GNU_SOURCE     // syscall(2), MAP_POPULATE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+struct uring {
+    int fd;
+
+    /** submission queue (compartida con el kernel) */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned  sq_entries;
+    struct io_uring_sqe *sqes;
+
+    /** completion queue (compartida con el kernel) */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /** entradas escritas que todavía no le pasamos a io_uring_enter */
+    unsigned  to_submit;
+
+    void   *sq_ring;
+    size_t  sq_ring_size;
+    void   *cq_ring;
+    size_t  cq_ring_size;
+    size_t  sqes_size;
+};
+
+static int
+sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags, const void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, arg, argsz);
+}
+
+struct uring *
+uring_new(unsigned entries) {
+    struct uring *r = calloc(1, sizeof(*r));
+    if(r == NULL) {
+        return NULL;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_uring_setup(entries, &p);
+    if(r->fd == -1) {
+        free(r);
+        return NULL;
+    }
+
+    // necesitamos poder pasarle timeout y máscara de señales al esperar
+    // (5.11) y que el kernel no descarte completitudes si se llena el CQ.
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP
+                            | IORING_FEAT_EXT_ARG;
+    if((p.features & required) != required) {
+        close(r->fd);
+        free(r);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(r->cq_ring_size > r->sq_ring_size) {
+        r->sq_ring_size = r->cq_ring_size;
+    }
+    r->cq_ring_size = r->sq_ring_size;
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sq_ring == MAP_FAILED) {
+        goto fail;
+    }
+    // IORING_FEAT_SINGLE_MMAP: ambos rings comparten el mapeo
+    r->cq_ring = r->sq_ring;
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_head    = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array   = (unsigned *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+
+    char *cq = r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return r;
+
+fail:
+    uring_destroy(r);
+    return NULL;
+}
+
+void
+uring_destroy(struct uring *r) {
+    if(r == NULL) {
+        return;
+    }
+    if(r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if(r->sq_ring != NULL && r->sq_ring != MAP_FAILED) {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    close(r->fd);
+    free(r);
+}
+
+/** envía lo encolado sin esperar completitudes */
+static int
+uring_flush(struct uring *r) {
+    while(r->to_submit > 0) {
+        const int n = sys_uring_enter(r->fd, r->to_submit, 0, 0, NULL, 0);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        r->to_submit -= (unsigned) n;
+    }
+    return 0;
+}
+
+/** obtiene una entrada libre del SQ, vaciándolo si hace falta */
+static struct io_uring_sqe *
+uring_get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    if(tail - head >= r->sq_entries) {
+        if(uring_flush(r) == -1) {
+            return NULL;
+        }
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if(tail - head >= r->sq_entries) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    const unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = r->sqes + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    return sqe;
+}
+
+static void
+uring_commit_sqe(struct uring *r) {
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+}
+
+bool
+uring_poll_add(struct uring *r, int fd, unsigned poll_mask,
+               uint64_t user_data, bool multishot) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode       = IORING_OP_POLL_ADD;
+    sqe->fd           = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->len          = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data    = user_data;
+    uring_commit_sqe(r);
+    return true;
+}
+
+bool
+uring_poll_remove(struct uring *r, uint64_t target, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode    = IORING_OP_POLL_REMOVE;
+    sqe->fd        = -1;
+    sqe->addr      = target;
+    sqe->user_data = user_data;
+    uring_commit_sqe(r);
+    return true;
+}
+
+int
+uring_submit_and_wait(struct uring *r, const struct timespec *timeout,
+                      const sigset_t *sigmask) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if(timeout != NULL) {
+        ts.tv_sec  = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_nsec;
+        arg.ts     = (uint64_t)(uintptr_t)&ts;
+    }
+    if(sigmask != NULL) {
+        arg.sigmask    = (uint64_t)(uintptr_t)sigmask;
+        arg.sigmask_sz = _NSIG / 8;
+    }
+
+    const int n = sys_uring_enter(r->fd, r->to_submit, 1,
+                                  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                  &arg, sizeof(arg));
+    if(n < 0) {
+        return -1;
+    }
+    r->to_submit -= (unsigned) n < r->to_submit ? (unsigned) n : r->to_submit;
+    return n;
+}
+
+unsigned
+uring_reap(struct uring *r, struct uring_completion *out, unsigned max) {
+    unsigned head = *r->cq_head;
+    const unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+
+    while(head != tail && n < max) {
+        const struct io_uring_cqe *cqe = r->cqes + (head & *r->cq_mask);
+        out[n].user_data = cqe->user_data;
+        out[n].res       = cqe->res;
+        out[n].more      = (cqe->flags & IORING_CQE_F_MORE) != 0;
+        n++;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
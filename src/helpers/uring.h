@@ -0,0 +1,75 @@
+#ifndef URING_H_Qm7cT2vLx9RkPe4sWbNa8HdYf3G
+#define URING_H_Qm7cT2vLx9RkPe4sWbNa8HdYf3G
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+/**
+ * uring.c - envoltorio mínimo sobre io_uring(7) usando las syscalls crudas
+ *
+ * Solo expone lo que necesita el selector: armar y desarmar polls sobre
+ * file descriptors, y enviar todo lo encolado en la misma llamada que espera
+ * las completitudes. De esta forma una iteración del selector cuesta una
+ * única io_uring_enter(2) sin importar cuántos intereses cambiaron.
+ *
+ * No depende de liburing. Si el kernel no soporta io_uring (o lo bloquea
+ * una política de seccomp) `uring_new' retorna NULL y el llamador puede
+ * elegir otro mecanismo.
+ */
+struct uring;
+
+/** una completitud retirada del kernel */
+struct uring_completion {
+    uint64_t user_data;
+    int32_t  res;
+    /** la operación sigue activa y generará más completitudes (multishot) */
+    bool     more;
+};
+
+/**
+ * crea un ring con al menos `entries' lugares de submission.
+ * retorna NULL (dejando errno) si el kernel no tiene lo necesario.
+ */
+struct uring *
+uring_new(unsigned entries);
+
+/** libera el ring. Tolera NULLs */
+void
+uring_destroy(struct uring *r);
+
+/**
+ * encola un IORING_OP_POLL_ADD sobre `fd' con la máscara `poll_mask'
+ * (POLLIN, POLLOUT, ...). Con `multishot' el poll sigue armado tras cada
+ * completitud (IORING_CQE_F_MORE).
+ *
+ * retorna false si no se pudo encolar (errno).
+ */
+bool
+uring_poll_add(struct uring *r, int fd, unsigned poll_mask,
+               uint64_t user_data, bool multishot);
+
+/**
+ * encola la cancelación del poll identificado por `target'. La completitud
+ * de la cancelación en sí llega con `user_data'.
+ */
+bool
+uring_poll_remove(struct uring *r, uint64_t target, uint64_t user_data);
+
+/**
+ * envía todo lo encolado y espera hasta que haya al menos una completitud,
+ * venza `timeout' (puede ser NULL) o llegue una señal no bloqueada en
+ * `sigmask' (puede ser NULL).
+ *
+ * retorna -1 ante error (errno). EINTR y ETIME no son errores reales.
+ */
+int
+uring_submit_and_wait(struct uring *r, const struct timespec *timeout,
+                      const sigset_t *sigmask);
+
+/** retira hasta `max' completitudes. retorna la cantidad retirada */
+unsigned
+uring_reap(struct uring *r, struct uring_completion *out, unsigned max);
+
+#endif
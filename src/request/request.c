@@ -9,8 +9,7 @@
 #include <unistd.h>
 #include "../socks5/socks5.h"
 #include "../tunnel/tunnel.h"
-#include "../resolver/resolver.h"
-#include "../helpers/metrics.h"
+#include "../connect/connect.h"
 
 // ============================================================================  
 // Tabla de transiciones del parser (por ahora vacía)
@@ -222,14 +221,6 @@ void request_close(struct request_parser *p) {
 // ESTADOS REQUEST - Funciones de la máquina de estados
 // ============================================================================
 
-static int set_non_blocking(int fd) {
-    const int flags = fcntl(fd, F_GETFL);
-    if (flags == -1) {
-        return -1;
-    }
-    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-}
-
 void client_request_read_on_arrival(unsigned state, struct selector_key *key) {
     (void)state;
     struct socks5_conn *conn = key->data;
@@ -307,127 +298,9 @@ unsigned client_request_read_on_read_ready(struct selector_key *key) {
     }
 }
 
-// ============================================================================
-// Callback de resolución DNS asíncrona
-// ============================================================================
-
-static void on_resolution_done(
-    struct selector_key *key,
-    enum resolver_status status,
-    struct addrinfo *result,
-    void *data
-) {
-    struct socks5_conn *conn = (struct socks5_conn *)data;
-    struct request_st *d = &conn->client.request;
-    struct socks5_metrics *m = metrics_get();
-    
-    d->resolving = false;
-    
-    if (status != RESOLVER_SUCCESS || result == NULL) {
-        m->dns_fail++;
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x04, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        return;
-    }
-    
-    m->dns_ok++;
-    
-    struct addrinfo *rp;
-    int fd = -1;
-    int connect_result = -1;
-    
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (fd == -1) {
-            continue;
-        }
-
-        if (set_non_blocking(fd) == -1) {
-            close(fd);
-            fd = -1;
-            continue;
-        }
-
-        connect_result = connect(fd, rp->ai_addr, rp->ai_addrlen);
-        
-        if (connect_result == 0 || (connect_result == -1 && errno == EINPROGRESS)) {
-            memcpy(&conn->origin_addr, rp->ai_addr, rp->ai_addrlen);
-            conn->origin_addr_len = rp->ai_addrlen;
-            break;
-        }
-        
-        close(fd);
-        fd = -1;
-    }
-    
-    if (fd == -1) {
-        resolver_free_result(result);
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x04, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        return;
-    }
-
-    conn->origin_fd = fd;
-    
-    // Determinar si fue conexión inmediata o EINPROGRESS
-    // (después del break, connect_result es 0 o -1 con EINPROGRESS)
-    bool immediate = (connect_result == 0);
-    
-    if (immediate) {
-        // Conexión inmediata — no necesitamos retry
-        resolver_free_result(result);
-        conn->addrinfo_list = NULL;
-        conn->addrinfo_current = NULL;
-        
-        if (selector_register(key->s, fd, socks5_get_handler(), OP_WRITE, conn) != SELECTOR_SUCCESS) {
-            close(fd);
-            conn->origin_fd = -1;
-            uint8_t addr[4] = {0, 0, 0, 0};
-            client_set_reply(conn, 0x01, 0x01, addr, 0);
-            selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-            return;
-        }
-        conn->reply_code = 0x00;
-        prepare_bound_addr(conn);
-        conn->reply_ready = true;
-        conn->origin_stm.current = conn->origin_stm.states + O_CONNECTING;
-        if (conn->origin_stm.current->on_arrival != NULL) {
-            struct selector_key origin_key = {
-                .s = key->s,
-                .fd = fd,
-                .data = conn,
-            };
-            conn->origin_stm.current->on_arrival(O_CONNECTING, &origin_key);
-        }
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        selector_set_interest(key->s, fd, OP_NOOP);
-        return;
-    }
-    
-    // EINPROGRESS — guardar lista de direcciones para fallback
-    conn->addrinfo_list = result;
-    conn->addrinfo_current = (rp != NULL) ? rp->ai_next : NULL;
-    
-    if (selector_register(key->s, fd, socks5_get_handler(), OP_WRITE, conn) != SELECTOR_SUCCESS) {
-        close(fd);
-        conn->origin_fd = -1;
-        resolver_free_result(result);
-        conn->addrinfo_list = NULL;
-        conn->addrinfo_current = NULL;
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x01, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        return;
-    }
-    selector_set_interest(key->s, conn->client_fd, OP_NOOP);
-}
-
 void client_request_write_on_arrival(unsigned state, struct selector_key *key) {
     (void)state;
     struct socks5_conn *conn = key->data;
-    struct request_st *d = &conn->client.request;
 
     buffer_reset(&conn->write_buf);
     conn->reply_ready = false;
@@ -440,147 +313,8 @@ void client_request_write_on_arrival(unsigned state, struct selector_key *key) {
         return;
     }
 
-    char portstr[16];
-    snprintf(portstr, sizeof(portstr), "%u", conn->req_port);
-
-    if (conn->req_atyp == 0x03) {
-        char host[256];
-        memcpy(host, conn->req_addr, conn->req_addr_len);
-        host[conn->req_addr_len] = '\0';
-        
-        d->resolving = true;
-        selector_set_interest(key->s, conn->client_fd, OP_NOOP);
-        
-        if (!resolver_request(key, host, portstr, on_resolution_done, conn)) {
-            d->resolving = false;
-            struct socks5_metrics *m = metrics_get();
-            m->dns_fail++;
-            uint8_t addr[4] = {0, 0, 0, 0};
-            client_set_reply(conn, 0x01, 0x01, addr, 0);
-            selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        }
-        return;
-    }
-
-    struct addrinfo hints;
-    struct addrinfo *result = NULL;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    int gai = 0;
-    if (conn->req_atyp == 0x01) {
-        char ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, conn->req_addr, ip, sizeof(ip));
-        hints.ai_family = AF_INET;
-        hints.ai_flags = AI_NUMERICHOST;
-        gai = getaddrinfo(ip, portstr, &hints, &result);
-    } else if (conn->req_atyp == 0x04) {
-        char ip[INET6_ADDRSTRLEN];
-        inet_ntop(AF_INET6, conn->req_addr, ip, sizeof(ip));
-        hints.ai_family = AF_INET6;
-        hints.ai_flags = AI_NUMERICHOST;
-        gai = getaddrinfo(ip, portstr, &hints, &result);
-    } else {
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x08, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        return;
-    }
-
-    if (gai != 0 || result == NULL) {
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x04, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        if (result != NULL) {
-            freeaddrinfo(result);
-        }
-        return;
-    }
-
-    // Try all resolved addresses (similar to on_resolution_done)
-    struct addrinfo *rp;
-    int fd = -1;
-    int r = -1;
-    
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (fd == -1) {
-            continue;
-        }
-
-        if (set_non_blocking(fd) == -1) {
-            close(fd);
-            fd = -1;
-            continue;
-        }
-
-        r = connect(fd, rp->ai_addr, rp->ai_addrlen);
-        
-        if (r == 0 || (r == -1 && errno == EINPROGRESS)) {
-            memcpy(&conn->origin_addr, rp->ai_addr, rp->ai_addrlen);
-            conn->origin_addr_len = rp->ai_addrlen;
-            break;
-        }
-        
-        close(fd);
-        fd = -1;
-    }
-    
-    freeaddrinfo(result);
-    
-    if (fd == -1) {
-        uint8_t addr[4] = {0, 0, 0, 0};
-        client_set_reply(conn, 0x01, 0x01, addr, 0);
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        return;
-    }
-
-    conn->origin_fd = fd;
-    if (r == 0) {
-        if (selector_register(key->s, fd, socks5_get_handler(), OP_WRITE, conn) != SELECTOR_SUCCESS) {
-            close(fd);
-            conn->origin_fd = -1;
-            uint8_t addr[4] = {0, 0, 0, 0};
-            client_set_reply(conn, 0x01, 0x01, addr, 0);
-            selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-            return;
-        }
-        conn->reply_code = 0x00;
-        prepare_bound_addr(conn);
-        conn->reply_ready = true;
-        conn->origin_stm.current = conn->origin_stm.states + O_CONNECTING;
-        if (conn->origin_stm.current->on_arrival != NULL) {
-            struct selector_key origin_key = {
-                .s = key->s,
-                .fd = fd,
-                .data = conn,
-            };
-            conn->origin_stm.current->on_arrival(O_CONNECTING, &origin_key);
-        }
-        selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-        selector_set_interest(key->s, fd, OP_NOOP);
-        return;
-    }
-
-    if (r < 0 && errno == EINPROGRESS) {
-        if (selector_register(key->s, fd, socks5_get_handler(), OP_WRITE, conn) != SELECTOR_SUCCESS) {
-            close(fd);
-            conn->origin_fd = -1;
-            uint8_t addr[4] = {0, 0, 0, 0};
-            client_set_reply(conn, 0x01, 0x01, addr, 0);
-            selector_set_interest(key->s, conn->client_fd, OP_WRITE);
-            return;
-        }
-        selector_set_interest(key->s, conn->client_fd, OP_NOOP);
-        return;
-    }
-
-    close(fd);
-    conn->origin_fd = -1;
-    uint8_t addr[4] = {0, 0, 0, 0};
-    client_set_reply(conn, 0x01, 0x01, addr, 0);
-    selector_set_interest(key->s, conn->client_fd, OP_WRITE);
+    // resolución, candidatos y reintentos quedan en el motor de conexión
+    connect_request(key, conn);
 }
 
 unsigned client_request_write_on_read_ready(struct selector_key *key) {
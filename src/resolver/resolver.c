@@ -1,22 +1,26 @@
 #include "resolver.h"
 #include "../helpers/selector.h"
+#include "../helpers/pool.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
-#include <fcntl.h>
 
 #define MAX_HOSTNAME 256
 #define MAX_PORT 16
 
 struct resolver_job {
-    struct selector_key *key;
+    /** aviso al selector; primer campo para poder convertir el puntero */
+    struct selector_completion done;
+    /** selector del thread que pidió la resolución */
+    fd_selector s;
     char hostname[MAX_HOSTNAME];
     char port[MAX_PORT];
     resolver_done_callback callback;
     void *data;
+    uint32_t seq;
     
     enum resolver_status status;
     struct addrinfo *result;
@@ -34,11 +38,14 @@ struct job_queue {
 
 static struct {
     struct job_queue pending_jobs;
-    struct job_queue done_jobs;
     pthread_t *threads;
     int num_threads;
-    int notification_fd[2];
     bool initialized;
+    /**
+     * trabajos. Sobrevive a resolver_destroy: los ya resueltos que siguen
+     * encolados en un selector se devuelven cuando éste los despacha
+     */
+    struct pool *jobs;
 } resolver_ctx = {
     .initialized = false
 };
@@ -63,7 +70,7 @@ static void queue_destroy(struct job_queue *q) {
         if (job->result) {
             freeaddrinfo(job->result);
         }
-        free(job);
+        pool_put(resolver_ctx.jobs, job);
     }
     q->shutdown = true;
     pthread_cond_broadcast(&q->cond);
@@ -140,93 +147,60 @@ static void* resolver_worker(void *arg) {
             }
         }
         
-        queue_push(&resolver_ctx.done_jobs, job);
-        
-        char notify = '!';
-        ssize_t written = write(resolver_ctx.notification_fd[1], &notify, 1);
-        (void)written;
+        if (selector_notify_completion(job->s, &job->done) != SELECTOR_SUCCESS) {
+            perror("resolver: selector_notify_completion");
+        }
     }
     
     return NULL;
 }
 
 // ============================================================================
-// Handler para el notification FD en el selector
+// Entrega del resultado (en el thread del selector)
 // ============================================================================
 
-static void resolver_notification_read(struct selector_key *key) {
-    char buf[256];
-    while (read(key->fd, buf, sizeof(buf)) > 0) {
-    }
-    
-    while (true) {
-        pthread_mutex_lock(&resolver_ctx.done_jobs.mutex);
-        struct resolver_job *job = resolver_ctx.done_jobs.head;
-        if (job) {
-            resolver_ctx.done_jobs.head = job->next;
-            if (!resolver_ctx.done_jobs.head) {
-                resolver_ctx.done_jobs.tail = NULL;
-            }
-        }
-        pthread_mutex_unlock(&resolver_ctx.done_jobs.mutex);
-        
-        if (!job) {
-            break;
-        }
-        
-        if (job->callback) {
-            job->callback(job->key, job->status, job->result, job->data);
-        } else {
-            if (job->result) {
-                freeaddrinfo(job->result);
-            }
-        }
-        
-        free(job);
+static void resolver_job_done(struct selector_key *key, struct selector_completion *c) {
+    struct resolver_job *job = (struct resolver_job *)c;
+
+    // si el fd se cerró (o se reutilizó para otra conexión) nadie espera
+    // este resultado
+    if (job->callback && key->fd != -1 && key->data == job->data) {
+        job->callback(key, job->status, job->result, job->data, job->seq);
+    } else if (job->result) {
+        freeaddrinfo(job->result);
     }
-}
 
-static const struct fd_handler resolver_notification_handler = {
-    .handle_read = resolver_notification_read,
-    .handle_write = NULL,
-    .handle_block = NULL,
-    .handle_close = NULL,
-};
+    pool_put(resolver_ctx.jobs, job);
+}
 
 // ============================================================================
 // API Pública
 // ============================================================================
 
-bool resolver_init(int num_threads) {
+bool resolver_init(int num_threads, size_t job_prealloc) {
     if (resolver_ctx.initialized) {
         return false;
     }
-    
-    if (num_threads < 1 || num_threads > 4) {
-        num_threads = 2;
-    }
-    
-    if (pipe(resolver_ctx.notification_fd) == -1) {
-        return false;
+
+    if (resolver_ctx.jobs == NULL) {
+        resolver_ctx.jobs = pool_new("resolver_job", sizeof(struct resolver_job), job_prealloc);
+        if (resolver_ctx.jobs == NULL) {
+            return false;
+        }
     }
     
-    int flags = fcntl(resolver_ctx.notification_fd[0], F_GETFL, 0);
-    if (flags == -1 || fcntl(resolver_ctx.notification_fd[0], F_SETFL, flags | O_NONBLOCK) == -1) {
-        close(resolver_ctx.notification_fd[0]);
-        close(resolver_ctx.notification_fd[1]);
-        return false;
+    if (num_threads < 1) {
+        num_threads = 2;
+    } else if (num_threads > RESOLVER_MAX_THREADS) {
+        num_threads = RESOLVER_MAX_THREADS;
     }
     
     queue_init(&resolver_ctx.pending_jobs);
-    queue_init(&resolver_ctx.done_jobs);
     
     resolver_ctx.num_threads = num_threads;
     resolver_ctx.threads = calloc((size_t)num_threads, sizeof(pthread_t));
     if (!resolver_ctx.threads) {
-        close(resolver_ctx.notification_fd[0]);
-        close(resolver_ctx.notification_fd[1]);
         queue_destroy(&resolver_ctx.pending_jobs);
-        queue_destroy(&resolver_ctx.done_jobs);
         return false;
     }
     
@@ -242,45 +216,37 @@ bool resolver_init(int num_threads) {
     return true;
 }
 
-bool resolver_register_notification_fd(fd_selector selector) {
-    if (!resolver_ctx.initialized) {
-        return false;
-    }
-    
-    selector_status st = selector_register(
-        selector,
-        resolver_ctx.notification_fd[0],
-        &resolver_notification_handler,
-        OP_READ,
-        NULL
-    );
-    
-    return st == SELECTOR_SUCCESS;
-}
-
 bool resolver_request(
     struct selector_key *key,
     const char *hostname,
     const char *port,
     resolver_done_callback callback,
-    void *data
+    void *data,
+    uint32_t seq
 ) {
-    if (!resolver_ctx.initialized || !hostname || !port) {
+    if (!resolver_ctx.initialized || !key || !hostname || !port) {
         return false;
     }
     
-    struct resolver_job *job = calloc(1, sizeof(*job));
+    struct resolver_job *job = pool_get(resolver_ctx.jobs);
     if (!job) {
         return false;
     }
+    memset(job, 0, sizeof(*job));
     
-    job->key = key;
+    // `key' vive solo durante el handler: guardamos lo necesario para
+    // volver a armarla cuando llegue el resultado
+    job->s = key->s;
+    job->done.fd = key->fd;
+    job->done.callback = resolver_job_done;
+    job->done.name = "resolver";
     strncpy(job->hostname, hostname, MAX_HOSTNAME - 1);
     job->hostname[MAX_HOSTNAME - 1] = '\0';
     strncpy(job->port, port, MAX_PORT - 1);
     job->port[MAX_PORT - 1] = '\0';
     job->callback = callback;
     job->data = data;
+    job->seq = seq;
     job->status = RESOLVER_PENDING;
     job->result = NULL;
     
@@ -312,11 +278,9 @@ void resolver_destroy(void) {
     free(resolver_ctx.threads);
     resolver_ctx.threads = NULL;
     
+    // las resoluciones ya terminadas quedan encoladas en su selector, que
+    // las libera al despacharlas (o al destruirse)
     queue_destroy(&resolver_ctx.pending_jobs);
-    queue_destroy(&resolver_ctx.done_jobs);
-    
-    close(resolver_ctx.notification_fd[0]);
-    close(resolver_ctx.notification_fd[1]);
     
     resolver_ctx.initialized = false;
 }
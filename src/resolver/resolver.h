@@ -20,22 +20,34 @@ typedef void (*resolver_done_callback)(
     struct selector_key *key,
     enum resolver_status status,
     struct addrinfo *result,
-    void *data
+    void *data,
+    uint32_t seq
 );
 
-/* Inicializa el subsistema de resolución DNS asíncrona */
-bool resolver_init(int num_threads);
-
-/* Registra el file descriptor de notificaciones en el selector*/
-bool resolver_register_notification_fd(fd_selector selector);
-
-/* Solicita la resolución asíncrona de un hostname */
+/* Máximo de threads del resolver; todos los reactores comparten el pool */
+#define RESOLVER_MAX_THREADS 16
+
+/*
+ * Inicializa el subsistema de resolución DNS asíncrona. `num_threads' se
+ * limita a RESOLVER_MAX_THREADS. Se reservan de antemano `job_prealloc'
+ * pedidos.
+ */
+bool resolver_init(int num_threads, size_t job_prealloc);
+
+/*
+ * Solicita la resolución asíncrona de un hostname. El callback se invoca en
+ * el thread del selector de `key', con el fd de `key', siempre que ese fd
+ * siga registrado con el mismo `data'. Un fd y un `data' reutilizados pasan
+ * ese control: `seq' vuelve intacto en el callback para que el pedido
+ * reconozca un resultado que ya no es suyo.
+ */
 bool resolver_request(
     struct selector_key *key,
     const char *hostname,
     const char *port,
     resolver_done_callback callback,
-    void *data
+    void *data,
+    uint32_t seq
 );
 
 /* Libera un resultado de addrinfo obtenido del resolver */
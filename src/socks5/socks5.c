@@ -4,6 +4,7 @@
 #include "../connect/connect.h"
 #include "../tunnel/tunnel.h"
 #include "../helpers/metrics.h"
+#include "../helpers/pool.h"
 #include <string.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -13,7 +14,9 @@
 static void socks5_read(struct selector_key *key);
 static void socks5_write(struct selector_key *key);
 static void socks5_block(struct selector_key *key);
+static void socks5_error(struct selector_key *key);
 static void socks5_close(struct selector_key *key);
+static void socks5_timeout(struct selector_key *key, struct selector_timer *t);
 
 static bool is_client_fd(const struct socks5_conn *conn, int fd);
 static bool is_origin_fd(const struct socks5_conn *conn, int fd);
@@ -136,8 +139,23 @@ static const struct state_definition origin_states[] = {
     },
 };
 
+// conexiones; todos los reactores comparten el mismo pool
+static struct pool *conns;
+
+bool socks5_pool_init(size_t prealloc) {
+    if (conns == NULL) {
+        conns = pool_new("socks5_conn", sizeof(struct socks5_conn), prealloc);
+    }
+    return conns != NULL;
+}
+
+void socks5_pool_close(void) {
+    pool_destroy(conns);
+    conns = NULL;
+}
+
 struct socks5_conn *socks5_new(int client_fd) {
-    struct socks5_conn *conn = malloc(sizeof(*conn));
+    struct socks5_conn *conn = pool_get(conns);
     if (conn == NULL) {
         return NULL;
     }
@@ -145,6 +163,7 @@ struct socks5_conn *socks5_new(int client_fd) {
     memset(conn, 0, sizeof(*conn));
     conn->client_fd = client_fd;
     conn->origin_fd = -1;
+    conn->flow_id = -1;
     conn->closed = false;
     conn->reply_ready = false;
     conn->reply_sent = false;
@@ -153,26 +172,28 @@ struct socks5_conn *socks5_new(int client_fd) {
 
     buffer_init(&conn->read_buf, sizeof(conn->read_raw), conn->read_raw);
     buffer_init(&conn->write_buf, sizeof(conn->write_raw), conn->write_raw);
-    buffer_init(&conn->client_to_origin_buf,
-                sizeof(conn->client_to_origin_raw),
-                conn->client_to_origin_raw);
-    buffer_init(&conn->origin_to_client_buf,
-                sizeof(conn->origin_to_client_raw),
-                conn->origin_to_client_raw);
+    ring_init(&conn->client_to_origin_buf, 0, NULL);
+    ring_init(&conn->origin_to_client_buf, 0, NULL);
 
     conn->chan_c2o.src_fd = &conn->client_fd;
     conn->chan_c2o.dst_fd = &conn->origin_fd;
+    conn->chan_c2o.src_budget = &conn->client_budget;
+    conn->chan_c2o.dst_budget = &conn->origin_budget;
     conn->chan_c2o.dst_buffer = &conn->client_to_origin_buf;
     conn->chan_c2o.read_enabled = true;
     conn->chan_c2o.write_enabled = false;
     conn->chan_c2o.direction = C2O;
+    conn->chan_c2o.pipe[0] = conn->chan_c2o.pipe[1] = -1;
 
     conn->chan_o2c.src_fd = &conn->origin_fd;
     conn->chan_o2c.dst_fd = &conn->client_fd;
+    conn->chan_o2c.src_budget = &conn->origin_budget;
+    conn->chan_o2c.dst_budget = &conn->client_budget;
     conn->chan_o2c.dst_buffer = &conn->origin_to_client_buf;
     conn->chan_o2c.read_enabled = true;
     conn->chan_o2c.write_enabled = false;
     conn->chan_o2c.direction = O2C;
+    conn->chan_o2c.pipe[0] = conn->chan_o2c.pipe[1] = -1;
 
     strcpy(conn->username, "anonymous");
     conn->method_chosen = 0xFF;
@@ -182,6 +203,10 @@ struct socks5_conn *socks5_new(int client_fd) {
     http_sniffer_init(&conn->http_state);
     conn->credentials_logged = false;
 
+    conn->timer.fd = client_fd;
+    conn->timer.handler = socks5_timeout;
+    conn->phase = PHASE_HANDSHAKE;
+
     conn->client_stm.initial   = C_HELLO_READ;
     conn->client_stm.max_state = (sizeof(client_states) / sizeof(client_states[0])) - 1;
     conn->client_stm.states    = client_states;
@@ -192,13 +217,7 @@ struct socks5_conn *socks5_new(int client_fd) {
     conn->origin_stm.states    = origin_states;
     stm_init(&conn->origin_stm);
 
-    struct socks5_metrics *m = metrics_get();
-    m->total_connections++;
-    m->current_connections++;
-    
-    if (m->current_connections > m->max_concurrent_connections) {
-        m->max_concurrent_connections = m->current_connections;
-    }
+    metrics_connection_opened();
 
     return conn;
 }
@@ -208,12 +227,10 @@ void socks5_destroy(struct socks5_conn *conn) {
         return;
     }
 
-    struct socks5_metrics *m = metrics_get();
-    if (m->current_connections > 0) {
-        m->current_connections--;
-    }
+    metrics_connection_closed();
 
-    free(conn);
+    tunnel_release(conn, NULL);
+    pool_put(conns, conn);
 }
 
 static bool is_client_fd(const struct socks5_conn *conn, int fd) {
@@ -232,63 +249,160 @@ static bool origin_terminal(unsigned st) {
     return st == O_DONE || st == O_ERROR;
 }
 
-static void socks5_read(struct selector_key *key) {
+// ============================================================================
+// PLAZOS
+// ============================================================================
+
+static struct socks5_timeouts timeouts = {
+    .handshake = SOCKS5_DEFAULT_HANDSHAKE_TIMEOUT,
+    .connect   = SOCKS5_DEFAULT_CONNECT_TIMEOUT,
+    .idle      = SOCKS5_DEFAULT_IDLE_TIMEOUT,
+};
+
+void socks5_set_timeouts(const struct socks5_timeouts *t) {
+    timeouts = *t;
+}
+
+// Etapa de la conexión que define qué plazo corre, según el estado del cliente
+static enum socks5_phase socks5_phase_of(struct socks5_conn *conn) {
+    switch (stm_state(&conn->client_stm)) {
+        case C_REQUEST_WRITE:
+            return PHASE_CONNECT;
+        case C_REPLY:
+            return PHASE_IDLE;
+        default:
+            return PHASE_HANDSHAKE;
+    }
+}
+
+static unsigned long socks5_phase_timeout(enum socks5_phase phase) {
+    switch (phase) {
+        case PHASE_HANDSHAKE:
+            return timeouts.handshake;
+        case PHASE_CONNECT:
+            return timeouts.connect;
+        default:
+            return timeouts.idle;
+    }
+}
+
+// El plazo de handshake y el de conexión cubren toda la etapa (no se
+// reinician con cada byte, si no un cliente lento podría estirarlos); el de
+// inactividad se reinicia con cada evento del túnel.
+static void socks5_update_timeout(fd_selector s, struct socks5_conn *conn) {
+    const enum socks5_phase phase = socks5_phase_of(conn);
+    if (phase == conn->phase && phase != PHASE_IDLE) {
+        return;
+    }
+    conn->phase = phase;
+
+    const unsigned long ms = socks5_phase_timeout(phase);
+    if (ms == 0) {
+        selector_timer_cancel(s, &conn->timer);
+    } else {
+        selector_timer_reset(s, &conn->timer, ms);
+    }
+}
+
+void socks5_start_timeout(struct socks5_conn *conn, fd_selector s) {
+    conn->phase = PHASE_HANDSHAKE;
+    if (timeouts.handshake != 0) {
+        selector_timer_add(s, &conn->timer, timeouts.handshake);
+    }
+}
+
+static void socks5_timeout(struct selector_key *key, struct selector_timer *t) {
+    (void)t;
     struct socks5_conn *conn = key->data;
-    if (conn == NULL || conn->closed) {
+    if (key->fd == -1 || conn == NULL || conn->closed) {
         return;
     }
 
-    unsigned st = C_ERROR;
-    if (is_client_fd(conn, key->fd)) {
-        st = stm_handler_read(&conn->client_stm, key);
-        if (client_terminal(st)) {
-            socks5_close(key);
-        }
-    } else if (is_origin_fd(conn, key->fd)) {
-        st = stm_handler_read(&conn->origin_stm, key);
-        if (origin_terminal(st)) {
-            socks5_close(key);
-        }
+    struct socks5_metrics *m = metrics_get();
+    switch (conn->phase) {
+        case PHASE_HANDSHAKE:
+            m->timeouts_handshake++;
+            break;
+        case PHASE_CONNECT:
+            m->timeouts_connect++;
+            if (!conn->reply_ready) {
+                connect_expire(key->s, conn);
+                // enviar la respuesta queda a cargo del plazo de inactividad
+                conn->phase = PHASE_IDLE;
+                if (timeouts.idle != 0) {
+                    selector_timer_add(key->s, &conn->timer, timeouts.idle);
+                }
+                return;
+            }
+            break;
+        default:
+            m->timeouts_idle++;
+            break;
     }
+    socks5_close(key);
 }
 
-static void socks5_write(struct selector_key *key) {
+// ============================================================================
+// DESPACHO DE EVENTOS
+// ============================================================================
+
+typedef unsigned (*stm_handler)(struct state_machine *stm, struct selector_key *key);
+
+static void socks5_dispatch(struct selector_key *key, stm_handler handler) {
     struct socks5_conn *conn = key->data;
     if (conn == NULL || conn->closed) {
         return;
     }
 
-    unsigned st = C_ERROR;
+    unsigned prev, st;
     if (is_client_fd(conn, key->fd)) {
-        st = stm_handler_write(&conn->client_stm, key);
+        prev = stm_state(&conn->client_stm);
+        st = handler(&conn->client_stm, key);
         if (client_terminal(st)) {
             socks5_close(key);
+            return;
         }
-    } else if (is_origin_fd(conn, key->fd)) {
-        st = stm_handler_write(&conn->origin_stm, key);
+    } else if (is_origin_fd(conn, key->fd) || connect_is_attempt(conn, key->fd)) {
+        // mientras se conecta el origin son los intentos en vuelo
+        prev = stm_state(&conn->origin_stm);
+        st = handler(&conn->origin_stm, key);
         if (origin_terminal(st)) {
             socks5_close(key);
+            return;
         }
+    } else {
+        return;
+    }
+
+    // En edge-triggered un cambio de estado puede dejar al fd esperando un
+    // evento que ya ocurrió (el estado anterior no lo consumió): se pide que
+    // vuelva a notificarse. En level-triggered selector_rearm no hace nada.
+    if (prev != st) {
+        selector_rearm(key->s, key->fd);
     }
+    socks5_update_timeout(key->s, conn);
+}
+
+static void socks5_read(struct selector_key *key) {
+    socks5_dispatch(key, stm_handler_read);
+}
+
+static void socks5_write(struct selector_key *key) {
+    socks5_dispatch(key, stm_handler_write);
 }
 
 static void socks5_block(struct selector_key *key) {
+    socks5_dispatch(key, stm_handler_block);
+}
+
+// Solo el túnel pide OP_ERROR (notificaciones de MSG_ZEROCOPY)
+static void socks5_error(struct selector_key *key) {
     struct socks5_conn *conn = key->data;
     if (conn == NULL || conn->closed) {
         return;
     }
-
-    unsigned st = C_ERROR;
-    if (is_client_fd(conn, key->fd)) {
-        st = stm_handler_block(&conn->client_stm, key);
-        if (client_terminal(st)) {
-            socks5_close(key);
-        }
-    } else if (is_origin_fd(conn, key->fd)) {
-        st = stm_handler_block(&conn->origin_stm, key);
-        if (origin_terminal(st)) {
-            socks5_close(key);
-        }
+    if (tunnel_error_queue(key) != TUNNEL_STAY) {
+        socks5_close(key);
     }
 }
 
@@ -299,18 +413,23 @@ static void socks5_close(struct selector_key *key) {
     }
 
     conn->closed = true;
+    selector_timer_cancel(key->s, &conn->timer);
+    selector_timer_cancel(key->s, &conn->buffer_timer);
+    selector_timer_cancel(key->s, &conn->park_timer);
+    selector_timer_cancel(key->s, &conn->throttle_timer);
+    selector_timer_cancel(key->s, &conn->flow_timer);
 
-    if (conn->addrinfo_list != NULL) {
-        freeaddrinfo(conn->addrinfo_list);
-        conn->addrinfo_list = NULL;
-        conn->addrinfo_current = NULL;
-    }
+    connect_abort(key->s, conn);
 
-    struct socks5_metrics *m = metrics_get();
-    if (m->current_connections > 0) {
-        m->current_connections--;
+    // si se corta durante el saludo no se pasa por on_departure
+    if (stm_state(&conn->client_stm) == C_HELLO_READ) {
+        hello_close(&conn->client.hello.parser);
     }
 
+    metrics_connection_closed();
+    // antes de tomar los fds: puede quedarse con el del cliente (zerocopy)
+    tunnel_release(conn, key->s);
+
     const int cfd = conn->client_fd;
     const int ofd = conn->origin_fd;
 
@@ -326,14 +445,16 @@ static void socks5_close(struct selector_key *key) {
         close(cfd);
     }
 
-    free(conn);
+    pool_put(conns, conn);
     key->data = NULL;
 }
 
 static const struct fd_handler socks5_handler = {
+    .name         = "socks5",
     .handle_read  = socks5_read,
     .handle_write = socks5_write,
     .handle_block = socks5_block,
+    .handle_error = socks5_error,
     .handle_close = NULL,
 };
 
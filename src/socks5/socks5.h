@@ -17,6 +17,9 @@
 #include "../auth/auth.h"
 #include "../request/request.h"
 #include "../tunnel/tunnel.h"
+#include "../connect/connect.h"
+#include "../helpers/ratelimit.h"
+#include "../helpers/flows.h"
 #include "../helpers/pop3_sniffer.h"
 #include "../helpers/http_sniffer.h"
 
@@ -43,7 +46,29 @@ enum origin_state {
     O_ERROR,
 };
 
-#define SOCKS5_BUFFER_SIZE 4096                 //TODO: ajustar tamaño según corresponda
+#define SOCKS5_BUFFER_SIZE 4096                 // solo negociación; el túnel usa buffers adaptativos
+
+// ============================================================================
+// PLAZOS
+// ============================================================================
+
+// Etapas de una conexión, cada una con su propio plazo
+enum socks5_phase {
+    PHASE_HANDSHAKE,    // hello, auth y request
+    PHASE_CONNECT,      // resolución y conexión al origin
+    PHASE_IDLE,         // túnel sin tráfico
+};
+
+// Plazos en milisegundos. 0 desactiva el plazo.
+struct socks5_timeouts {
+    unsigned long handshake;
+    unsigned long connect;
+    unsigned long idle;
+};
+
+#define SOCKS5_DEFAULT_HANDSHAKE_TIMEOUT    (10 * 1000UL)
+#define SOCKS5_DEFAULT_CONNECT_TIMEOUT      (10 * 1000UL)
+#define SOCKS5_DEFAULT_IDLE_TIMEOUT         (300 * 1000UL)
 
 // ============================================================================
 // DEFINICION DE VARIABLES POR ESTADO (las estructuras están en sus módulos)
@@ -82,11 +107,9 @@ struct socks5_conn {
     bool reply_ready;
     bool reply_sent;
 
-    buffer client_to_origin_buf;
-    uint8_t client_to_origin_raw[4096];
-
-    buffer origin_to_client_buf;
-    uint8_t origin_to_client_raw[4096];
+    // buffers del túnel: se piden al activarlo (ver tunnel_buffers_init)
+    struct ring client_to_origin_buf;
+    struct ring origin_to_client_buf;
 
     bool client_read_closed;
     bool origin_read_closed;
@@ -102,22 +125,51 @@ struct socks5_conn {
 
     struct data_channel chan_c2o;
     struct data_channel chan_o2c;
+    struct io_budget client_budget;
+    struct io_budget origin_budget;
 
     enum { PROTO_NONE, PROTO_HTTP, PROTO_POP3 } sniff_protocol;
     struct pop3_sniffer pop3_state;
     struct http_sniffer http_state;
     bool credentials_logged;
 
-    // DNS fallback: lista de direcciones pendientes de probar
-    struct addrinfo *addrinfo_list;      // lista completa (para liberar)
-    struct addrinfo *addrinfo_current;   // siguiente dirección a probar
+    // direcciones del destino (para liberar) y los intentos de conexión
+    struct addrinfo *addrinfo_list;
+    struct connect_st connect;
+
+    // plazo de la etapa actual (ver socks5_update_timeout)
+    enum socks5_phase phase;
+    struct selector_timer timer;
+    // achique periódico de los buffers del túnel
+    struct selector_timer buffer_timer;
+    // devolución de los buffers de un túnel inactivo
+    struct selector_timer park_timer;
+    // límites de ancho de banda y espera de tokens
+    struct ratelimit ratelimit;
+    struct selector_timer throttle_timer;
+    // muestreo de TCP_INFO (ver flows.h); flow_id -1 si el túnel no está
+    // publicado en la tabla del reactor
+    int flow_id;
+    struct flow_leg flow_client;
+    struct flow_leg flow_origin;
+    struct selector_timer flow_timer;
 };
 
 
+// Reserva `prealloc' conexiones de antemano. Llamar antes de socks5_new
+bool socks5_pool_init(size_t prealloc);
+void socks5_pool_close(void);
+
 struct socks5_conn *socks5_new(int client_fd);
 
 void socks5_destroy(struct socks5_conn *conn);
 
 const struct fd_handler *socks5_get_handler(void);
 
+// Configura los plazos de las conexiones nuevas
+void socks5_set_timeouts(const struct socks5_timeouts *t);
+
+// Arranca el plazo de handshake de una conexión recién registrada
+void socks5_start_timeout(struct socks5_conn *conn, fd_selector s);
+
 #endif
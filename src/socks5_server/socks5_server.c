@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // pthread_setaffinity_np, CPU_SET
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -5,10 +6,15 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -17,14 +23,41 @@
 #include "../resolver/resolver.h"
 #include "../args/args.h"
 #include "../auth/auth.h"
+#include "../helpers/metrics.h"
+#include "../tunnel/tunnel.h"
+#include "../helpers/parser.h"
+#include "../helpers/ratelimit.h"
+#include "../helpers/flows.h"
+#include "../connect/connect.h"
 
 #define SOCKS5_DEFAULT_PORT 1080
 #define SOCKS5_BUFFER_SIZE  4096
+#define RESOLVER_THREADS_PER_REACTOR 2
 
 // Variable global para señal de terminación
 static volatile sig_atomic_t server_should_stop = 0;
 static fd_selector global_selector = NULL;
 
+/**
+ * Un reactor es un thread con su propio selector, su propio socket SOCKS
+ * (SO_REUSEPORT reparte las conexiones entrantes entre todos) y su copia de
+ * las métricas. Las conexiones nunca cambian de reactor. El reactor 0 corre
+ * en el thread principal y además atiende el monitor.
+ */
+struct reactor {
+    unsigned    id;
+    fd_selector selector;
+    int         server_fd;
+    /** CPU al que se fija el thread. -1: sin afinidad */
+    int         cpu;
+    pthread_t   thread;
+    atomic_bool stop;
+    /** despierta al selector para que vea `stop' */
+    struct selector_completion wakeup;
+};
+
+static struct reactor reactors[METRICS_MAX_REACTORS];
+
 struct echo_conn {
     int     fd;
     buffer  read_buf;
@@ -39,6 +72,7 @@ static void echo_write   (struct selector_key *key);
 static void echo_close   (struct selector_key *key);
 
 static const struct fd_handler acceptor_handler = {
+    .name          = "acceptor",
     .handle_read   = accept_handler,
     .handle_write  = NULL,
     .handle_block  = NULL,
@@ -46,6 +80,7 @@ static const struct fd_handler acceptor_handler = {
 };
 
 static const struct fd_handler echo_handler = {
+    .name          = "echo",
     .handle_read   = echo_read,
     .handle_write  = echo_write,
     .handle_block  = NULL,
@@ -57,7 +92,9 @@ static void fatal_connection_error(struct selector_key *key, const char *msg) {
     selector_unregister_fd(key->s, key->fd);
 }
 
-static void accept_handler(struct selector_key *key) {
+// Acepta una conexión pendiente. Retorna false cuando no quedan más (o ante
+// un error del accept) para cortar el drenado del listener.
+static bool accept_one(struct selector_key *key) {
     int server_fd = key->fd;
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
@@ -67,13 +104,13 @@ static void accept_handler(struct selector_key *key) {
         if (errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("accept");
         }
-        return;
+        return false;
     }
 
     if (selector_fd_set_nio(client_fd) == -1) {
         perror("selector_fd_set_nio (client)");
         close(client_fd);
-        return;
+        return true;
     }
 
     // ESTO ES DEL ECHO-SERVER
@@ -109,7 +146,7 @@ static void accept_handler(struct selector_key *key) {
     if (conn == NULL) {
         perror("socks5_new");
         close(client_fd);
-        return;
+        return true;
     }
 
     const struct fd_handler *h = socks5_get_handler();
@@ -120,9 +157,17 @@ static void accept_handler(struct selector_key *key) {
                 selector_error(st));
         socks5_destroy(conn);
         close(client_fd);
-        return;
+        return true;
     }
+    socks5_start_timeout(conn, key->s);
+    return true;
+}
 
+static void accept_handler(struct selector_key *key) {
+    // en edge-triggered solo hay aviso cuando llega una conexión nueva: hay
+    // que vaciar la cola de accept hasta EAGAIN
+    while (accept_one(key) && selector_is_edge_triggered(key->s)) {
+    }
 }
 
 static void echo_read(struct selector_key *key) {
@@ -227,12 +272,249 @@ static int setup_signal_handlers(void) {
     return 0;
 }
 
+// select(2) no puede pasar de FD_SETSIZE, pero con epoll(7) o io_uring el único
+// techo es RLIMIT_NOFILE: lo llevamos al máximo permitido.
+static void raise_nofile_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+        perror("getrlimit RLIMIT_NOFILE");
+        return;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+            perror("setrlimit RLIMIT_NOFILE");
+        }
+    }
+}
+
+// Crea el socket pasivo del proxy. Con varios reactores cada uno tiene el
+// suyo sobre la misma dirección y el kernel reparte las conexiones.
+static int socks_listen(const struct socks5args *args, bool reuseport) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%u", args->socks_port);
+
+    int gai_err = getaddrinfo(args->socks_addr, port_str, &hints, &res);
+    if (gai_err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai_err));
+        return -1;
+    }
+
+    int server_fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (server_fd == -1) {
+        perror("socket");
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEADDR");
+        goto fail;
+    }
+    if (reuseport
+        && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt SO_REUSEPORT");
+        goto fail;
+    }
+
+    if (bind(server_fd, res->ai_addr, res->ai_addrlen) == -1) {
+        perror("bind");
+        goto fail;
+    }
+    freeaddrinfo(res);
+    res = NULL;
+
+    // el hello puede venir en el SYN (TFO) y accept no avisa hasta que llega
+    // (TCP_DEFER_ACCEPT): un RTT y un despertar menos por cliente
+    if (args->listen_fastopen > 0
+        && setsockopt(server_fd, IPPROTO_TCP, TCP_FASTOPEN, &args->listen_fastopen,
+                      sizeof(args->listen_fastopen)) == -1) {
+        perror("setsockopt TCP_FASTOPEN");
+        goto fail;
+    }
+    if (args->defer_accept > 0
+        && setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &args->defer_accept,
+                      sizeof(args->defer_accept)) == -1) {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+        goto fail;
+    }
+
+    if (listen(server_fd, args->listen_backlog) == -1) {
+        perror("listen");
+        goto fail;
+    }
+
+    if (selector_fd_set_nio(server_fd) == -1) {
+        perror("selector_fd_set_nio (server)");
+        goto fail;
+    }
+    return server_fd;
+
+fail:
+    if (res != NULL) {
+        freeaddrinfo(res);
+    }
+    close(server_fd);
+    return -1;
+}
+
+// El n-ésimo CPU (módulo la cantidad) entre los que el proceso puede usar.
+static int nth_allowed_cpu(unsigned n) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    const int count = CPU_COUNT(&set);
+    if (count == 0) {
+        return -1;
+    }
+    int left = (int)(n % (unsigned)count);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set) && left-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+// Prepara el reactor desde el thread que lo va a correr o desde uno con la
+// misma máscara de señales (ver selector_new).
+static bool reactor_setup(struct reactor *r, unsigned id,
+                          const struct socks5args *args) {
+    memset(r, 0, sizeof(*r));
+    r->id  = id;
+    r->cpu = -1;
+    atomic_init(&r->stop, false);
+
+    r->server_fd = socks_listen(args, args->threads > 1);
+    if (r->server_fd == -1) {
+        return false;
+    }
+
+    r->selector = selector_new(1024);
+    if (r->selector == NULL) {
+        fprintf(stderr, "selector_new: no se pudo crear el selector (%s)\n",
+                selector_backend_name(args->backend));
+        close(r->server_fd);
+        return false;
+    }
+
+    selector_status st = selector_register(r->selector, r->server_fd,
+                                           &acceptor_handler, OP_READ, NULL);
+    if (st != SELECTOR_SUCCESS) {
+        fprintf(stderr, "selector_register (server): %s\n", selector_error(st));
+        selector_destroy(r->selector);
+        close(r->server_fd);
+        return false;
+    }
+    return true;
+}
+
+static void reactor_teardown(struct reactor *r) {
+    selector_destroy(r->selector);
+    close(r->server_fd);
+}
+
+static void reactor_pin(const struct reactor *r) {
+    if (r->cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(r->cpu, &set);
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        fprintf(stderr, "reactor %u: no se pudo fijar al CPU %d: %s\n",
+                r->id, r->cpu, strerror(err));
+    }
+}
+
+static void reactor_wakeup(struct selector_key *key, struct selector_completion *c) {
+    (void)key;
+    (void)c;
+}
+
+static void *reactor_run(void *arg) {
+    struct reactor *r = arg;
+    metrics_attach(r->id);
+    flows_attach(r->id);
+    reactor_pin(r);
+
+    while (!atomic_load(&r->stop)) {
+        selector_status st = selector_select(r->selector);
+        if (st != SELECTOR_SUCCESS) {
+            fprintf(stderr, "reactor %u: selector_select: %s\n",
+                    r->id, selector_error(st));
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Pide a los reactores auxiliares [1, n) que terminen y los espera. Sus
+// selectores siguen vivos hasta reactor_teardown.
+static void reactors_join(unsigned n) {
+    for (unsigned i = 1; i < n; i++) {
+        struct reactor *r = reactors + i;
+        atomic_store(&r->stop, true);
+        r->wakeup.fd       = -1;
+        r->wakeup.callback = reactor_wakeup;
+        selector_notify_completion(r->selector, &r->wakeup);
+        pthread_join(r->thread, NULL);
+    }
+}
+
+// Libera los pools de conexiones, parsers y buffers de túnel. Llamar con todos los reactores
+// ya destruidos: al destruirse cierran las conexiones que les quedaban.
+static void pools_close(void) {
+    socks5_pool_close();
+    parser_pool_close();
+    tunnel_buffers_close();
+}
+
 int socks5_server_main(int argc, char *argv[]) {
     struct socks5args args;
     parse_args(argc, argv, &args);
 
     auth_set_users(args.users, MAX_USERS);
 
+    const struct socks5_timeouts timeouts = {
+        .handshake = args.handshake_timeout * 1000UL,
+        .connect   = args.connect_timeout * 1000UL,
+        .idle      = args.idle_timeout * 1000UL,
+    };
+    socks5_set_timeouts(&timeouts);
+    const struct connect_timing timing = {
+        .attempt_delay   = args.connect_delay,
+        .attempt_timeout = args.connect_attempt_timeout,
+        .budget          = args.connect_budget,
+    };
+    connect_set_timing(&timing);
+    connect_set_fastopen(args.origin_fastopen);
+
+    const struct tunnel_budget budget = {
+        .bytes = args.budget_bytes,
+        .ops   = args.budget_ops,
+    };
+    tunnel_set_budget(&budget);
+    tunnel_set_splice(args.splice);
+    tunnel_set_zerocopy(args.zerocopy ? args.zerocopy_min : 0);
+    tunnel_set_park(args.park_idle);
+    tunnel_set_notsent_lowat((unsigned)args.notsent_lowat);
+    flows_set_sockbuf_max(args.sockbuf_max);
+    ratelimit_set(RATELIMIT_GLOBAL, NULL, args.limit_global);
+    ratelimit_set(RATELIMIT_USER, NULL, args.limit_user);
+    ratelimit_set(RATELIMIT_CONN, NULL, args.limit_conn);
+
     // Configurar manejadores de señales
     if (setup_signal_handlers() == -1) {
         fprintf(stderr, "Error: no se pudieron configurar los manejadores de señales\n");
@@ -240,11 +522,14 @@ int socks5_server_main(int argc, char *argv[]) {
     }
 
     const struct selector_init conf = {
-        .signal = SIGALRM,
         .select_timeout = {
             .tv_sec  = 10,
             .tv_nsec = 0,
         },
+        .backend = args.backend,
+        .edge_triggered = args.edge_triggered,
+        .loop_stats = args.loop_stats,
+        .job_prealloc = args.pool_prealloc / 4,
     };
 
     selector_status st = selector_init(&conf);
@@ -253,93 +538,94 @@ int socks5_server_main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        perror("socket");
+    // los reactores aceptan conexiones apenas arrancan: los pools tienen que
+    // estar listos antes
+    if (!socks5_pool_init(args.pool_prealloc) || !parser_pool_init(args.pool_prealloc)
+        || !tunnel_buffers_init(args.pool_prealloc * 2, (size_t)args.buffer_memory << 20)) {
+        fprintf(stderr, "Error: no hay memoria para reservar %lu conexiones\n",
+                args.pool_prealloc);
+        pools_close();
         selector_close();
         return EXIT_FAILURE;
     }
 
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        perror("setsockopt SO_REUSEADDR");
-        close(server_fd);
-        selector_close();
-        return EXIT_FAILURE;
+    // los CPUs se eligen antes de fijar ningún thread: después la afinidad
+    // del thread principal ya no es la del proceso
+    int cpus[METRICS_MAX_REACTORS];
+    for (unsigned i = 0; i < args.threads; i++) {
+        cpus[i] = args.pin_cpus ? nth_allowed_cpu(i) : -1;
     }
 
-    struct addrinfo hints, *res;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-
-    char port_str[16];
-    snprintf(port_str, sizeof(port_str), "%u", args.socks_port);
-
-    int gai_err = getaddrinfo(args.socks_addr, port_str, &hints, &res);
-    if (gai_err != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(gai_err));
-        close(server_fd);
+    struct reactor *main_reactor = reactors;
+    if (!reactor_setup(main_reactor, 0, &args)) {
+        pools_close();
         selector_close();
         return EXIT_FAILURE;
     }
+    main_reactor->cpu = cpus[0];
+    fd_selector sel = main_reactor->selector;
 
-    if (bind(server_fd, res->ai_addr, res->ai_addrlen) == -1) {
-        perror("bind");
-        freeaddrinfo(res);
-        close(server_fd);
-        selector_close();
-        return EXIT_FAILURE;
+    if (selector_get_backend(sel) != SELECTOR_BACKEND_PSELECT) {
+        raise_nofile_limit();
     }
-
-    freeaddrinfo(res);
-
-    if (listen(server_fd, 20) == -1) {
-        perror("listen");
-        close(server_fd);
-        selector_close();
-        return EXIT_FAILURE;
+    printf("Selector: %s (%s)\n", selector_backend_name(selector_get_backend(sel)),
+           selector_is_edge_triggered(sel) ? "edge-triggered" : "level-triggered");
+    monitor_add_reactor(sel);
+
+    // SIGINT/SIGTERM las atiende solo el thread principal: los threads
+    // del resolver y los reactores auxiliares (y sus selectores) nacen con
+    // ellas bloqueadas
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+    // Inicializar el subsistema de resolución DNS asíncrona. Como todo
+    // estado global, antes de que arranque cualquier reactor: desde ahí ya
+    // se aceptan pedidos
+    int resolver_threads = RESOLVER_THREADS_PER_REACTOR * (int)args.threads;
+    if (resolver_threads > RESOLVER_MAX_THREADS) {
+        resolver_threads = RESOLVER_MAX_THREADS;
     }
-
-    if (selector_fd_set_nio(server_fd) == -1) {
-        perror("selector_fd_set_nio (server)");
-        close(server_fd);
-        selector_close();
-        return EXIT_FAILURE;
+    if (!resolver_init(resolver_threads, args.pool_prealloc / 4)) {
+        fprintf(stderr, "Advertencia: no se pudo inicializar el resolver asíncrono\n");
+        fprintf(stderr, "Las resoluciones DNS podrían fallar.\n");
+    } else {
+        printf("Resolver DNS asíncrono inicializado (%d threads)\n", resolver_threads);
     }
 
-    fd_selector sel = selector_new(1024);
-    if (sel == NULL) {
-        fprintf(stderr, "selector_new: sin memoria\n");
-        close(server_fd);
-        selector_close();
-        return EXIT_FAILURE;
+    unsigned started = 1;
+    for (; started < args.threads; started++) {
+        struct reactor *r = reactors + started;
+        if (!reactor_setup(r, started, &args)) {
+            break;
+        }
+        r->cpu = cpus[started];
+        monitor_add_reactor(r->selector);
+        const int err = pthread_create(&r->thread, NULL, reactor_run, r);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            reactor_teardown(r);
+            break;
+        }
     }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
-    st = selector_register(sel, server_fd, &acceptor_handler, OP_READ, NULL);
-    if (st != SELECTOR_SUCCESS) {
-        fprintf(stderr, "selector_register (server): %s\n", selector_error(st));
-        selector_destroy(sel);
-        close(server_fd);
+    if (started < args.threads) {
+        reactors_join(started);
+        resolver_destroy();
+        for (unsigned i = 0; i < started; i++) {
+            reactor_teardown(reactors + i);
+        }
+        pools_close();
         selector_close();
         return EXIT_FAILURE;
     }
 
-    printf("SOCKS5 proxy escuchando en %s:%u\n", args.socks_addr, args.socks_port);
-
-    // Inicializar el subsistema de resolución DNS asíncrona
-    if (!resolver_init(2)) {
-        fprintf(stderr, "Advertencia: no se pudo inicializar el resolver asíncrono\n");
-        fprintf(stderr, "Las resoluciones DNS podrían fallar.\n");
-    } else {
-        if (!resolver_register_notification_fd(sel)) {
-            fprintf(stderr, "Advertencia: no se pudo registrar el resolver en el selector\n");
-            resolver_destroy();
-        } else {
-            printf("Resolver DNS asíncrono inicializado (2 threads)\n");
-        }
-    }
+    printf("SOCKS5 proxy escuchando en %s:%u (%u reactor%s%s)\n",
+           args.socks_addr, args.socks_port, args.threads,
+           args.threads == 1 ? "" : "es", args.pin_cpus ? ", fijados a CPUs" : "");
 
     char mng_port_str[16];
     snprintf(mng_port_str, sizeof(mng_port_str), "%u", args.mng_port);
@@ -354,6 +640,9 @@ int socks5_server_main(int argc, char *argv[]) {
 
     printf("Servidor SOCKS5 escuchando. Presione Ctrl-C para detener.\n");
 
+    metrics_attach(0);
+    flows_attach(0);
+    reactor_pin(main_reactor);
     while (!server_should_stop) {
         st = selector_select(sel);
         if (st != SELECTOR_SUCCESS) {
@@ -366,12 +655,16 @@ int socks5_server_main(int argc, char *argv[]) {
 
     printf("\nCerrando servidor...\n");
 
-    // Limpieza ordenada
+    // Limpieza ordenada: los resolvers pueden notificar a cualquier
+    // selector, así que se destruyen antes que ellos
     global_selector = NULL;
+    reactors_join(args.threads);
     resolver_destroy();
-    selector_destroy(sel);
+    for (unsigned i = 0; i < args.threads; i++) {
+        reactor_teardown(reactors + i);
+    }
+    pools_close();
     selector_close();
-    close(server_fd);
 
     printf("Servidor cerrado correctamente.\n");
 
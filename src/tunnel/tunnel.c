@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // splice(2), pipe2(2), F_GETPIPE_SZ
 #include "tunnel.h"
 #include "../socks5/socks5.h"
 #include "../request/request.h"
@@ -7,17 +8,51 @@
 #include "../helpers/credentials_log.h"
 #include "../helpers/pop3_sniffer.h"
 #include "../helpers/http_sniffer.h"
+#include "../helpers/pool.h"
+#include "../helpers/ratelimit.h"
+#include "../helpers/flows.h"
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/errqueue.h>
 
 // ============================================================================
 // FUNCIONES AUXILIARES DE REPLY
 // ============================================================================
 
+// Destino pedido por el cliente, sin el puerto
+static void request_dest(const struct socks5_conn *conn, char *dst, size_t size) {
+    if (conn->req_atyp == 0x01) {
+        // IPv4
+        snprintf(dst, size, "%u.%u.%u.%u",
+                 conn->req_addr[0], conn->req_addr[1],
+                 conn->req_addr[2], conn->req_addr[3]);
+    } else if (conn->req_atyp == 0x03) {
+        // DOMAINNAME - req_addr ya contiene el nombre sin prefijo de longitud
+        size_t len = conn->req_addr_len;
+        if (len > size - 1) len = size - 1;
+        memcpy(dst, conn->req_addr, len);
+        dst[len] = '\0';
+    } else if (conn->req_atyp == 0x04) {
+        // IPv6
+        inet_ntop(AF_INET6, conn->req_addr, dst, size);
+    } else {
+        snprintf(dst, size, "unknown");
+    }
+}
+
 void client_set_reply(struct socks5_conn *conn, uint8_t rep, uint8_t atyp, const uint8_t *addr, uint16_t port) {
     conn->reply_code = rep;
     
@@ -54,23 +89,7 @@ void client_set_reply(struct socks5_conn *conn, uint8_t rep, uint8_t atyp, const
         }
 
         char dst[512];
-        if (conn->req_atyp == 0x01) {
-            // IPv4
-            snprintf(dst, sizeof(dst), "%u.%u.%u.%u",
-                     conn->req_addr[0], conn->req_addr[1],
-                     conn->req_addr[2], conn->req_addr[3]);
-        } else if (conn->req_atyp == 0x03) {
-            // DOMAINNAME - req_addr ya contiene el nombre sin prefijo de longitud
-            uint8_t len = conn->req_addr_len;
-            if (len > sizeof(dst) - 1) len = sizeof(dst) - 1;
-            memcpy(dst, conn->req_addr, len);
-            dst[len] = '\0';
-        } else if (conn->req_atyp == 0x04) {
-            // IPv6
-            inet_ntop(AF_INET6, conn->req_addr, dst, sizeof(dst));
-        } else {
-            snprintf(dst, sizeof(dst), "unknown");
-        }
+        request_dest(conn, dst, sizeof(dst));
 
         access_log_record(
             conn->username,
@@ -120,184 +139,1236 @@ void client_build_reply(struct socks5_conn *conn) {
 // FUNCIONES AUXILIARES DE CANAL
 // ============================================================================
 
-enum tunnel_status channel_read(struct selector_key *key, struct data_channel *ch, bool *read_closed_flag) {
-    (void)key;
-    if (!ch->read_enabled || *ch->src_fd == -1 || ch->dst_buffer == NULL) {
-        return TUNNEL_STAY;
+static void channel_sniff(struct socks5_conn *conn, const uint8_t *data, size_t n) {
+    if (conn->sniff_protocol == PROTO_NONE || conn->credentials_logged) {
+        return;
     }
 
-    size_t space;
-    uint8_t *write_ptr = buffer_write_ptr(ch->dst_buffer, &space);
-    if (space == 0) {
-        return TUNNEL_STAY;
+    bool captured = false;
+
+    if (conn->sniff_protocol == PROTO_POP3) {
+        captured = pop3_sniffer_process(&conn->pop3_state, data, n);
+    } else if (conn->sniff_protocol == PROTO_HTTP) {
+        captured = http_sniffer_process(&conn->http_state, data, n);
     }
 
-    const ssize_t n = recv(*ch->src_fd, write_ptr, space, 0);
-    if (n == 0) {
-        ch->read_enabled = false;
-        if (read_closed_flag != NULL) {
-            *read_closed_flag = true;
+    if (!captured) {
+        return;
+    }
+
+    char src_ip[128] = "unknown";
+    struct sockaddr_storage client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    if (getpeername(conn->client_fd, (struct sockaddr *)&client_addr, &addr_len) == 0) {
+        if (client_addr.ss_family == AF_INET) {
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&client_addr)->sin_addr, src_ip, sizeof(src_ip));
+        } else if (client_addr.ss_family == AF_INET6) {
+            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&client_addr)->sin6_addr, src_ip, sizeof(src_ip));
         }
-        shutdown(*ch->src_fd, SHUT_RD);
-        
-        if (!buffer_can_read(ch->dst_buffer) && *ch->dst_fd != -1) {
-            shutdown(*ch->dst_fd, SHUT_WR);
+    }
+
+    char dst[512];
+    request_dest(conn, dst, sizeof(dst));
+
+    char username[256] = "";
+    char password[256] = "";
+
+    if (conn->sniff_protocol == PROTO_POP3) {
+        pop3_sniffer_get_credentials(&conn->pop3_state, username, password);
+        credentials_log_record("POP3", src_ip, dst, conn->req_port, username, password);
+    } else if (conn->sniff_protocol == PROTO_HTTP) {
+        http_sniffer_get_credentials(&conn->http_state, username, password);
+        credentials_log_record("HTTP", src_ip, dst, conn->req_port, username, password);
+    }
+
+    conn->credentials_logged = true;
+}
+
+static struct tunnel_budget budget = {
+    .bytes = TUNNEL_DEFAULT_BUDGET_BYTES,
+    .ops   = TUNNEL_DEFAULT_BUDGET_OPS,
+};
+
+void tunnel_set_budget(const struct tunnel_budget *b) {
+    budget = *b;
+}
+
+// Verifica si el fd todavía tiene presupuesto en esta iteración. Si no, lo
+// vuelve a encolar: en level-triggered el selector lo reporta de nuevo por
+// sí solo, en edge-triggered hay que pedir que se reevalúe su estado.
+static bool budget_exhausted(struct selector_key *key, struct io_budget *b, int fd) {
+    if (b == NULL) {
+        return false;
+    }
+
+    const uint64_t iteration = selector_iteration(key->s);
+    if (b->iteration != iteration) {
+        b->iteration = iteration;
+        b->bytes = 0;
+        b->ops = 0;
+        return false;
+    }
+
+    struct socks5_metrics *m = metrics_get();
+    if (budget.bytes != 0 && b->bytes >= budget.bytes) {
+        m->budget_bytes_exhausted++;
+    } else if (budget.ops != 0 && b->ops >= budget.ops) {
+        m->budget_ops_exhausted++;
+    } else {
+        return false;
+    }
+    selector_rearm(key->s, fd);
+    return true;
+}
+
+static void budget_charge(struct io_budget *b, size_t n) {
+    if (b != NULL) {
+        b->bytes += n;
+        b->ops++;
+    }
+}
+
+// En level-triggered cada handler hace una sola lectura o escritura por
+// socket (ver channel_keep_going) y el selector ya reparte los turnos: el
+// presupuesto no frenaría nada y solo costaría contarlo.
+static void tunnel_budget_setup(struct socks5_conn *conn, fd_selector s) {
+    if (selector_is_edge_triggered(s)) {
+        return;
+    }
+    conn->chan_c2o.src_budget = conn->chan_c2o.dst_budget = NULL;
+    conn->chan_o2c.src_budget = conn->chan_o2c.dst_budget = NULL;
+}
+
+// ============================================================================
+// BUFFERS ADAPTATIVOS
+// ============================================================================
+
+// un pool por clase de tamaño, compartidos por todos los reactores
+static struct pool *buffer_pools[TUNNEL_BUFFER_CLASSES];
+static const char *buffer_pool_names[TUNNEL_BUFFER_CLASSES] = {
+    "buffer_4k", "buffer_16k", "buffer_64k", "buffer_256k",
+};
+
+// bytes de buffers en uso y el máximo permitido
+static atomic_size_t buffer_memory;
+/** túneles con los buffers de las dos direcciones devueltos (ver PARKING) */
+static atomic_size_t buffer_parked;
+static size_t buffer_memory_max;
+// clases a las que puede crecer un canal (ver tunnel_set_buffer_max)
+static unsigned buffer_classes = TUNNEL_BUFFER_CLASSES;
+
+// Buffers de canales cortados con RST sin pasar por un drain (sin selector o
+// sin memoria, ver tunnel_release). Sus bytes vuelven al presupuesto de
+// --buffer-memory en el acto; el bloque, recién cuando pasó
+// TUNNEL_ZEROCOPY_QUARANTINE_MS, en la próxima lectura de una cola de
+// errores o el próximo cierre de túnel de cualquier reactor.
+struct zerocopy_orphan {
+    struct zerocopy_orphan *next;
+    uint8_t *data;
+    unsigned size_class;
+    uint64_t since_ms;
+};
+
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zerocopy_orphan *orphans;
+static atomic_bool orphans_pending;
+
+static size_t class_size(unsigned c) {
+    return (size_t)TUNNEL_BUFFER_MIN << (2 * c);
+}
+
+bool tunnel_buffers_init(size_t prealloc, size_t memory_max) {
+    buffer_memory_max = memory_max;
+    for (unsigned c = 0; c < TUNNEL_BUFFER_CLASSES; c++) {
+        if (buffer_pools[c] == NULL) {
+            buffer_pools[c] = pool_new(buffer_pool_names[c], class_size(c), c == 0 ? prealloc : 0);
+            if (buffer_pools[c] == NULL) {
+                return false;
+            }
         }
-        
-        return TUNNEL_STAY;
     }
+    return true;
+}
 
-    if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return TUNNEL_STAY;
+void tunnel_set_buffer_max(size_t bytes) {
+    if (bytes == 0) {
+        buffer_classes = TUNNEL_BUFFER_CLASSES;
+        return;
+    }
+    buffer_classes = 1;
+    while (buffer_classes < TUNNEL_BUFFER_CLASSES && class_size(buffer_classes) <= bytes) {
+        buffer_classes++;
+    }
+}
+
+void tunnel_buffers_close(void) {
+    // los bloques de los huérfanos se van con los pools
+    pthread_mutex_lock(&orphans_lock);
+    while (orphans != NULL) {
+        struct zerocopy_orphan *o = orphans;
+        orphans = o->next;
+        free(o);
+    }
+    atomic_store_explicit(&orphans_pending, false, memory_order_relaxed);
+    pthread_mutex_unlock(&orphans_lock);
+    for (unsigned c = 0; c < TUNNEL_BUFFER_CLASSES; c++) {
+        pool_destroy(buffer_pools[c]);
+        buffer_pools[c] = NULL;
+    }
+}
+
+void tunnel_buffers_stats(struct tunnel_buffers_stats *out) {
+    out->memory     = atomic_load_explicit(&buffer_memory, memory_order_relaxed);
+    out->memory_max = buffer_memory_max;
+    out->parked     = atomic_load_explicit(&buffer_parked, memory_order_relaxed);
+    for (unsigned c = 0; c < TUNNEL_BUFFER_CLASSES; c++) {
+        struct pool_stats ps;
+        pool_get_stats(buffer_pools[c], &ps);
+        out->size[c]   = class_size(c);
+        out->in_use[c] = ps.in_use;
+    }
+}
+
+// La clase mínima siempre se concede (sin ella el túnel no puede andar); las
+// demás solo si entran en el presupuesto global
+static bool memory_reserve(size_t n, bool force) {
+    size_t cur = atomic_load_explicit(&buffer_memory, memory_order_relaxed);
+    do {
+        if (!force && cur + n > buffer_memory_max) {
+            return false;
         }
+    } while (!atomic_compare_exchange_weak_explicit(&buffer_memory, &cur, cur + n,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+
+static void memory_release(size_t n) {
+    atomic_fetch_sub_explicit(&buffer_memory, n, memory_order_relaxed);
+}
+
+// Cambia el buffer del canal por uno de la clase `c', conservando lo que
+// quedaba pendiente. Falla si no entra, si excede el presupuesto o si no hay
+// memoria; en ese caso el canal sigue con el buffer que tenía.
+static bool channel_resize(struct data_channel *ch, unsigned c) {
+    struct ring *r = ch->dst_buffer;
+    const size_t old_size = r->size;
+    const size_t size = class_size(c);
+    // lo retenido por MSG_ZEROCOPY no se puede mover
+    if (ring_len(r) > size || ring_held(r) > 0) {
+        return false;
+    }
+    if (size > old_size && !memory_reserve(size - old_size, old_size == 0 && c == 0)) {
+        return false;
+    }
+
+    uint8_t *data = pool_get(buffer_pools[c]);
+    if (data == NULL) {
+        if (size > old_size) {
+            memory_release(size - old_size);
+        }
+        return false;
+    }
+
+    size_t len = 0;
+    if (r->data != NULL) {
+        struct iovec iov[2];
+        const int iovcnt = ring_read_iov(r, iov);
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(data + len, iov[i].iov_base, iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+        pool_put(buffer_pools[ch->size_class], r->data);
+    }
+    ring_init(r, size, data);
+    ring_write_adv(r, len);
+    if (size < old_size) {
+        memory_release(old_size - size);
+    }
+    ch->size_class = (uint8_t)c;
+    return true;
+}
+
+// Devuelve el buffer del canal al pool (el canal ya no lo necesita)
+static void channel_buffer_release(struct data_channel *ch) {
+    struct ring *r = ch->dst_buffer;
+    if (r->data != NULL) {
+        pool_put(buffer_pools[ch->size_class], r->data);
+        memory_release(r->size);
+        ring_init(r, 0, NULL);
+    }
+    ch->size_class = 0;
+}
+
+// Cada TUNNEL_SHRINK_MS: una dirección que no llenó su buffer desde el tick
+// anterior baja una clase. El timer solo está armado mientras algún canal de
+// la conexión tenga un buffer más grande que el mínimo.
+static void tunnel_buffer_tick(struct selector_key *key, struct selector_timer *t) {
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+
+    struct socks5_metrics *m = metrics_get();
+    struct data_channel *channels[] = { &conn->chan_c2o, &conn->chan_o2c };
+    bool again = false;
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        struct data_channel *ch = channels[i];
+        if (!ch->filled && ch->size_class > 0 && ch->dst_buffer->data != NULL
+            && channel_resize(ch, ch->size_class - 1u)) {
+            m->buffer_shrinks++;
+        }
+        ch->filled = false;
+        again = again || ch->size_class > 0;
+    }
+    tunnel_update_interest(conn, key->s);
+    if (again) {
+        selector_timer_add(key->s, t, TUNNEL_SHRINK_MS);
+    }
+}
+
+// Una lectura llenó todo el lugar libre: si pasa TUNNEL_GROW_FILLS veces
+// seguidas el otro extremo no da abasto con el buffer actual
+static void channel_filled(struct selector_key *key, struct socks5_conn *conn, struct data_channel *ch) {
+    ch->filled = true;
+    if (++ch->fills < TUNNEL_GROW_FILLS || ch->size_class + 1u >= buffer_classes
+        || ring_held(ch->dst_buffer) > 0) {
+        return;
+    }
+    ch->fills = 0;
+
+    struct socks5_metrics *m = metrics_get();
+    if (!channel_resize(ch, ch->size_class + 1u)) {
+        m->buffer_grow_denied++;
+        return;
+    }
+    m->buffer_grows++;
+
+    if (!selector_timer_armed(&conn->buffer_timer)) {
+        conn->buffer_timer.fd = conn->client_fd;
+        conn->buffer_timer.handler = tunnel_buffer_tick;
+        selector_timer_add(key->s, &conn->buffer_timer, TUNNEL_SHRINK_MS);
+    }
+}
+
+// ============================================================================
+// SPLICE
+// ============================================================================
+
+static bool splice_enabled = false;
+
+void tunnel_set_splice(bool enabled) {
+    splice_enabled = enabled;
+}
+
+// Bytes del canal que todavía no llegaron al destino (en el buffer o en el pipe)
+static bool channel_has_pending(const struct data_channel *ch) {
+    return ring_can_read(ch->dst_buffer) || ch->pipe_len > 0;
+}
+
+// Un canal estacionado no tiene buffer, pero lo recupera al leer
+static bool channel_has_space(const struct data_channel *ch) {
+    if (ch->parked) {
+        return true;
+    }
+    if (ch->splicing) {
+        return !ch->pipe_full && ch->pipe_len < ch->pipe_cap;
+    }
+    return ring_can_write(ch->dst_buffer);
+}
+
+// Un canal pasa a splice(2) cuando nada de su tráfico tiene que verse en user
+// space: O2C nunca se inspecciona y C2O solo mientras el disector no terminó.
+// Se espera a que el buffer quede vacío para no reordenar bytes. Si no se
+// puede crear el pipe el canal sigue copiando.
+static bool channel_try_splice(const struct socks5_conn *conn, struct data_channel *ch) {
+    if (ch->splicing) {
+        return true;
+    }
+    if (!splice_enabled || ch->splice_failed || ring_can_read(ch->dst_buffer)
+        || ring_held(ch->dst_buffer) > 0) {
+        return false;
+    }
+    if (ch->direction == C2O && conn->sniff_protocol != PROTO_NONE && !conn->credentials_logged) {
+        return false;
+    }
+
+    if (pipe2(ch->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        ch->pipe[0] = ch->pipe[1] = -1;
+        ch->splice_failed = true;
+        return false;
+    }
+    const int cap = fcntl(ch->pipe[1], F_GETPIPE_SZ);
+    ch->pipe_cap = cap > 0 ? (size_t)cap : TUNNEL_PIPE_MIN_SIZE;
+    ch->pipe_len = 0;
+    ch->pipe_full = false;
+    ch->splicing = true;
+    // el buffer vacío ya no hace falta
+    channel_buffer_release(ch);
+    return true;
+}
+
+// ============================================================================
+// MSG_ZEROCOPY
+// ============================================================================
+
+static size_t zerocopy_min = 0;
+
+void tunnel_set_zerocopy(size_t min) {
+    zerocopy_min = min;
+}
+
+// El kernel todavía usa parte del buffer del canal
+static bool channel_pinned(const struct data_channel *ch) {
+    return ch->dst_buffer != NULL && ring_held(ch->dst_buffer) > 0;
+}
+
+// Solo la dirección origen→cliente, con bloques de al menos `zerocopy_min'
+// y mientras haya lugar para anotar el envío
+static bool channel_zerocopy(const struct data_channel *ch, size_t len) {
+    return ch->zerocopy && len >= zerocopy_min
+        && ch->zc_next - ch->zc_first < TUNNEL_ZEROCOPY_INFLIGHT;
+}
+
+// Registra `n' bytes enviados desde el buffer del canal. Mientras haya
+// envíos con MSG_ZEROCOPY en vuelo todo lo enviado queda retenido (lo
+// retenido tiene que ser contiguo) y se libera junto con el último de ellos.
+static void channel_sent(struct data_channel *ch, size_t n, bool zerocopy) {
+    if (zerocopy) {
+        ch->zc_sent[ch->zc_next % TUNNEL_ZEROCOPY_INFLIGHT] = n;
+        ch->zc_next++;
+        ring_hold_adv(ch->dst_buffer, n);
+
+        struct socks5_metrics *m = metrics_get();
+        m->zerocopy_sends++;
+        m->bytes_zerocopy += (uint64_t)n;
+    } else if (ch->zc_next != ch->zc_first) {
+        ch->zc_sent[(ch->zc_next - 1u) % TUNNEL_ZEROCOPY_INFLIGHT] += n;
+        ring_hold_adv(ch->dst_buffer, n);
+    } else {
+        ring_read_adv(ch->dst_buffer, n);
+    }
+}
+
+// El kernel terminó con los envíos hasta `hi' (inclusive). TCP los confirma
+// en orden, así que se libera desde el más antiguo.
+static void channel_zerocopy_done(struct data_channel *ch, uint32_t hi) {
+    while (ch->zc_first != ch->zc_next && (int32_t)(hi - ch->zc_first) >= 0) {
+        ring_release(ch->dst_buffer, ch->zc_sent[ch->zc_first % TUNNEL_ZEROCOPY_INFLIGHT]);
+        ch->zc_first++;
+    }
+}
+
+// Habilita MSG_ZEROCOPY en el socket del cliente. pselect(2) no avisa de la
+// cola de errores, así que con ese backend no se usa.
+static void tunnel_zerocopy_setup(struct socks5_conn *conn, fd_selector s) {
+    if (zerocopy_min == 0 || selector_get_backend(s) == SELECTOR_BACKEND_PSELECT) {
+        return;
+    }
+    const int one = 1;
+    conn->chan_o2c.zerocopy =
+        setsockopt(conn->client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+}
+
+// ============================================================================
+// TCP_NOTSENT_LOWAT
+// ============================================================================
+
+static unsigned notsent_lowat = 0;
+
+void tunnel_set_notsent_lowat(unsigned bytes) {
+    notsent_lowat = bytes;
+}
+
+// Con TCP_NOTSENT_LOWAT el kernel deja de aceptar datos (EAGAIN) y de
+// reportar OP_WRITE mientras el socket tenga al menos `notsent_lowat' bytes
+// sin enviar. Lo que no entra queda en el buffer del túnel, que al llenarse
+// frena la lectura del otro extremo. Si falla el socket sigue como antes.
+static void tunnel_lowat_setup(struct socks5_conn *conn) {
+    if (notsent_lowat == 0) {
+        return;
+    }
+    setsockopt(conn->client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat));
+    setsockopt(conn->origin_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat));
+}
+
+// Lee las notificaciones de MSG_ZEROCOPY de `fd' y libera lo que `ch' tenía
+// retenido. retorna false si falla la lectura.
+static bool channel_error_queue(struct data_channel *ch, int fd) {
+    struct socks5_metrics *m = metrics_get();
+
+    while (true) {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = {
+            .msg_control    = control,
+            .msg_controllen = sizeof(control),
+        };
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            return false;
+        }
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR)
+                  || (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err err;
+            memcpy(&err, CMSG_DATA(c), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // el kernel terminó copiando (p.ej. loopback): es más caro que
+                // un send común, así que el canal deja de pedirlo
+                m->zerocopy_copied += (uint64_t)(err.ee_data - err.ee_info) + 1;
+                ch->zerocopy = false;
+            }
+            channel_zerocopy_done(ch, err.ee_data);
+        }
+    }
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void orphans_reap(void) {
+    if (!atomic_load_explicit(&orphans_pending, memory_order_relaxed)) {
+        return;
+    }
+    const uint64_t now = now_ms();
+    pthread_mutex_lock(&orphans_lock);
+    struct zerocopy_orphan **p = &orphans;
+    while (*p != NULL) {
+        struct zerocopy_orphan *o = *p;
+        if (now - o->since_ms < TUNNEL_ZEROCOPY_QUARANTINE_MS) {
+            p = &o->next;
+            continue;
+        }
+        *p = o->next;
+        pool_put(buffer_pools[o->size_class], o->data);
+        free(o);
+    }
+    atomic_store_explicit(&orphans_pending, orphans != NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&orphans_lock);
+}
+
+// El canal suelta su buffer retenido por MSG_ZEROCOPY. Sin memoria para
+// anotarlo el bloque se pierde, pero igual sale de la cuenta.
+static void channel_orphan(struct data_channel *ch) {
+    struct ring *r = ch->dst_buffer;
+    metrics_get()->zerocopy_orphaned_bytes += (uint64_t)r->size;
+    memory_release(r->size);
+
+    struct zerocopy_orphan *o = malloc(sizeof(*o));
+    if (o != NULL) {
+        o->data = r->data;
+        o->size_class = ch->size_class;
+        o->since_ms = now_ms();
+        pthread_mutex_lock(&orphans_lock);
+        o->next = orphans;
+        orphans = o;
+        atomic_store_explicit(&orphans_pending, true, memory_order_relaxed);
+        pthread_mutex_unlock(&orphans_lock);
+    }
+    ring_init(r, 0, NULL);
+    ch->size_class = 0;
+}
+
+enum tunnel_status tunnel_error_queue(struct selector_key *key) {
+    orphans_reap();
+    struct socks5_conn *conn = key->data;
+    struct data_channel *ch = *conn->chan_o2c.dst_fd == key->fd ? &conn->chan_o2c : &conn->chan_c2o;
+    if (!channel_error_queue(ch, key->fd)) {
         return TUNNEL_ERROR;
     }
 
-    buffer_write_adv(ch->dst_buffer, (size_t)n);
-    ch->write_enabled = true;
+    // se liberó lugar: el origen pudo haber quedado listo sin otro aviso
+    if (*ch->src_fd != -1 && ch->read_enabled) {
+        selector_rearm(key->s, *ch->src_fd);
+    }
+    tunnel_update_interest(conn, key->s);
+    return tunnel_finished(conn) ? TUNNEL_DONE : TUNNEL_STAY;
+}
+
+// Un canal que se cierra con envíos MSG_ZEROCOPY sin confirmar no puede
+// devolver su buffer: el kernel todavía lee esas páginas (y las retransmite).
+// El socket de destino y el buffer pasan a un `zerocopy_drain', fuera del
+// selector, que cada TUNNEL_ZEROCOPY_DRAIN_TICK_MS lee la cola de errores;
+// cuando llegan todas las notificaciones cierra el socket y recién entonces
+// devuelve el buffer al pool. Si no llegan en TUNNEL_ZEROCOPY_DRAIN_MS (el
+// otro extremo no confirma) se corta con RST, que descarta lo encolado, y el
+// buffer espera TUNNEL_ZEROCOPY_QUARANTINE_MS más por los paquetes que el
+// driver todavía tenga en vuelo.
+struct zerocopy_drain {
+    int fd;
+    struct data_channel ch;
+    struct ring ring;
+    unsigned long waited;
+    bool reset;
+    struct selector_timer timer;
+};
+
+static void zerocopy_drain_tick(struct selector_key *key, struct selector_timer *t) {
+    struct zerocopy_drain *d = (struct zerocopy_drain *)((char *)t - offsetof(struct zerocopy_drain, timer));
+    orphans_reap();
+
+    if (!d->reset) {
+        const bool ok = channel_error_queue(&d->ch, d->fd);
+        if (ok && d->ch.zc_first == d->ch.zc_next) {
+            close(d->fd);
+            channel_buffer_release(&d->ch);
+            free(d);
+            return;
+        }
+        d->waited += TUNNEL_ZEROCOPY_DRAIN_TICK_MS;
+        if (ok && d->waited < TUNNEL_ZEROCOPY_DRAIN_MS) {
+            selector_timer_add(key->s, t, TUNNEL_ZEROCOPY_DRAIN_TICK_MS);
+            return;
+        }
+        const struct linger l = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(d->fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        close(d->fd);
+        d->reset = true;
+        metrics_get()->zerocopy_drain_resets++;
+        // el número de fd se puede reusar: el timer ya no lo consulta
+        selector_timer_add(key->s, t, TUNNEL_ZEROCOPY_QUARANTINE_MS);
+        return;
+    }
+    channel_buffer_release(&d->ch);
+    free(d);
+}
+
+// Pasa el socket de destino de `ch' y su buffer a un drain. retorna false si
+// no hay memoria para hacerlo.
+static bool channel_drain(fd_selector s, struct data_channel *ch) {
+    struct zerocopy_drain *d = malloc(sizeof(*d));
+    if (d == NULL) {
+        return false;
+    }
+    memset(d, 0, sizeof(*d));
+    d->fd = *ch->dst_fd;
+    d->ch = *ch;
+    d->ring = *ch->dst_buffer;
+    d->ch.dst_buffer = &d->ring;
+
+    // el canal queda sin buffer ni socket; el resto no se envía
+    ring_init(ch->dst_buffer, 0, NULL);
+    ch->size_class = 0;
+    ch->zc_first = ch->zc_next = 0;
+    selector_unregister_fd(s, d->fd);
+    *ch->dst_fd = -1;
+    shutdown(d->fd, SHUT_RD);
+
+    metrics_get()->zerocopy_drains++;
+    d->timer.fd = d->fd;
+    d->timer.handler = zerocopy_drain_tick;
+    selector_timer_add(s, &d->timer, TUNNEL_ZEROCOPY_DRAIN_TICK_MS);
+    return true;
+}
+
+void tunnel_release(struct socks5_conn *conn, fd_selector s) {
+    if (conn->chan_c2o.parked && conn->chan_o2c.parked) {
+        atomic_fetch_sub_explicit(&buffer_parked, 1, memory_order_relaxed);
+    }
+    struct data_channel *channels[] = { &conn->chan_c2o, &conn->chan_o2c };
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        struct data_channel *ch = channels[i];
+        if (channel_pinned(ch) && *ch->dst_fd != -1
+            && (s == NULL || !channel_drain(s, ch))) {
+            // sin drain: un RST descarta lo que el kernel tenga encolado y el
+            // buffer espera su cuarentena fuera del pool (ver channel_orphan)
+            const struct linger l = { .l_onoff = 1, .l_linger = 0 };
+            setsockopt(*ch->dst_fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+            channel_orphan(ch);
+        }
+        for (int j = 0; j < 2; j++) {
+            if (ch->pipe[j] != -1) {
+                close(ch->pipe[j]);
+                ch->pipe[j] = -1;
+            }
+        }
+        ch->splicing = false;
+        ch->pipe_len = 0;
+        ch->parked = false;
+        channel_buffer_release(ch);
+    }
+    flows_unregister(conn->flow_id);
+    conn->flow_id = -1;
+    ratelimit_detach(&conn->ratelimit);
+    orphans_reap();
+}
+
+// ============================================================================
+// MEDICIONES (TCP_INFO)
+// ============================================================================
+
+// Cada FLOWS_SAMPLE_MS se mide el túnel y, si hay tope configurado, se
+// agrandan los buffers de socket según el BDP (ver flows.h). Un túnel que no
+// movió datos desde la medición anterior conserva la que tiene: ni el RTT
+// ni el BDP cambian sin tráfico que los actualice.
+static void tunnel_flow_tick(struct selector_key *key, struct selector_timer *t) {
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+    if (conn->chan_c2o.sampled_active || conn->chan_o2c.sampled_active) {
+        conn->chan_c2o.sampled_active = conn->chan_o2c.sampled_active = false;
+        metrics_get()->sockbuf_grows += flows_sample(conn->flow_id,
+                                                     &conn->flow_client, conn->client_fd,
+                                                     &conn->flow_origin, conn->origin_fd);
+    }
+    selector_timer_add(key->s, t, FLOWS_SAMPLE_MS);
+}
+
+static void tunnel_flow_setup(struct socks5_conn *conn, fd_selector s) {
+    char dst[96];
+    char dest[sizeof(dst) + 8];
+    request_dest(conn, dst, sizeof(dst));
+    snprintf(dest, sizeof(dest), conn->req_atyp == 0x04 ? "[%s]:%u" : "%s:%u", dst, conn->req_port);
+
+    // fuera de la tabla no aparece en FLOWS, pero se mide igual
+    conn->flow_id = flows_register(conn->username, dest);
+    if (conn->flow_id == -1) {
+        metrics_get()->flows_untracked++;
+    }
+    conn->flow_timer.fd = conn->client_fd;
+    conn->flow_timer.handler = tunnel_flow_tick;
+    selector_timer_add(s, &conn->flow_timer, FLOWS_SAMPLE_MS);
+}
+
+// ============================================================================
+// PARKING
+// ============================================================================
+
+static unsigned long park_ms = TUNNEL_DEFAULT_PARK_MS;
+
+void tunnel_set_park(unsigned long ms) {
+    park_ms = ms;
+}
+
+// Cada `park_ms': si ninguna dirección movió datos desde el tick anterior y
+// no queda nada pendiente, los buffers vuelven a sus pools. Un túnel
+// inactivo ocupa así solo su estructura. El timer no se vuelve a armar
+// hasta que una lectura saque al túnel del estacionamiento.
+static void tunnel_park_tick(struct selector_key *key, struct selector_timer *t) {
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+
+    struct data_channel *channels[] = { &conn->chan_c2o, &conn->chan_o2c };
+    bool idle = true;
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        const struct data_channel *ch = channels[i];
+        idle = idle && !ch->active && !ch->throttled
+            && !channel_has_pending(ch) && !channel_pinned(ch);
+    }
+    if (!idle) {
+        conn->chan_c2o.active = conn->chan_o2c.active = false;
+        selector_timer_add(key->s, t, park_ms);
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        channel_buffer_release(channels[i]);
+        channels[i]->parked = true;
+        channels[i]->fills = 0;
+    }
+    atomic_fetch_add_explicit(&buffer_parked, 1, memory_order_relaxed);
+    metrics_get()->buffer_parks++;
+    // sin buffers no hay nada que achicar
+    selector_timer_cancel(key->s, &conn->buffer_timer);
+}
+
+static void tunnel_park_arm(struct socks5_conn *conn, fd_selector s) {
+    if (park_ms == 0 || selector_timer_armed(&conn->park_timer)) {
+        return;
+    }
+    conn->park_timer.fd = conn->client_fd;
+    conn->park_timer.handler = tunnel_park_tick;
+    selector_timer_add(s, &conn->park_timer, park_ms);
+}
+
+// Llegaron datos a un canal estacionado: vuelve a tomar un buffer mínimo.
+// La otra dirección lo recupera recién cuando le toque leer.
+static bool channel_unpark(struct selector_key *key, struct socks5_conn *conn, struct data_channel *ch) {
+    if (!ch->splicing && !channel_resize(ch, 0)) {
+        return false;
+    }
+    const struct data_channel *other = ch == &conn->chan_c2o ? &conn->chan_o2c : &conn->chan_c2o;
+    if (other->parked) {
+        atomic_fetch_sub_explicit(&buffer_parked, 1, memory_order_relaxed);
+        metrics_get()->buffer_unparks++;
+    }
+    ch->parked = false;
+    tunnel_park_arm(conn, key->s);
+    return true;
+}
+
+// ============================================================================
+// LÍMITES DE ANCHO DE BANDA
+// ============================================================================
 
+// Se vence la espera de tokens: los canales vuelven a leer. En edge-triggered
+// el origen pudo quedar listo sin otro aviso.
+static void tunnel_throttle_tick(struct selector_key *key, struct selector_timer *t) {
+    (void)t;
+    struct socks5_conn *conn = key->data;
+    if (key->fd == -1 || conn == NULL || conn->closed) {
+        return;
+    }
+
+    struct data_channel *channels[] = { &conn->chan_c2o, &conn->chan_o2c };
+    for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++) {
+        struct data_channel *ch = channels[i];
+        if (ch->throttled) {
+            ch->throttled = false;
+            if (*ch->src_fd != -1) {
+                selector_rearm(key->s, *ch->src_fd);
+            }
+        }
+    }
+    tunnel_update_interest(conn, key->s);
+}
+
+// Cuánto de `want' puede leer el canal según los límites. Sin tokens, el
+// canal deja de pedir OP_READ y se arma el timer de la conexión para cuando
+// vuelva a haber (en lugar de reintentar en cada vuelta del loop).
+static size_t channel_allow(struct selector_key *key, struct socks5_conn *conn,
+                            struct data_channel *ch, size_t want) {
+    unsigned long wait_ms = 0;
+    enum ratelimit_level level = RATELIMIT_CONN;
+    const size_t allow = ratelimit_allow(&conn->ratelimit, want, &wait_ms, &level);
+    if (allow > 0) {
+        return allow;
+    }
+
+    ch->throttled = true;
+    struct socks5_metrics *m = metrics_get();
+    m->throttle_events++;
+    switch (level) {
+        case RATELIMIT_GLOBAL:
+            m->throttled_ms_global += wait_ms;
+            break;
+        case RATELIMIT_USER:
+            m->throttled_ms_user += wait_ms;
+            break;
+        default:
+            m->throttled_ms_conn += wait_ms;
+            break;
+    }
+
+    if (!selector_timer_armed(&conn->throttle_timer)) {
+        conn->throttle_timer.fd = conn->client_fd;
+        conn->throttle_timer.handler = tunnel_throttle_tick;
+        selector_timer_add(key->s, &conn->throttle_timer, wait_ms);
+    }
+    return 0;
+}
+
+// En modo level-triggered se hace una sola operación por evento, como
+// siempre: si quedó algo el selector lo vuelve a reportar en la próxima
+// vuelta y los demás fds no esperan. En edge-triggered no habrá otro aviso
+// hasta que cambie el estado del socket, así que hay que llegar a EAGAIN.
+static bool channel_keep_going(struct selector_key *key) {
+    return selector_is_edge_triggered(key->s);
+}
+
+// El origen cerró su lado: se propaga el half-close cuando ya no queda nada
+// por entregar (si queda, lo hace channel_write al vaciar el canal)
+static void channel_read_closed(struct data_channel *ch, bool *read_closed_flag) {
+    ch->read_enabled = false;
+    if (read_closed_flag != NULL) {
+        *read_closed_flag = true;
+    }
+    shutdown(*ch->src_fd, SHUT_RD);
+
+    if (!channel_has_pending(ch) && *ch->dst_fd != -1) {
+        shutdown(*ch->dst_fd, SHUT_WR);
+    }
+}
+
+static void channel_count(struct data_channel *ch, size_t n) {
+    ch->active = true;
+    ch->sampled_active = true;
     struct socks5_metrics *m = metrics_get();
-    struct socks5_conn *conn = (struct socks5_conn *)key->data;
-    
     if (ch->direction == C2O) {
         m->bytes_client_to_origin += (uint64_t)n;
-        
-        if (conn->sniff_protocol != PROTO_NONE && !conn->credentials_logged) {
-            bool captured = false;
-            
-            if (conn->sniff_protocol == PROTO_POP3) {
-                captured = pop3_sniffer_process(&conn->pop3_state, write_ptr, (size_t)n);
-            } else if (conn->sniff_protocol == PROTO_HTTP) {
-                captured = http_sniffer_process(&conn->http_state, write_ptr, (size_t)n);
-            }
-            
-            if (captured) {
-                char src_ip[128] = "unknown";
-                struct sockaddr_storage client_addr;
-                socklen_t addr_len = sizeof(client_addr);
-                if (getpeername(conn->client_fd, (struct sockaddr *)&client_addr, &addr_len) == 0) {
-                    if (client_addr.ss_family == AF_INET) {
-                        inet_ntop(AF_INET, &((struct sockaddr_in *)&client_addr)->sin_addr, src_ip, sizeof(src_ip));
-                    } else if (client_addr.ss_family == AF_INET6) {
-                        inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&client_addr)->sin6_addr, src_ip, sizeof(src_ip));
-                    }
-                }
-                
-                char dst[512];
-                if (conn->req_atyp == 0x01) {
-                    snprintf(dst, sizeof(dst), "%u.%u.%u.%u",
-                             conn->req_addr[0], conn->req_addr[1],
-                             conn->req_addr[2], conn->req_addr[3]);
-                } else if (conn->req_atyp == 0x03) {
-                    uint8_t len = conn->req_addr_len;
-                    if (len > sizeof(dst) - 1) len = sizeof(dst) - 1;
-                    memcpy(dst, conn->req_addr, len);
-                    dst[len] = '\0';
-                } else if (conn->req_atyp == 0x04) {
-                    inet_ntop(AF_INET6, conn->req_addr, dst, sizeof(dst));
-                } else {
-                    snprintf(dst, sizeof(dst), "unknown");
-                }
-                
-                char username[256] = "";
-                char password[256] = "";
-                
-                if (conn->sniff_protocol == PROTO_POP3) {
-                    pop3_sniffer_get_credentials(&conn->pop3_state, username, password);
-                    credentials_log_record("POP3", src_ip, dst, conn->req_port, username, password);
-                } else if (conn->sniff_protocol == PROTO_HTTP) {
-                    http_sniffer_get_credentials(&conn->http_state, username, password);
-                    credentials_log_record("HTTP", src_ip, dst, conn->req_port, username, password);
+    } else if (ch->direction == O2C) {
+        m->bytes_origin_to_client += (uint64_t)n;
+    }
+}
+
+// Del socket al pipe, sin pasar por user space
+static enum tunnel_status channel_splice_in(struct selector_key *key, struct data_channel *ch, bool *read_closed_flag) {
+    struct socks5_conn *conn = key->data;
+    while (true) {
+        const size_t space = ch->pipe_cap - ch->pipe_len;
+        if (space == 0 || ch->pipe_full) {
+            // idem buffer lleno en channel_read
+            selector_rearm(key->s, *ch->src_fd);
+            return TUNNEL_STAY;
+        }
+        if (budget_exhausted(key, ch->src_budget, *ch->src_fd)) {
+            return TUNNEL_STAY;
+        }
+        const size_t asked = channel_allow(key, conn, ch, space);
+        if (asked == 0) {
+            return TUNNEL_STAY;
+        }
+
+        const ssize_t n = splice(*ch->src_fd, NULL, ch->pipe[1], NULL, asked,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        budget_charge(ch->src_budget, n > 0 ? (size_t)n : 0);
+        metrics_get()->tunnel_reads++;
+        if (n == 0) {
+            channel_read_closed(ch, read_closed_flag);
+            return TUNNEL_STAY;
+        }
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // el pipe se llena por cantidad de segmentos, no de bytes:
+                // con datos adentro EAGAIN puede ser el pipe y no el socket.
+                // Se deja de leer hasta que channel_splice_out lo vacíe.
+                if (ch->pipe_len > 0) {
+                    ch->pipe_full = true;
                 }
-                
-                conn->credentials_logged = true;
+                return TUNNEL_STAY;
             }
+            return TUNNEL_ERROR;
+        }
+
+        ch->pipe_len += (size_t)n;
+        ch->write_enabled = true;
+        channel_count(ch, (size_t)n);
+        ratelimit_charge(&conn->ratelimit, (size_t)n);
+        metrics_get()->bytes_spliced += (uint64_t)n;
+
+        if (!channel_keep_going(key)) {
+            return TUNNEL_STAY;
         }
-    } else if (ch->direction == O2C) {
-        m->bytes_origin_to_client += (uint64_t)n;
     }
+}
 
-    return TUNNEL_STAY;
+// Del pipe al socket destino. `rearm': ver channel_flush
+static enum tunnel_status channel_splice_out(struct selector_key *key, struct data_channel *ch, bool rearm) {
+    while (true) {
+        if (ch->pipe_len == 0) {
+            ch->write_enabled = false;
+            if (!ch->read_enabled && *ch->dst_fd != -1) {
+                shutdown(*ch->dst_fd, SHUT_WR);
+            }
+            return TUNNEL_STAY;
+        }
+        if (budget_exhausted(key, ch->dst_budget, *ch->dst_fd)) {
+            return TUNNEL_STAY;
+        }
+
+        const size_t asked = ch->pipe_len;
+        const ssize_t n = splice(ch->pipe[0], NULL, *ch->dst_fd, NULL, asked,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        budget_charge(ch->dst_budget, n > 0 ? (size_t)n : 0);
+        metrics_get()->tunnel_writes++;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                metrics_get()->writes_deferred++;
+                return TUNNEL_STAY;
+            }
+            return TUNNEL_ERROR;
+        }
+        if (n == 0) {
+            return TUNNEL_ERROR;
+        }
+
+        ch->pipe_len -= (size_t)n;
+        if (ch->pipe_full) {
+            // hay lugar de nuevo; el origen puede seguir listo sin otro aviso
+            ch->pipe_full = false;
+            if (*ch->src_fd != -1 && ch->read_enabled) {
+                selector_rearm(key->s, *ch->src_fd);
+            }
+        }
+        if (ch->pipe_len == 0) {
+            ch->write_enabled = false;
+            if (rearm) {
+                selector_rearm(key->s, *ch->dst_fd);
+            }
+            if (!ch->read_enabled) {
+                shutdown(*ch->dst_fd, SHUT_WR);
+            }
+            return TUNNEL_STAY;
+        }
+
+        if (!channel_keep_going(key)) {
+            metrics_get()->writes_deferred++;
+            return TUNNEL_STAY;
+        }
+    }
 }
 
-enum tunnel_status channel_write(struct selector_key *key, struct data_channel *ch) {
-    (void)key;
-    if (*ch->dst_fd == -1 || ch->dst_buffer == NULL) {
+// Lee del origen del canal hacia su buffer (o su pipe)
+static enum tunnel_status channel_fill(struct selector_key *key, struct data_channel *ch, bool *read_closed_flag) {
+    if (!ch->read_enabled || ch->throttled || *ch->src_fd == -1 || ch->dst_buffer == NULL) {
         return TUNNEL_STAY;
     }
 
-    size_t available;
-    uint8_t *read_ptr = buffer_read_ptr(ch->dst_buffer, &available);
-    if (available == 0) {
-        ch->write_enabled = false;
-        
-        if (!ch->read_enabled && *ch->dst_fd != -1) {
-            shutdown(*ch->dst_fd, SHUT_WR);
-        }
-        
-        return TUNNEL_STAY;
+    struct socks5_conn *conn = (struct socks5_conn *)key->data;
+    if (ch->parked && !channel_unpark(key, conn, ch)) {
+        return TUNNEL_ERROR;
+    }
+    if (channel_try_splice(conn, ch)) {
+        return channel_splice_in(key, ch, read_closed_flag);
     }
 
-    const ssize_t n = send(*ch->dst_fd, read_ptr, available, MSG_NOSIGNAL);
-    if (n < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    while (true) {
+        struct iovec iov[2];
+        int iovcnt = ring_write_iov(ch->dst_buffer, iov);
+        const size_t space = ring_iov_len(iov, iovcnt);
+        if (space == 0) {
+            // buffer lleno: se deja de pedir OP_READ hasta que se vacíe. Si
+            // se vacía en esta misma iteración el interés queda igual y, sin
+            // haber llegado a EAGAIN, en edge-triggered no habría otro aviso.
+            selector_rearm(key->s, *ch->src_fd);
+            return TUNNEL_STAY;
+        }
+        if (budget_exhausted(key, ch->src_budget, *ch->src_fd)) {
+            return TUNNEL_STAY;
+        }
+        const size_t asked = channel_allow(key, conn, ch, space);
+        if (asked == 0) {
+            return TUNNEL_STAY;
+        }
+        iovcnt = ring_iov_trim(iov, iovcnt, asked);
+
+        const ssize_t n = readv(*ch->src_fd, iov, iovcnt);
+        budget_charge(ch->src_budget, n > 0 ? (size_t)n : 0);
+        metrics_get()->tunnel_reads++;
+        if (n == 0) {
+            channel_read_closed(ch, read_closed_flag);
+            return TUNNEL_STAY;
+        }
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return TUNNEL_STAY;
+            }
+            return TUNNEL_ERROR;
+        }
+
+        ring_write_adv(ch->dst_buffer, (size_t)n);
+        ch->write_enabled = true;
+
+        channel_count(ch, (size_t)n);
+        ratelimit_charge(&conn->ratelimit, (size_t)n);
+        if (ch->direction == C2O) {
+            // lo recibido puede haber quedado partido en los dos tramos
+            size_t left = (size_t)n;
+            for (int i = 0; i < iovcnt && left > 0; i++) {
+                const size_t len = iov[i].iov_len < left ? iov[i].iov_len : left;
+                channel_sniff(conn, iov[i].iov_base, len);
+                left -= len;
+            }
+        }
+
+        // puede cambiar el buffer: `iov' deja de ser válido
+        if ((size_t)n == space) {
+            channel_filled(key, conn, ch);
+        } else {
+            ch->fills = 0;
+        }
+
+        if (!channel_keep_going(key)) {
             return TUNNEL_STAY;
         }
-        return TUNNEL_ERROR;
     }
+}
 
-    if (n == 0) {
-        return TUNNEL_ERROR;
+// Escribe en el destino lo pendiente del canal. Al vaciarlo se fuerza un
+// nuevo aviso del destino (`rearm'), salvo que no haya tenido OP_WRITE.
+static enum tunnel_status channel_flush(struct selector_key *key, struct data_channel *ch, bool rearm) {
+    if (*ch->dst_fd == -1 || ch->dst_buffer == NULL) {
+        return TUNNEL_STAY;
     }
+    if (ch->splicing) {
+        return channel_splice_out(key, ch, rearm);
+    }
+
+    bool may_zerocopy = true;
+
+    while (true) {
+        struct iovec iov[2];
+        const int iovcnt = ring_read_iov(ch->dst_buffer, iov);
+        const size_t available = ring_iov_len(iov, iovcnt);
+        if (available == 0) {
+            ch->write_enabled = false;
+
+            if (!ch->read_enabled && *ch->dst_fd != -1) {
+                shutdown(*ch->dst_fd, SHUT_WR);
+            }
+
+            return TUNNEL_STAY;
+        }
+        if (budget_exhausted(key, ch->dst_budget, *ch->dst_fd)) {
+            return TUNNEL_STAY;
+        }
+
+        // writev(2) vía sendmsg para no recibir SIGPIPE
+        struct msghdr msg = {
+            .msg_iov    = iov,
+            .msg_iovlen = (size_t)iovcnt,
+        };
+        const bool zerocopy = may_zerocopy && channel_zerocopy(ch, available);
+        if (ch->zerocopy && available >= zerocopy_min && !zerocopy) {
+            metrics_get()->zerocopy_fallback++;
+        }
+        const ssize_t n = sendmsg(*ch->dst_fd, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        budget_charge(ch->dst_budget, n > 0 ? (size_t)n : 0);
+        metrics_get()->tunnel_writes++;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                metrics_get()->writes_deferred++;
+                return TUNNEL_STAY;
+            }
+            if (zerocopy && errno == ENOBUFS) {
+                // no hay memoria para retener más páginas (optmem_max)
+                may_zerocopy = false;
+                continue;
+            }
+            return TUNNEL_ERROR;
+        }
 
-    buffer_read_adv(ch->dst_buffer, (size_t)n);
-    if (!buffer_can_read(ch->dst_buffer)) {
-        ch->write_enabled = false;
-        
-        if (!ch->read_enabled && *ch->dst_fd != -1) {
-            shutdown(*ch->dst_fd, SHUT_WR);
+        if (n == 0) {
+            return TUNNEL_ERROR;
+        }
+
+        channel_sent(ch, (size_t)n, zerocopy);
+        if (!ring_can_read(ch->dst_buffer)) {
+            ch->write_enabled = false;
+            // idem channel_fill: el socket sigue escribible sin otro aviso
+            if (rearm) {
+                selector_rearm(key->s, *ch->dst_fd);
+            }
+
+            if (!ch->read_enabled && *ch->dst_fd != -1) {
+                shutdown(*ch->dst_fd, SHUT_WR);
+            }
+            return TUNNEL_STAY;
+        }
+
+        if (!channel_keep_going(key)) {
+            metrics_get()->writes_deferred++;
+            return TUNNEL_STAY;
         }
     }
-    return TUNNEL_STAY;
+}
+
+// Lo leído se intenta escribir en el acto, sin esperar a que el selector
+// avise que el destino es escribible: casi siempre lo es, y así se ahorra
+// una vuelta del loop y el alta y baja de OP_WRITE. Solo si el envío queda
+// corto (EAGAIN o escritura parcial) se pide OP_WRITE. Si ya había datos
+// pendientes el destino tiene OP_WRITE y se espera ese aviso.
+enum tunnel_status channel_read(struct selector_key *key, struct data_channel *ch, bool *read_closed_flag) {
+    const bool idle = !channel_has_pending(ch);
+    const enum tunnel_status st = channel_fill(key, ch, read_closed_flag);
+    if (st != TUNNEL_STAY || !idle || !channel_has_pending(ch)) {
+        return st;
+    }
+    return channel_flush(key, ch, false);
+}
+
+enum tunnel_status channel_write(struct selector_key *key, struct data_channel *ch) {
+    return channel_flush(key, ch, true);
 }
 
 bool tunnel_finished(const struct socks5_conn *conn) {
     return !conn->chan_c2o.read_enabled &&
            !conn->chan_o2c.read_enabled &&
-           !buffer_can_read((buffer *)&conn->client_to_origin_buf) &&
-           !buffer_can_read((buffer *)&conn->origin_to_client_buf);
+           !channel_has_pending(&conn->chan_c2o) &&
+           !channel_has_pending(&conn->chan_o2c) &&
+           !channel_pinned(&conn->chan_c2o) &&
+           !channel_pinned(&conn->chan_o2c);
 }
 
 void tunnel_update_interest(struct socks5_conn *conn, fd_selector s) {
     if (conn->client_fd != -1) {
         fd_interest ci = OP_NOOP;
-        if (conn->chan_c2o.read_enabled && buffer_can_write(&conn->client_to_origin_buf)) {
+        if (conn->chan_c2o.read_enabled && !conn->chan_c2o.throttled && channel_has_space(&conn->chan_c2o)) {
             ci |= OP_READ;
         }
-        if (conn->chan_o2c.write_enabled && buffer_can_read(&conn->origin_to_client_buf)) {
+        if (conn->chan_o2c.write_enabled && channel_has_pending(&conn->chan_o2c)) {
             ci |= OP_WRITE;
         }
+        if (channel_pinned(&conn->chan_o2c)) {
+            ci |= OP_ERROR;
+        }
         selector_set_interest(s, conn->client_fd, ci);
     }
 
     if (conn->origin_fd != -1) {
         fd_interest oi = OP_NOOP;
-        if (conn->chan_o2c.read_enabled && buffer_can_write(&conn->origin_to_client_buf)) {
+        if (conn->chan_o2c.read_enabled && !conn->chan_o2c.throttled && channel_has_space(&conn->chan_o2c)) {
             oi |= OP_READ;
         }
-        if (conn->chan_c2o.write_enabled && buffer_can_read(&conn->client_to_origin_buf)) {
+        if (conn->chan_c2o.write_enabled && channel_has_pending(&conn->chan_c2o)) {
             oi |= OP_WRITE;
         }
+        if (channel_pinned(&conn->chan_c2o)) {
+            oi |= OP_ERROR;
+        }
         selector_set_interest(s, conn->origin_fd, oi);
     }
 }
 
-void tunnel_activate(struct socks5_conn *conn, fd_selector s) {
+// Lo que el cliente mandó detrás del pedido, antes de la respuesta, pasa al
+// buffer hacia el origin; entra entero porque el buffer recién pedido es al
+// menos tan grande como read_buf. Lo que ya viajó en el SYN (TCP Fast Open,
+// ver connect_set_fastopen) no se reenvía. El disector lo ve todo.
+static void tunnel_early_data(struct socks5_conn *conn) {
+    size_t n;
+    const uint8_t *data = buffer_read_ptr(&conn->read_buf, &n);
+    if (n == 0) {
+        return;
+    }
+    channel_count(&conn->chan_c2o, n);
+    channel_sniff(conn, data, n);
+
+    const size_t sent = conn->connect.fastopen_sent < n ? conn->connect.fastopen_sent : n;
+    size_t left = n - sent;
+    const uint8_t *p = data + sent;
+    struct iovec iov[2];
+    const int iovcnt = ring_write_iov(&conn->client_to_origin_buf, iov);
+    for (int i = 0; i < iovcnt && left > 0; i++) {
+        const size_t len = iov[i].iov_len < left ? iov[i].iov_len : left;
+        memcpy(iov[i].iov_base, p, len);
+        ring_write_adv(&conn->client_to_origin_buf, len);
+        p += len;
+        left -= len;
+    }
+    buffer_read_adv(&conn->read_buf, n);
+}
+
+bool tunnel_activate(struct socks5_conn *conn, fd_selector s) {
+    if (!channel_resize(&conn->chan_c2o, 0) || !channel_resize(&conn->chan_o2c, 0)) {
+        return false;
+    }
     conn->chan_c2o.read_enabled = !conn->client_read_closed;
     conn->chan_o2c.read_enabled = !conn->origin_read_closed;
-    conn->chan_c2o.write_enabled = buffer_can_read(&conn->client_to_origin_buf);
-    conn->chan_o2c.write_enabled = buffer_can_read(&conn->origin_to_client_buf);
+    conn->chan_c2o.write_enabled = ring_can_read(&conn->client_to_origin_buf);
+    conn->chan_o2c.write_enabled = ring_can_read(&conn->origin_to_client_buf);
+    tunnel_budget_setup(conn, s);
+    tunnel_zerocopy_setup(conn, s);
+    tunnel_lowat_setup(conn);
+    if (!ratelimit_attach(&conn->ratelimit, conn->username)) {
+        metrics_get()->ratelimit_untracked++;
+    }
+    tunnel_flow_setup(conn, s);
+    tunnel_park_arm(conn, s);
     
     // Detectar protocolo por puerto (incluye puertos estándar + testing)
     if (conn->req_port == 110 || conn->req_port == 11110) {
@@ -307,8 +1378,12 @@ void tunnel_activate(struct socks5_conn *conn, fd_selector s) {
     } else {
         conn->sniff_protocol = PROTO_NONE;
     }
-    
+
+    tunnel_early_data(conn);
+    conn->chan_c2o.write_enabled = ring_can_read(&conn->client_to_origin_buf);
+
     tunnel_update_interest(conn, s);
+    return true;
 }
 
 // ============================================================================
@@ -375,7 +1450,9 @@ unsigned client_reply_on_write_ready(struct selector_key *key) {
             stm_handler_read(&conn->origin_stm, key);
         }
 
-        tunnel_activate(conn, key->s);
+        if (!tunnel_activate(conn, key->s)) {
+            return C_ERROR;
+        }
         return C_REPLY;
     }
 
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "../helpers/buffer.h"
+#include "../helpers/ring.h"
 #include "../helpers/selector.h"
 
 // ===========================================================================
@@ -20,13 +21,114 @@ enum channel_direction {
     O2C
 };
 
+/**
+ * trabajo hecho sobre un fd en una iteración del selector. Se compara contra
+ * el presupuesto configurado (ver tunnel_set_budget).
+ */
+struct io_budget {
+    /** iteración del selector a la que corresponden los contadores */
+    uint64_t iteration;
+    size_t   bytes;
+    unsigned ops;
+};
+
+/** límites por fd y por iteración. 0: sin límite */
+struct tunnel_budget {
+    size_t   bytes;
+    unsigned ops;
+};
+
+#define TUNNEL_DEFAULT_BUDGET_BYTES (64 * 1024)
+#define TUNNEL_DEFAULT_BUDGET_OPS   16
+
+/** capacidad que se asume para un pipe si F_GETPIPE_SZ falla */
+#define TUNNEL_PIPE_MIN_SIZE        (16 * 4096)
+
+/** clases de tamaño de los buffers de túnel: 4K, 16K, 64K y 256K */
+#define TUNNEL_BUFFER_CLASSES       4
+#define TUNNEL_BUFFER_MIN           (4 * 1024)
+/** lecturas seguidas que llenan el buffer antes de pasar a la clase siguiente */
+#define TUNNEL_GROW_FILLS           2
+/** período tras el cual un buffer que no se llenó baja una clase */
+#define TUNNEL_SHRINK_MS            1000
+/** memoria total para buffers de túnel, en MiB */
+#define TUNNEL_DEFAULT_BUFFER_MEMORY 256
+
+/** inactividad tras la cual un túnel devuelve sus buffers (ver tunnel_set_park) */
+#define TUNNEL_DEFAULT_PARK_MS      10000
+
+/** envíos con MSG_ZEROCOPY sin confirmar por canal */
+#define TUNNEL_ZEROCOPY_INFLIGHT    32
+/** plazo para que el kernel suelte el buffer de un canal cerrado, cada
+    cuánto se mira y la espera extra si hubo que cortar con RST (ver
+    tunnel_release) */
+#define TUNNEL_ZEROCOPY_DRAIN_MS        5000
+#define TUNNEL_ZEROCOPY_DRAIN_TICK_MS   20
+#define TUNNEL_ZEROCOPY_QUARANTINE_MS   1000
+/** bloque mínimo para usar MSG_ZEROCOPY (ver tunnel_set_zerocopy) */
+#define TUNNEL_DEFAULT_ZEROCOPY_MIN (16 * 1024)
+
+/** uso de los buffers de túnel, para monitoreo */
+struct tunnel_buffers_stats {
+    size_t memory;
+    size_t memory_max;
+    /** túneles estacionados: sin buffer en ninguna dirección */
+    size_t parked;
+    size_t size[TUNNEL_BUFFER_CLASSES];
+    size_t in_use[TUNNEL_BUFFER_CLASSES];
+};
+
 struct data_channel {
     int *src_fd;
     int *dst_fd;
-    buffer *dst_buffer;
+    /** presupuestos de los fds de origen y destino */
+    struct io_budget *src_budget;
+    struct io_budget *dst_budget;
+    struct ring *dst_buffer;
+    /** clase de tamaño de `dst_buffer' (0: TUNNEL_BUFFER_MIN) */
+    uint8_t size_class;
+    /** lecturas seguidas que llenaron el buffer */
+    uint8_t fills;
+    /** se llenó desde el último tick de achique */
+    bool filled;
+    /** leyó algo desde el último tick de estacionamiento */
+    bool active;
+    /** idem, desde la última medición de TCP_INFO (ver tunnel_flow_tick) */
+    bool sampled_active;
+    /** sin buffer por inactividad; lo recupera en la próxima lectura */
+    bool parked;
     bool read_enabled;
     bool write_enabled;
+    /** sin tokens (ver ratelimit.h): no se lee hasta el timer de la conexión */
+    bool throttled;
     enum channel_direction direction;
+
+    /**
+     * modo splice(2) (ver tunnel_set_splice): los datos van del socket de
+     * origen a `pipe' y de ahí al de destino sin pasar por `dst_buffer'.
+     * Mientras no se usa, `pipe' vale {-1, -1}.
+     */
+    int pipe[2];
+    bool splicing;
+    /** no se pudo crear el pipe: el canal sigue copiando */
+    bool splice_failed;
+    /** bytes dentro del pipe y su capacidad */
+    size_t pipe_len;
+    size_t pipe_cap;
+    /** el pipe no aceptó más datos; se deja de leer hasta vaciarlo */
+    bool pipe_full;
+
+    /**
+     * MSG_ZEROCOPY (ver tunnel_set_zerocopy): el kernel numera los envíos de
+     * cada socket y avisa por la cola de errores cuando deja de usar su
+     * memoria. Hasta entonces esos bytes quedan retenidos en `dst_buffer'.
+     * `zc_sent' guarda los bytes de cada envío en vuelo, de `zc_first' a
+     * `zc_next' (módulo TUNNEL_ZEROCOPY_INFLIGHT).
+     */
+    bool zerocopy;
+    uint32_t zc_first;
+    uint32_t zc_next;
+    size_t zc_sent[TUNNEL_ZEROCOPY_INFLIGHT];
 };
 
 enum tunnel_status {
@@ -61,11 +163,79 @@ void origin_error_on_arrival(unsigned state, struct selector_key *key);
 // Funciones auxiliares de túnel
 // ===========================================================================
 
+/**
+ * configura cuánto puede leer/escribir un túnel sobre cada fd en una iteración
+ * del selector. Al agotarlo se deja el resto para la siguiente, así unos pocos
+ * flujos masivos no demoran a los interactivos ni a los handshakes. Solo se
+ * aplica con selectores edge-triggered.
+ */
+void tunnel_set_budget(const struct tunnel_budget *b);
+
+/**
+ * habilita el relay con splice(2): un canal al que no le mira el tráfico
+ * ningún disector (o cuyo disector ya terminó) mueve los datos a través de
+ * un pipe propio, sin copiarlos a user space. Cuesta dos fds por canal.
+ */
+void tunnel_set_splice(bool enabled);
+
+/**
+ * envía con MSG_ZEROCOPY los bloques de al menos `min' bytes de la dirección
+ * origen→cliente (0 lo deshabilita). El kernel lee directamente del buffer
+ * del túnel, que queda retenido hasta que avisa por la cola de errores del
+ * socket (OP_ERROR). Si el kernel informa que igual tuvo que copiar, la
+ * conexión vuelve a send(2) común. Requiere epoll o io_uring.
+ */
+void tunnel_set_zerocopy(size_t min);
+
+/**
+ * fija TCP_NOTSENT_LOWAT en `bytes' (0 lo deshabilita) en los sockets del
+ * cliente y del origen. El kernel solo acepta datos y reporta OP_WRITE
+ * mientras tenga menos de `bytes' sin enviar, así los datos en espera se
+ * quedan en los buffers del túnel (sujetos a los límites y presupuestos) en
+ * lugar de acumularse en el socket, que agrega latencia.
+ */
+void tunnel_set_notsent_lowat(unsigned bytes);
+
+/**
+ * un túnel cuyas dos direcciones pasan `ms' milisegundos sin datos devuelve
+ * sus buffers a los pools (0 lo deshabilita). Cada dirección vuelve a tomar
+ * uno mínimo cuando su origen tiene algo para leer. Pensado para conexiones
+ * largas y casi siempre quietas (websockets, IMAP IDLE, SSH).
+ */
+void tunnel_set_park(unsigned long ms);
+
+/** atiende la cola de errores de un socket del túnel (OP_ERROR) */
+enum tunnel_status tunnel_error_queue(struct selector_key *key);
+
+/**
+ * crea los pools de buffers de túnel. Cada dirección arranca con un buffer de
+ * TUNNEL_BUFFER_MIN; si las lecturas lo llenan una y otra vez (el destino no
+ * da abasto) pasa a la clase siguiente, y si deja de llenarse vuelve a bajar.
+ * Los buffers mayores al mínimo solo se conceden mientras el total no supere
+ * `memory_max' bytes. `prealloc' es la cantidad de buffers mínimos reservados.
+ */
+bool tunnel_buffers_init(size_t prealloc, size_t memory_max);
+/**
+ * tope por dirección para el crecimiento de los buffers: se redondea hacia
+ * abajo a una clase, nunca por debajo de TUNNEL_BUFFER_MIN (0: sin tope).
+ */
+void tunnel_set_buffer_max(size_t bytes);
+void tunnel_buffers_close(void);
+void tunnel_buffers_stats(struct tunnel_buffers_stats *out);
+
+/**
+ * cierra los pipes de la conexión y devuelve sus buffers. Idempotente. Un
+ * buffer que MSG_ZEROCOPY todavía usa no vuelve al pool: se lleva el socket
+ * de destino (que deja -1 en la conexión) y espera las notificaciones del
+ * kernel en `s'. `s' puede ser NULL si la conexión nunca tuvo túnel.
+ */
+void tunnel_release(struct socks5_conn *conn, fd_selector s);
+
 enum tunnel_status channel_read(struct selector_key *key, struct data_channel *ch, bool *read_closed_flag);
 enum tunnel_status channel_write(struct selector_key *key, struct data_channel *ch);
 bool tunnel_finished(const struct socks5_conn *conn);
 void tunnel_update_interest(struct socks5_conn *conn, fd_selector s);
-void tunnel_activate(struct socks5_conn *conn, fd_selector s);
+bool tunnel_activate(struct socks5_conn *conn, fd_selector s);
 
 // ===========================================================================
 // Funciones auxiliares de reply